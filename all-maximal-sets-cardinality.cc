@@ -23,19 +23,34 @@
 #include <iostream>
 #include <vector>
 #include "data-source-iterator.h"
+#include "memory-budget.h"
 #include "set-properties.h"
 
 namespace google_extremal_sets {
 
 namespace {
 
+// Memory used by each retained itemset besides its items: the header of
+// its copy in the arena, and its pointers in index_us and then in a
+// candidate list. Together with the items this also bounds the size of
+// the inline record of a small itemset.
+const size_t kBytesPerSet =
+    sizeof(SetProperties) + 2 * sizeof(SetProperties*);
+
+// A candidate list is compacted once more than 1/kCompactionRatio of
+// its entries are deleted. Compacting takes time linear in the length of
+// the list, which at least length/kCompactionRatio deletions must have
+// preceded, so the cost per deletion is constant.
+const size_t kCompactionRatio = 4;
+
 // Returns true if the elements in set #2 are all contained by
 // set #1.
+template <typename ItemId>
 inline bool DoesSubsume(
-    std::vector<uint32_t>::const_iterator it1,
-    const std::vector<uint32_t>::const_iterator it1_end,
-    const uint32_t* it2,
-    const uint32_t* const it2_end) {
+    const uint32_t* it1,
+    const uint32_t* const it1_end,
+    const ItemId* it2,
+    const ItemId* const it2_end) {
   while (it2 != it2_end) {
     it1 = std::lower_bound(it1, it1_end, *it2);
     if (it1 == it1_end || *it1 > *it2)
@@ -46,77 +61,242 @@ inline bool DoesSubsume(
   return true;
 }
 
+// Returns the itemset held by a candidate list entry, or NULL if the
+// entry has been deleted.
+template <typename ItemId>
+inline const BasicSetProperties<ItemId>* CandidateSet(
+    const BasicSetProperties<ItemId>* candidate) {
+  return candidate;
+}
+template <uint32_t Width, typename ItemId>
+inline const BasicSetProperties<ItemId>* CandidateSet(
+    const SmallSet<Width, ItemId>& candidate) {
+  return candidate.deleted() ? 0 : &candidate.set();
+}
+
+template <typename ItemId>
+inline void DeleteCandidate(BasicSetProperties<ItemId>** candidate) {
+  *candidate = 0;
+}
+template <uint32_t Width, typename ItemId>
+inline void DeleteCandidate(SmallSet<Width, ItemId>* candidate) {
+  candidate->Delete();
+}
+
+// The items of an input set from the one a candidate list is keyed by
+// onwards, against which the candidates of the list are checked. If
+// there are few enough of them, they are loaded into an ItemMatcher on
+// first use.
+class CurrentSuffix {
+ public:
+  CurrentSuffix(const uint32_t* begin, const uint32_t* end)
+      : begin_(begin), end_(end), matcher_loaded_(false) {}
+
+  // Returns true if all of the sorted items [it, it_end) are in the
+  // suffix.
+  template <typename ItemId>
+  bool Contains(const ItemId* it, const ItemId* it_end) {
+    uint32_t size = end_ - begin_;
+    if (size > ItemMatcher::kMaxItems)
+      return DoesSubsume(begin_, end_, it, it_end);
+    if (!matcher_loaded_) {
+      matcher_.Load(begin_, size);
+      matcher_loaded_ = true;
+    }
+    return matcher_.ContainsAll(it, it_end);
+  }
+
+ private:
+  const uint32_t* begin_;
+  const uint32_t* end_;
+  bool matcher_loaded_;
+  ItemMatcher matcher_;
+};
+
+// Deletes the candidates of the given size class that are subsumed by
+// the suffix, whose first item they are known to share. The scan ends
+// at the first candidate of more than max_size items, since those that
+// follow are at least as large. Returns false if it ended that way.
+template <typename ItemId, class Candidate>
+bool DeleteSubsumedFrom(std::vector<Candidate>* candidates,
+                        uint32_t max_size,
+                        CurrentSuffix* suffix,
+                        size_t* deleted,
+                        long long* subsumption_checks_count) {
+  for (size_t j = 0; j < candidates->size(); ++j) {
+    const BasicSetProperties<ItemId>* candidate =
+        CandidateSet((*candidates)[j]);
+    if (!candidate)
+      continue;
+    if (candidate->size > max_size)
+      return false;
+    // We need not check the first item, which is known to be the same
+    // as the first item of the suffix.
+    if (suffix->Contains(candidate->begin() + 1, candidate->end())) {
+      // Candidate is not maximal, so we delete it. Note that we must
+      // preserve the cardinality based ordering, so we only mark the
+      // entry deleted rather than performing any swapping. The memory
+      // of arena copies is reclaimed along with the rest of the pass by
+      // DumpMaximalSets.
+      DeleteCandidate(&(*candidates)[j]);
+      ++*deleted;
+    }
+    ++*subsumption_checks_count;
+  }
+  return true;
+}
+
+// Removes the deleted entries of the given size class, preserving the
+// order of the rest.
+template <class Candidate>
+void RemoveDeleted(std::vector<Candidate>* candidates) {
+  size_t out = 0;
+  for (size_t j = 0; j < candidates->size(); ++j) {
+    if (CandidateSet((*candidates)[j]))
+      (*candidates)[out++] = (*candidates)[j];
+  }
+  candidates->erase(candidates->begin() + out, candidates->end());
+}
+
 }  // namespace
 
 bool AllMaximalSetsCardinality::FindAllMaximalSets(
     DataSourceIterator* data,
     uint32_t max_item_id,
-    uint32_t max_items_in_ram,
+    uint64_t max_bytes_in_ram,
     OutputModeEnum output_mode) {
   Init();
+  const DatasetMetadata* metadata = data->GetMetadata();
+  if (metadata && metadata->sort_order != SORT_UNKNOWN &&
+      metadata->sort_order != SORT_CARDINALITY) {
+    std::cerr << "; ERROR: Dataset is not sorted by cardinality."
+              << std::endl;
+    return false;
+  }
+  // Candidates store 16-bit ids when the header shows that they all
+  // fit.
+  if (metadata && metadata->max_item_id <= kMaxNarrowItemId) {
+    return FindAllMaximalSetsIn(data, max_item_id, max_bytes_in_ram,
+                                output_mode, &narrow_candidates_);
+  }
+  return FindAllMaximalSetsIn(data, max_item_id, max_bytes_in_ram,
+                              output_mode, &candidates_);
+}
+
+template <typename ItemId>
+bool AllMaximalSetsCardinality::FindAllMaximalSetsIn(
+    DataSourceIterator* data,
+    uint32_t max_item_id,
+    uint64_t max_bytes_in_ram,
+    OutputModeEnum output_mode,
+    CandidateMap<ItemId>* candidates) {
+  typedef typename CandidateList<ItemId>::MediumCandidate MediumCandidate;
 
   // The index_us vector contains the previous itemsets whose
   // cardinality is the same as the current itemset. We delay their
   // indexing until they can potentially be subsumed; that is, when
   // the data iterator reaches itemsets with a higher cardinality.
-  std::vector<SetProperties*> index_us;
+  std::vector<BasicSetProperties<ItemId>*> index_us;
 
   // Vars set by the data source iterator.
   int result;
-  uint32_t set_id;
-  std::vector<uint32_t> current_set;
+  SetBatch batch;
 
   // This outer loop supports multiple passes over the data in the
-  // case where the dataset exceeds the bound on max_items_in_ram. As
+  // case where the dataset exceeds the bound on max_bytes_in_ram. As
   // long as resume_offset == 0, we will continue retaining itemsets
   // in RAM. Otherwise itemsets from the data iterator will be used
   // only to perform subsumption checks against existing candidates,
   // and will be indexed during a subsequent pass.
   off_t resume_offset = 0;
   do {  // while (resume_offset != 0)
-    if (!PrepareForDataScan(data, max_item_id, resume_offset))
+    if (!PrepareForDataScan(data, max_item_id, resume_offset, candidates))
       return false;  // IO error
     resume_offset = 0;
-    uint32_t items_in_ram = 0;
+    // Bytes used by the retained itemsets. The candidate map grows by
+    // at most one list per itemset, so it is accounted for between
+    // batches.
+    uint64_t bytes_in_ram = 0;
+    uint64_t map_bytes = candidates->Bytes();
     int current_set_size = -1;
 
-    // This loop scans the input data from beginning to end.
-    while ((result = data->Next(&set_id, &current_set)) > 0) {
-      DeleteSubsumedCandidates(current_set);
-
-      // If current_set has higher cardinality than the itemsets within
-      // index_us, we move them from index_us into the candidate index.
-      if (current_set.size() != static_cast<uint32_t>(current_set_size)) {
-        IndexSets(index_us);
-        index_us.clear();
-        current_set_size = current_set.size();
-      }
+    // This loop scans the input data from beginning to end. While we
+    // are retaining itemsets, batches are cut off at the set that
+    // reaches the RAM limit so that Tell() is the exact resume point.
+    while ((result = data->NextBatch(
+                &batch, kDefaultBatchSize,
+                resume_offset == 0 ?
+                    ItemsLeftInBudget(bytes_in_ram + map_bytes,
+                                      max_bytes_in_ram) :
+                    static_cast<size_t>(-1),
+                kBytesPerSet / sizeof(uint32_t))) > 0) {
+      for (size_t i = 0; i < batch.size(); ++i) {
+        const SetProperties& current_set = batch[i];
 
-      if (resume_offset == 0) {
-        // Copy the current_set into RAM and place a pointer to it in index_us.
-        index_us.push_back(SetProperties::Create(set_id, current_set));
-        items_in_ram += current_set.size();
-        ++input_sets_count_;
-
-        // Check if we've exceeded the RAM limit and if so stop
-        // retaining any further itemsets in memory until the next
-        // scan.
-        if (items_in_ram >= max_items_in_ram) {
-          resume_offset = data->Tell();
-          std::cerr << "; Halting indexing at input set number "
-                    << input_sets_count_ << " with id " << set_id << std::endl;
-          // Force the sets in index_us to get added to the index.
-          current_set_size = -1;
+        // If current_set has higher cardinality than the itemsets
+        // within index_us, we move them from index_us into the
+        // candidate index. This must precede the subsumption check
+        // since current_set may subsume them.
+        if (current_set.size != static_cast<uint32_t>(current_set_size)) {
+          IndexSets(index_us, candidates);
+          index_us.clear();
+          current_set_size = current_set.size;
         }
-      }  // if (resume_offset = 0)
-    }  // while ((result = data->Next())
+
+        DeleteSubsumedCandidates(current_set, candidates);
+
+        if (resume_offset == 0) {
+          // The items are checked before they are copied rather than
+          // trusting the max_item_id of the dataset header, since a
+          // stale header would otherwise have ids silently truncated.
+          if (!BasicSetProperties<ItemId>::Fits(current_set)) {
+            std::cerr << "; ERROR: Itemset " << current_set.set_id
+                      << " has an item id exceeding the max_item_id of "
+                      << "the dataset header." << std::endl;
+            return false;
+          }
+          if (current_set.size == 0 ||
+              current_set.size > MediumCandidate::kWidth) {
+            // Copy the current_set into RAM and place a pointer to it in
+            // index_us.
+            index_us.push_back(arena_.Create<ItemId>(current_set));
+            bytes_in_ram +=
+                kBytesPerSet + current_set.size * sizeof(ItemId);
+          } else {
+            // Small itemsets are copied into their candidate list
+            // right away. This is safe since a candidate list is only
+            // scanned up to the candidates at least as large as the
+            // input set.
+            bytes_in_ram += IndexSmallSet(current_set, candidates);
+          }
+          ++input_sets_count_;
+
+          // Check if we've exceeded the RAM limit and if so stop
+          // retaining any further itemsets in memory until the next
+          // scan. This is always the last set of the batch.
+          if (bytes_in_ram + map_bytes >= max_bytes_in_ram) {
+            resume_offset = data->Tell();
+            // The next pass resumes here, so streamed input must be
+            // kept from this point on.
+            if (!data->BeginSpill())
+              return false;
+            std::cerr << "; Halting indexing at input set number "
+                      << input_sets_count_ << " with id "
+                      << current_set.set_id << std::endl;
+            // Force the sets in index_us to get added to the index.
+            current_set_size = -1;
+          }
+        }  // if (resume_offset = 0)
+      }
+      map_bytes = candidates->Bytes();
+    }  // while ((result = data->NextBatch())
 
     if (result != 0)  // IO error
       return false;
 
     // At this point, any remaining candidate set and any remaining set
     // in index_us is maximal!
-    DumpMaximalSets(&index_us, output_mode);
+    DumpMaximalSets(&index_us, output_mode, candidates);
   } while (resume_offset != 0);
 
   return true;
@@ -126,110 +306,142 @@ void AllMaximalSetsCardinality::Init() {
   maximal_sets_count_ = input_sets_count_ = subsumption_checks_count_ = 0;
 }
 
+template <typename ItemId>
 bool AllMaximalSetsCardinality::PrepareForDataScan(
-    DataSourceIterator* data, uint32_t max_item_id, off_t resume_offset) {
-  assert(candidates_.size() == 0);
-  candidates_.resize(max_item_id);
+    DataSourceIterator* data, uint32_t, off_t resume_offset,
+    CandidateMap<ItemId>* candidates) {
+  assert(candidates->lists.size() == 0);
+  const DatasetMetadata* metadata = data->GetMetadata();
+  if (metadata) {
+    // There can be no more lists than distinct items or itemsets.
+    candidates->lists.reserve(
+        std::min<uint64_t>(static_cast<uint64_t>(metadata->max_item_id) + 1,
+                           metadata->set_count));
+  }
   std::cerr << "; Starting new dataset scan at offset: "
             << resume_offset << std::endl;
   return data->Seek(resume_offset);
 }
 
-void AllMaximalSetsCardinality::IndexSets(const std::vector<SetProperties*>& index_us) {
-  for (std::vector<SetProperties*>::const_iterator it = index_us.begin();
+template <typename ItemId>
+void AllMaximalSetsCardinality::IndexSets(
+    const std::vector<BasicSetProperties<ItemId>*>& index_us,
+    CandidateMap<ItemId>* candidates) {
+  for (typename std::vector<BasicSetProperties<ItemId>*>::const_iterator it =
+           index_us.begin();
        it != index_us.end();
        ++it) {
-    SetProperties* itemset_to_index = *it;
-    uint32_t item_id_to_index = itemset_to_index->item[0];
-    if (item_id_to_index >= candidates_.size())
-      candidates_.resize(item_id_to_index + 1);
-    candidates_[item_id_to_index].push_back(itemset_to_index);
+    BasicSetProperties<ItemId>* itemset_to_index = *it;
+    if (itemset_to_index->size == 0) {
+      candidates->empty_sets.push_back(itemset_to_index);
+    } else {
+      candidates->ListFor(itemset_to_index->item[0]).sets.push_back(
+          itemset_to_index);
+    }
   }
 }
 
-inline SetProperties* AllMaximalSetsCardinality::NextCandidate(
-    const CandidateList& candidates,
-    const std::vector<uint32_t>& current_set,
-    unsigned int current_index,
-    int* candidate_index) {
-  do {
-    ++(*candidate_index);
-    if (static_cast<unsigned int>(*candidate_index) == candidates.size())
-      return 0;
-  } while (!candidates[*candidate_index]);
-
-  SetProperties* candidate = candidates[*candidate_index];
-  if (current_set.size() - current_index < candidate->size)
-    return 0;  // remaining sets are too big to be subsumed
-  return candidate;
+template <typename ItemId>
+size_t AllMaximalSetsCardinality::IndexSmallSet(
+    const SetProperties& set, CandidateMap<ItemId>* candidates) {
+  typedef typename CandidateList<ItemId>::SmallCandidate SmallCandidate;
+  typedef typename CandidateList<ItemId>::MediumCandidate MediumCandidate;
+  CandidateList<ItemId>& list = candidates->ListFor(set.item[0]);
+  if (set.size <= SmallCandidate::kWidth) {
+    list.small.push_back(SmallCandidate(set));
+    return sizeof(SmallCandidate);
+  }
+  list.medium.push_back(MediumCandidate(set));
+  return sizeof(MediumCandidate);
 }
 
+template <typename ItemId>
 void AllMaximalSetsCardinality::DeleteSubsumedCandidates(
-    const std::vector<uint32_t>& current_set) {
-  std::vector<uint32_t>::const_iterator current_begin = current_set.begin();
-  std::vector<uint32_t>::const_iterator current_end = current_set.end();
-  SetProperties* candidate = 0;
-  for (unsigned int i = 0; i < current_set.size(); ++i, ++current_begin) {
-    if (candidates_.size() <= current_set[i])
-      return;
-    CandidateList& candidates = candidates_[current_set[i]];
-    int candidate_index = -1;
-    while ((candidate =
-           NextCandidate(
-               candidates,
-               current_set,
-               i,
-               &candidate_index))) {
-      // We must explicitly check subsumption. We need not check every
-      // item in each set because we already know:
-      // (1) the candidate does not contain any items within
-      // current_set[0] through current_set[i - 1].
-      // (2) the candidate's first item is already known to be
-      // the same as current_set[i].
-      // We adjust the iterators accordingly.
-      if (DoesSubsume(
-             current_begin, current_end,
-             candidate->begin() + 1, candidate->end())) {
-        // Candidate is not maximal, so we delete it. Note that we
-        // must preserve the cardinality based ordering, so we NULL
-        // out the pointer to the deleted entry rather than performing
-        // any swapping. TODO: Occasionally it might be beneficial to
-        // compress out the holes left by the NULL entries if we have
-        // accumulated a significant number of them.
-        candidates[candidate_index] = 0;
-        SetProperties::Delete(candidate);
-      }
-      ++subsumption_checks_count_;
+    const SetProperties& current_set, CandidateMap<ItemId>* map) {
+  if (current_set.size > 0)
+    map->empty_sets.clear();
+  const uint32_t* current_begin = current_set.begin();
+  const uint32_t* current_end = current_set.end();
+  for (unsigned int i = 0; i < current_set.size; ++i, ++current_begin) {
+    uint32_t slot = map->item_slots.Find(current_set[i]);
+    if (slot == ItemMap::kNoSlot)
+      continue;
+    CandidateList<ItemId>& candidates = map->lists[slot];
+    // Candidates can only be subsumed if they are smaller than
+    // current_set, and no larger than the part of it from item i on,
+    // since they do not contain any of current_set[0] through
+    // current_set[i - 1].
+    uint32_t max_size = std::min(current_set.size - 1, current_set.size - i);
+    CurrentSuffix suffix(current_begin, current_end);
+    if (DeleteSubsumedFrom<ItemId>(
+            &candidates.small, max_size, &suffix, &candidates.deleted,
+            &subsumption_checks_count_) &&
+        DeleteSubsumedFrom<ItemId>(
+            &candidates.medium, max_size, &suffix, &candidates.deleted,
+            &subsumption_checks_count_)) {
+      DeleteSubsumedFrom<ItemId>(
+          &candidates.sets, max_size, &suffix, &candidates.deleted,
+          &subsumption_checks_count_);
     }
+    // Once the scan of the list is over its holes can be compressed
+    // out.
+    if (candidates.deleted * kCompactionRatio > candidates.size())
+      CompactCandidates(&candidates);
   }
 }
 
+template <typename ItemId>
+void AllMaximalSetsCardinality::CompactCandidates(
+    CandidateList<ItemId>* candidates) {
+  RemoveDeleted(&candidates->small);
+  RemoveDeleted(&candidates->medium);
+  RemoveDeleted(&candidates->sets);
+  candidates->deleted = 0;
+}
+
+template <typename ItemId>
 void AllMaximalSetsCardinality::DumpMaximalSets(
-    std::vector<SetProperties*>* unindexed_sets,
-    OutputModeEnum output_mode) {
+    std::vector<BasicSetProperties<ItemId>*>* unindexed_sets,
+    OutputModeEnum output_mode,
+    CandidateMap<ItemId>* candidates) {
   for (unsigned int i = 0; i < unindexed_sets->size(); ++i) {
-    SetProperties* maximal_set = (*unindexed_sets)[i];
-    FoundMaximalSet(*maximal_set, output_mode);
-    SetProperties::Delete(maximal_set);
+    FoundMaximalSet(*(*unindexed_sets)[i], output_mode);
   }
   unindexed_sets->clear();
-  for (unsigned int i = 0; i < candidates_.size(); ++i) {
-    CandidateList& candidate_set = candidates_[i];
+  for (size_t i = 0; i < candidates->empty_sets.size(); ++i)
+    FoundMaximalSet(*candidates->empty_sets[i], output_mode);
+  candidates->empty_sets.clear();
+  // The lists are dumped in order of their items.
+  std::vector<uint32_t> slots;
+  candidates->item_slots.SlotsInItemOrder(&slots);
+  for (size_t i = 0; i < slots.size(); ++i) {
+    CandidateList<ItemId>& candidate_list = candidates->lists[slots[i]];
+    for (size_t j = 0; j < candidate_list.small.size(); ++j) {
+      if (!candidate_list.small[j].deleted())
+        FoundMaximalSet(candidate_list.small[j].set(), output_mode);
+    }
+    for (size_t j = 0; j < candidate_list.medium.size(); ++j) {
+      if (!candidate_list.medium[j].deleted())
+        FoundMaximalSet(candidate_list.medium[j].set(), output_mode);
+    }
+    std::vector<BasicSetProperties<ItemId>*>& candidate_set =
+        candidate_list.sets;
     for (unsigned int j = 0; j < candidate_set.size(); ++j) {
-      SetProperties* maximal_set = candidate_set[j];
-      if (maximal_set) {
+      BasicSetProperties<ItemId>* maximal_set = candidate_set[j];
+      if (maximal_set)
         FoundMaximalSet(*maximal_set, output_mode);
-        SetProperties::Delete(maximal_set);
-      }
     }
-    candidate_set.clear();
   }
-  candidates_.clear();
+  candidates->lists.clear();
+  candidates->item_slots.Clear();
+  arena_.Clear();
   std::cout << std::flush;
 }
 
+template <typename ItemId>
 void AllMaximalSetsCardinality::FoundMaximalSet(
-    const SetProperties& maximal_set, OutputModeEnum output_mode) {
+    const BasicSetProperties<ItemId>& maximal_set,
+    OutputModeEnum output_mode) {
   ++maximal_sets_count_;
   switch (output_mode) {
     case COUNT_ONLY:
@@ -40,11 +40,14 @@
 
 #include <vector>
 #include "basic-types.h"
+#include "huge-page-allocator.h"
+#include "item-map.h"
+#include "set-arena.h"
+#include "small-set.h"
 
 namespace google_extremal_sets {
 
 class DataSourceIterator;
-class SetProperties;
 
 class AllMaximalSetsCardinality {
  public:
@@ -57,23 +60,29 @@ class AllMaximalSetsCardinality {
   // call to data->GetErrorMessage() will return a human-readable
   // description of the problem.
   //
-  // The caller must provide an estimate of the max_item_id which will
-  // be used to preallocate buffers.  The correct output will be
-  // produced even if the estimates are inaccurate (provided there is
-  // sufficient memory for the buffers to be allocated to the
-  // specified size.)
+  // Item ids may be arbitrary 32-bit integers: the candidate map only
+  // holds lists for the items that begin some candidate, so its size
+  // does not depend on the largest item id, and max_item_id is
+  // ignored. If the dataset header records metadata (see
+  // DatasetMetadata), the map is preallocated from it, and datasets
+  // recorded as being sorted in other than cardinality order are
+  // rejected. If it shows that all item ids fit in 16 bits, the
+  // candidates store them as such, halving the memory they take and
+  // the bandwidth consumed by checking them.
   //
-  // The caller must also specify a bound on the number of 4-byte item
-  // ids that will be stored in main memory during algorithm
-  // execution. Should the dataset contain more items than the limit,
-  // the algorithm will switch to an "out of core" mode and perform
-  // multiple passes over the data in order to compute the output.
+  // The caller must also specify a bound on the number of bytes of
+  // main memory used by the candidates and the candidate index during
+  // algorithm execution (see memory-budget.h for choosing one); the
+  // buffers of the data source are not included. Should the
+  // candidates not fit, the algorithm will switch to an "out of core"
+  // mode and perform multiple passes over the data in order to compute
+  // the output.
   //
   // This method may output status & progress messages to stderr.
   bool FindAllMaximalSets(
       DataSourceIterator* data,
       uint32_t max_item_id,
-      uint32_t max_items_in_ram,
+      uint64_t max_bytes_in_ram,
       OutputModeEnum output_mode);
 
   // Returns the number of maximal sets found by the last call to
@@ -93,48 +102,127 @@ class AllMaximalSetsCardinality {
   // initialization.
   void Init();
 
+  // A list of itemsets used to store candidates within the candidate
+  // map, with item ids of type ItemId. Candidates of up to 4 and up to
+  // 8 items are stored inline in records of the small and medium size
+  // classes, and larger ones in the arena. Since candidates are added
+  // in order of cardinality, the small candidates precede the medium
+  // ones, which precede those in sets. Deleted candidates are marked
+  // deleted (or NULLed out) to preserve the order of the rest, and
+  // compressed out by CompactCandidates once they make up a large
+  // enough share of the list.
+  template <typename ItemId>
+  struct CandidateList {
+    typedef SmallSet<4, ItemId> SmallCandidate;
+    typedef SmallSet<8, ItemId> MediumCandidate;
+
+    CandidateList() : deleted(0) {}
+    size_t size() const { return small.size() + medium.size() + sets.size(); }
+
+    std::vector<SmallCandidate> small;
+    std::vector<MediumCandidate> medium;
+    std::vector<BasicSetProperties<ItemId>*> sets;
+    // Number of deleted entries.
+    size_t deleted;
+  };
+
+  // Maps each item to a list of "candidate itemsets", each of which
+  // contains the item as its first entry.  Itemsets in each candidate
+  // list appear in increasing order of cardinality. Some entries may
+  // be NULL. The list of an item is lists[item_slots.Find(item)].
+  template <typename ItemId>
+  struct CandidateMap {
+    // Returns the candidate list for the given item, adding one to the
+    // map if needed.
+    CandidateList<ItemId>& ListFor(uint32_t item) {
+      uint32_t slot = item_slots.Insert(item);
+      if (slot == lists.size())
+        lists.push_back(CandidateList<ItemId>());
+      return lists[slot];
+    }
+
+    // Returns the bytes of memory used by the map itself, not counting
+    // the candidates.
+    uint64_t Bytes() const {
+      return lists.capacity() * sizeof(CandidateList<ItemId>) +
+          item_slots.BytesUsed();
+    }
+
+    std::vector<CandidateList<ItemId>,
+                HugePageAllocator<CandidateList<ItemId> > > lists;
+    ItemMap item_slots;
+
+    // Empty itemsets have no first item to be listed under. They are
+    // subsumed by the first non-empty itemset that follows them.
+    std::vector<BasicSetProperties<ItemId>*> empty_sets;
+  };
+
+  // Does the work of FindAllMaximalSets with candidates whose item ids
+  // are of type ItemId, held by the given map.
+  template <typename ItemId>
+  bool FindAllMaximalSetsIn(
+      DataSourceIterator* data,
+      uint32_t max_item_id,
+      uint64_t max_bytes_in_ram,
+      OutputModeEnum output_mode,
+      CandidateMap<ItemId>* candidates);
+
   // Prepare datastructures for scanning the data beginning at the
   // provided offset. Returns false if IO error encountered.
+  template <typename ItemId>
   bool PrepareForDataScan(
-      DataSourceIterator* data, uint32_t max_item_i, off_t seek_offset);
+      DataSourceIterator* data, uint32_t max_item_i, off_t seek_offset,
+      CandidateMap<ItemId>* candidates);
 
-  // A list of itemsets used to store candidates within the candidate
-  // map.
-  typedef std::vector<SetProperties*> CandidateList;
+  // Places an itemset of 1 to MediumCandidate::kWidth items straight
+  // into the candidate index. Returns the number of bytes this used.
+  template <typename ItemId>
+  size_t IndexSmallSet(
+      const SetProperties& set, CandidateMap<ItemId>* candidates);
 
   // Place all sets from index_us into the candidate index.
-  void IndexSets(const std::vector<SetProperties*>& index_us);
+  template <typename ItemId>
+  void IndexSets(const std::vector<BasicSetProperties<ItemId>*>& index_us,
+                 CandidateMap<ItemId>* candidates);
 
   // Delete all sets in RAM that are proper subsets of the given set.
-  void DeleteSubsumedCandidates(const std::vector<uint32_t>& input_set);
-
-  // Candidate iterator method used by DeleteSubsumedCandidates for
-  // each candidate list.
-  SetProperties* NextCandidate(
-      const CandidateList& candidates,
-      const std::vector<uint32_t>& current_set,
-      unsigned int current_index,
-      int* candidate_index);
-
-  // Dump out & delete all sets that remain in the candidate index and
-  // those in the list of unindexed_sets.
+  template <typename ItemId>
+  void DeleteSubsumedCandidates(const SetProperties& input_set,
+                                CandidateMap<ItemId>* candidates);
+
+  // Removes the deleted entries from the candidate list, preserving
+  // the order of the rest.
+  template <typename ItemId>
+  void CompactCandidates(CandidateList<ItemId>* candidates);
+
+  // Dump out all sets that remain in the candidate index and those in
+  // the list of unindexed_sets, then release them all.
+  template <typename ItemId>
   void DumpMaximalSets(
-      std::vector<SetProperties*>* unindexed_sets,
-      OutputModeEnum output_mode);
+      std::vector<BasicSetProperties<ItemId>*>* unindexed_sets,
+      OutputModeEnum output_mode,
+      CandidateMap<ItemId>* candidates);
 
   // Invoked for each maximal set found.
-  void FoundMaximalSet(const SetProperties& maximal_set, OutputModeEnum mode);
+  template <typename ItemId>
+  void FoundMaximalSet(const BasicSetProperties<ItemId>& maximal_set,
+                       OutputModeEnum mode);
 
   // Stats variables.
   long maximal_sets_count_;
   long input_sets_count_;
   long long subsumption_checks_count_;
 
-  // Maps each item to a list of "candidate itemsets", each of which
-  // contains the item as its first entry.  Itemsets in each candidate
-  // list appear in increasing order of cardinality. Some entries may
-  // be NULL.
-  std::vector<CandidateList> candidates_;
+  // The candidate map, with 32-bit item ids, and with 16-bit ones for
+  // datasets whose ids all fit. Only one is used by each call to
+  // FindAllMaximalSets.
+  CandidateMap<uint32_t> candidates_;
+  CandidateMap<uint16_t> narrow_candidates_;
+
+  // Holds the itemsets retained during the current pass. Subsumed
+  // candidates are only NULLed out, and the whole pass is released at
+  // once by DumpMaximalSets.
+  SetArena arena_;
 };
 
 }  // namespace google_extremal_sets
@@ -19,113 +19,568 @@
 
 #include "all-maximal-sets-lexicographic.h"
 #include <assert.h>
+#include <pthread.h>
 #include <algorithm>
 #include <functional>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <vector>
 #include "data-source-iterator.h"
+#include "index-snapshot.h"
+#include "memory-budget.h"
 #include "set-properties.h"
 
 namespace google_extremal_sets {
 
 namespace {
 
-// Perform a binary search to find the first non-NULL candidate in the
-// range such that comp(current_item, candidate[depth]) no longer holds.
-template<class Compare>
-AllMaximalSetsLexicographic::CandidateList::iterator find_new_it(
-    AllMaximalSetsLexicographic::CandidateList::iterator first,
-    AllMaximalSetsLexicographic::CandidateList::iterator last,
+// The item index is dense unless the first item of the last candidate
+// is at least kMaxDenseIndexRatio times the number of distinct first
+// items, in which case a sparse index, which is searched rather than
+// indexed, takes less memory.
+const uint64_t kMaxDenseIndexRatio = 4;
+
+inline bool UseDenseIndex(uint64_t first_items, uint32_t last_first_item) {
+  return last_first_item < kMaxDenseIndexRatio * first_items;
+}
+
+// Returns the bytes of memory used by the item index over candidates
+// with the given number of distinct first items.
+inline uint64_t IndexBytes(uint64_t first_items, uint32_t last_first_item) {
+  if (!first_items)
+    return 0;
+  if (UseDenseIndex(first_items, last_first_item))
+    return (static_cast<uint64_t>(last_first_item) + 1) * sizeof(size_t);
+  return first_items * (sizeof(uint32_t) + sizeof(size_t)) + sizeof(size_t);
+}
+
+// Threads of DeleteSubsumedWithinChunk take this many candidates at a
+// time, which is the number covered by a word of the bitmap of live
+// candidates.
+const size_t kScanBlockSize = 64;
+
+// Find the first candidate in the range, live or not, such that
+// comp(current_item, candidate[depth]) no longer holds, given that it
+// holds for the candidate at first. Deleted candidates keep their items
+// and their place in the sorted order, so unlike a search over the live
+// candidates only, this never has to step over deleted ones, and the
+// ranges it delimits hold only candidates sharing their prefix. The
+// position sought is usually near first, so rather than bisecting the
+// whole range, gallop ahead of first by doubling steps and bisect only
+// the last step.
+template<typename ItemId, class Compare>
+size_t find_new_it(
+    const CandidateStore<ItemId>& candidates,
+    size_t first,
+    size_t last,
     uint32_t current_item,
     unsigned int depth,
     Compare comp) {
-  while (first != last && !*first)
-    ++first;
-  int len = last - first;
-  int half;
-  AllMaximalSetsLexicographic::CandidateList::iterator current;
-  while (len > 0) {
-    half = len >> 1;
-    current = first + half;
-    while (current < last && !*current)
-      ++current;
-    if (current == last) {
-      len = half;
-    } else if (comp(current_item, (**current)[depth])) {
-      // Not far enough along yet!
-      first += half + 1;
-      len = len - half - 1;
-      while (first < last && !*first) {
-        ++first;
-        --len;
-      }
-      if (first == last)
-        return last;
-    } else {
-      // We may be too far along.
-      len = half;
+  assert(first != last && comp(current_item, candidates.Item(first, depth)));
+  // comp holds at low and does not hold at high or after it.
+  size_t low = first;
+  size_t high = last;
+  size_t step = 1;
+  while (step < high - low) {
+    size_t probe = low + step;
+    if (!comp(current_item, candidates.Item(probe, depth))) {
+      high = probe;
+      break;
     }
+    low = probe;
+    step <<= 1;
+  }
+  ++low;
+  while (low < high) {
+    size_t middle = low + ((high - low) >> 1);
+    if (comp(current_item, candidates.Item(middle, depth)))
+      low = middle + 1;
+    else
+      high = middle;
   }
-  assert(*first);
-  return first;
+  return low;
 }
 
 }  // namespace
 
 bool AllMaximalSetsLexicographic::FindAllMaximalSets(DataSourceIterator* data, uint32_t) {
   Init();
+  if (UseNarrowItems(data))
+    return FindAllMaximalSetsIn(data, narrow_chunks_);
+  return FindAllMaximalSetsIn(data, chunks_);
+}
 
-  // Vars set by the data source iterator.
-  int result;
-  uint32_t set_id;
-  ItemSet current_set;
+bool AllMaximalSetsLexicographic::UseNarrowItems(
+    DataSourceIterator* data) const {
+  // Only copies can store narrower ids than the dataset.
+  const DatasetMetadata* metadata = data->GetMetadata();
+  return !data->IsMapped() && metadata &&
+      metadata->max_item_id <= kMaxNarrowItemId;
+}
+
+template <typename ItemId>
+bool AllMaximalSetsLexicographic::FindAllMaximalSetsIn(
+    DataSourceIterator* data, Chunk<ItemId>* chunks) {
+  bool fits_in_ram;
+  if (!PrepareCandidates(data, chunks, &fits_in_ram))
+    return false;
+  // Each chunk is read from where the previous one ended, which is
+  // before the sets read to find that end, so streamed input must be
+  // spilled unless it is known to fit in a single chunk.
+  if (!fits_in_ram && !data->BeginSpill())
+    return false;
 
   // This outer loop supports multiple passes over the data in the
-  // case where the dataset exceeds the bound on max_items_in_ram_. As
-  // long as resume_offset == 0, we will continue retaining itemsets
-  // in RAM.
-  off_t start_offset = 0;
-  off_t resume_offset = 0;
-  do {  // while (resume_offset != 0)
-    if (!PrepareForDataScan(data, resume_offset))
-      return false;  // IO error
-    start_offset = resume_offset;
+  // case where the dataset exceeds the bound on max_bytes_in_ram_. Each
+  // pass checks one chunk, and as long as its resume_offset == 0, we
+  // will continue retaining itemsets in RAM. If pipelined_, the next
+  // chunk is read and indexed by another thread while the current one
+  // is checked.
+  //
+  // Rather than rescanning all of the data preceding each chunk, which
+  // would make the passes quadratic in their number, the chunk is only
+  // checked against the maximal sets found so far, as kept in
+  // found_sets_. This suffices: a preceding set that is not maximal is
+  // contained in a maximal set that also precedes the chunk's
+  // candidates (since in lexicographic order the only supersets
+  // following a set are those it is a prefix of, which were handled
+  // by DeleteTriviallySubsumedCandidates), or that lies within the
+  // chunk itself.
+  Chunk<ItemId>* chunk = &chunks[0];
+  Chunk<ItemId>* next_chunk = &chunks[1];
+  if (!LoadChunk(data, 0, chunk))
+    return false;  // IO error
+  std::auto_ptr<DataSourceIterator> found_sets;
+  if (chunk->resume_offset != 0) {
+    found_sets.reset(DataSourceIterator::GetTemporary());
+    if (!found_sets.get())
+      return false;
+    found_sets_ = found_sets.get();
+  }
+  for (;;) {
+    if (chunk->candidates.empty() && chunk->resume_offset == 0)
+      break;  // The previous chunk ended with the last set.
+
+    LoadThreadArgs<ItemId> load_args =
+        { this, data, chunk->resume_offset, next_chunk, false };
+    pthread_t load_thread;
+    bool loading = false;
+    if (pipelined_ && chunk->resume_offset != 0) {
+      loading = !pthread_create(
+          &load_thread, 0, &LoadThreadMain<ItemId>, &load_args);
+      if (!loading) {
+        std::cerr << "; WARNING: Failed to start chunk loading thread."
+                  << std::endl;
+      }
+    }
 
-    if (!ReadNextChunk(data, &resume_offset))
+    DeleteSubsumedWithinChunk(chunk);
+    bool success = chunk->start_offset == 0 ||
+        chunk->candidates.empty() || DeleteSubsumedByPrecedingSets(chunk);
+    if (success) {
+      std::cerr << "; Dumping maximal sets." << std::endl;
+      success = DumpMaximalSets(chunk);
+    }
+    if (loading) {
+      pthread_join(load_thread, 0);
+      success = success && load_args.result;
+    }
+    if (!success)
       return false;  // IO error
+    if (chunk->resume_offset == 0)
+      break;
+    if (loading)
+      std::swap(chunk, next_chunk);
+    else if (!LoadChunk(data, chunk->resume_offset, chunk))
+      return false;  // IO error
+  }
+  return true;
+}
+
+bool AllMaximalSetsLexicographic::SaveSnapshot(
+    DataSourceIterator* data, const char* snapshot_path) {
+  Init();
+  if (UseNarrowItems(data))
+    return SaveSnapshotOf(data, snapshot_path, narrow_chunks_);
+  return SaveSnapshotOf(data, snapshot_path, chunks_);
+}
+
+template <typename ItemId>
+bool AllMaximalSetsLexicographic::SaveSnapshotOf(
+    DataSourceIterator* data, const char* snapshot_path,
+    Chunk<ItemId>* chunks) {
+  Chunk<ItemId>* chunk = &chunks[0];
+  bool fits_in_ram;
+  if (!PrepareCandidates(data, chunks, &fits_in_ram)) {
+    chunk->candidates.Clear();
+    return false;
+  }
+  // A snapshot holds a single chunk, so it may take the whole RAM limit.
+  chunk_bytes_limit_ = max_bytes_in_ram_;
+  if (!PrepareForDataScan(data, 0) || !ReadNextChunk(data, chunk)) {
+    chunk->candidates.Clear();
+    return false;
+  }
+  if (chunk->resume_offset != 0) {
+    std::cerr << "; ERROR: Dataset does not fit in a single chunk, so it "
+              << "cannot be saved as a snapshot." << std::endl;
+    chunk->candidates.Clear();
+    return false;
+  }
+  chunk->index.clear();
+  chunk->index_items.clear();
+  if (!chunk->candidates.empty()) {
+    DeleteTriviallySubsumedCandidates(chunk);
+    BuildIndex(chunk);
+  }
+  std::cerr << "; Writing snapshot: " << snapshot_path << std::endl;
+  std::auto_ptr<SnapshotWriter> writer(
+      SnapshotWriter::Get(snapshot_path, LEXICOGRAPHIC_SNAPSHOT));
+  uint64_t parameters[2] = {
+    static_cast<uint64_t>(input_sets_count_), 0/*reserved*/ };
+  bool success = writer.get() &&
+      writer->WriteSection(SECTION_PARAMETERS, parameters, 2) &&
+      writer->WriteSection(SECTION_ITEM_INDEX, chunk->index) &&
+      writer->WriteSection(SECTION_ITEM_INDEX_ITEMS, chunk->index_items) &&
+      chunk->candidates.Save(writer.get()) &&
+      writer->Close();
+  chunk->candidates.Clear();
+  return success;
+}
 
-    DeleteTriviallySubsumedCandidates();
+bool AllMaximalSetsLexicographic::FindAllMaximalSetsInSnapshot(
+    const char* snapshot_path) {
+  Init();
+  std::auto_ptr<MappedSnapshot> snapshot(
+      MappedSnapshot::Get(snapshot_path, LEXICOGRAPHIC_SNAPSHOT));
+  if (!snapshot.get())
+    return false;
+  // The candidates are loaded into a store of the item id type they
+  // were saved with.
+  if (SavedCandidateItemBytes(*snapshot) == sizeof(uint16_t)) {
+    return FindAllMaximalSetsInSnapshotOf(
+        *snapshot, snapshot_path, &narrow_chunks_[0]);
+  }
+  return FindAllMaximalSetsInSnapshotOf(
+      *snapshot, snapshot_path, &chunks_[0]);
+}
+
+template <typename ItemId>
+bool AllMaximalSetsLexicographic::FindAllMaximalSetsInSnapshotOf(
+    const MappedSnapshot& snapshot, const char* snapshot_path,
+    Chunk<ItemId>* chunk) {
+  const uint64_t* parameters;
+  const size_t* index;
+  const uint32_t* index_items;
+  size_t parameter_count, index_count, index_item_count;
+  if (!snapshot.GetArray(SECTION_PARAMETERS, &parameters, &parameter_count) ||
+      !snapshot.GetArray(SECTION_ITEM_INDEX, &index, &index_count) ||
+      !snapshot.GetArray(
+          SECTION_ITEM_INDEX_ITEMS, &index_items, &index_item_count) ||
+      !chunk->candidates.Load(snapshot)) {
+    return false;
+  }
+  bool valid = parameter_count > 0 &&
+      (!index_item_count || index_count == index_item_count + 1);
+  for (size_t i = 0; valid && i < index_count; ++i)
+    valid = index[i] <= chunk->candidates.size();
+  for (size_t i = 1; valid && i < index_item_count; ++i)
+    valid = index_items[i - 1] < index_items[i];
+  if (!valid) {
+    std::cerr << "ERROR: Inconsistent index in snapshot file ("
+              << snapshot_path << ")\n";
+    chunk->candidates.Clear();
+    return false;
+  }
+  input_sets_count_ = parameters[0];
+  chunk->index.assign(index, index + index_count);
+  chunk->index_items.assign(index_items, index_items + index_item_count);
+  owns_candidates_ = false;
+  if (use_trie_)
+    chunk->trie.Build(chunk->candidates);
+  if (!chunk->candidates.empty())
+    DeleteSubsumedWithinChunk(chunk);
+  std::cerr << "; Dumping maximal sets." << std::endl;
+  // Releases the candidates before the snapshot they point into.
+  DumpMaximalSets(chunk);
+  return true;
+}
+
+template <typename ItemId>
+bool AllMaximalSetsLexicographic::PrepareCandidates(
+    DataSourceIterator* data, Chunk<ItemId>* chunks, bool* fits_in_ram) {
+  owns_candidates_ = !data->IsMapped();
+  const DatasetMetadata* metadata = data->GetMetadata();
+  if (metadata && metadata->sort_order != SORT_UNKNOWN &&
+      metadata->sort_order != SORT_LEXICOGRAPHIC) {
+    std::cerr << "; ERROR: Dataset is not sorted lexicographically."
+              << std::endl;
+    return false;
+  }
+  for (int i = 0; i < 2; ++i) {
+    CandidateStore<ItemId>& candidates = chunks[i].candidates;
+    candidates.Clear();
+    candidates.SetFrontCoded(front_coded_ && owns_candidates_);
+  }
+  const CandidateStore<ItemId>& candidates = chunks[0].candidates;
+  *fits_in_ram = false;
+  size_t item_bytes = candidates.BytesPerItem();
+  size_t set_bytes =
+      candidates.BytesPerCandidate(!owns_candidates_) +
+      (use_trie_ ? CandidateTrie::kBytesPerCandidate : 0);
+  if (metadata) {
+    // The candidates fit in a single chunk if all of the dataset and an
+    // index over it fit in the RAM limit. A dense index covers at most
+    // every item id, and kMaxDenseIndexRatio ids per itemset, and is
+    // larger than a sparse one would be.
+    uint64_t bytes =
+        metadata->total_items * item_bytes +
+        metadata->set_count *
+            candidates.BytesPerCandidate(!owns_candidates_) +
+        (use_trie_ ?
+         CandidateTrie::BytesFor(metadata->set_count) :
+         std::min(static_cast<uint64_t>(metadata->max_item_id) + 1,
+                  kMaxDenseIndexRatio * metadata->set_count) *
+             sizeof(size_t));
+    *fits_in_ram = bytes < max_bytes_in_ram_;
+  }
+  // Pipelined passes hold the next chunk while checking the current
+  // one, so each may only take half of the RAM limit.
+  bool two_chunks = pipelined_ && !*fits_in_ram;
+  chunk_bytes_limit_ = two_chunks ? max_bytes_in_ram_ / 2 : max_bytes_in_ram_;
+  // Reserving room for the largest possible chunk up front avoids
+  // holding both the old and new copy of an array while it grows.
+  // The pages a chunk does not use are never touched.
+  if (metadata && owns_candidates_) {
+    for (int i = 0; i < (two_chunks ? 2 : 1); ++i) {
+      chunks[i].candidates.Reserve(
+          std::min<uint64_t>(metadata->set_count,
+                             chunk_bytes_limit_ / set_bytes),
+          std::min<uint64_t>(metadata->total_items,
+                             chunk_bytes_limit_ / item_bytes));
+    }
+  }
+  return true;
+}
+
+template <typename ItemId>
+void AllMaximalSetsLexicographic::DeleteSubsumedWithinChunk(
+    Chunk<ItemId>* chunk) {
+  std::cerr << "; Potential maximal sets: " << chunk->candidates.size() << '\n'
+            << "; Beginning subsumption checking scan." << std::endl;
+  // Each candidate deletes the candidates it subsumes. Checking a
+  // candidate that is itself subsumed is merely redundant, since the
+  // candidate subsuming it subsumes everything it does, so the threads
+  // need only agree on the deletions themselves, which are atomic.
+  next_scan_candidate_ = 0;
+  size_t blocks =
+      (chunk->candidates.size() + kScanBlockSize - 1) / kScanBlockSize;
+  std::vector<Scan<ItemId> > scans(
+      std::min<size_t>(thread_count_, blocks), Scan<ItemId>(chunk));
+  if (scans.size() <= 1) {
+    Scan<ItemId> scan(chunk);
+    ScanCandidates(&scan);
+    canidate_seek_count_ += scan.seek_count;
+    return;
+  }
+  std::vector<ScanThreadArgs<ItemId> > args(scans.size());
+  std::vector<pthread_t> threads(scans.size());
+  size_t started = 1;
+  for (size_t i = 0; i < scans.size(); ++i) {
+    scans[i].concurrent = true;
+    args[i].algorithm = this;
+    args[i].scan = &scans[i];
+  }
+  // The calling thread does its share of the scan too.
+  for (; started < scans.size(); ++started) {
+    if (pthread_create(
+            &threads[started], 0, &ScanThreadMain<ItemId>, &args[started])) {
+      std::cerr << "; WARNING: Failed to start scan thread." << std::endl;
+      break;
+    }
+  }
+  ScanCandidates(&scans[0]);
+  for (size_t i = 1; i < started; ++i)
+    pthread_join(threads[i], 0);
+  for (size_t i = 0; i < scans.size(); ++i)
+    canidate_seek_count_ += scans[i].seek_count;
+}
 
-    BuildIndex();
+/*static*/
+template <typename ItemId>
+void* AllMaximalSetsLexicographic::ScanThreadMain(void* args) {
+  ScanThreadArgs<ItemId>* scan_args =
+      static_cast<ScanThreadArgs<ItemId>*>(args);
+  scan_args->algorithm->ScanCandidates(scan_args->scan);
+  return 0;
+}
 
-    std::cerr << "; Potential maximal sets: " << candidates_.size() << '\n'
-              << "; Beginning subsumption checking scan." << std::endl;
-    for (unsigned int i = 0; i < candidates_.size() - 1; ++i) {
-      if (candidates_[i])  // check to make sure not already deleted.
-        DeleteSubsumedCandidates(i);
+template <typename ItemId>
+void AllMaximalSetsLexicographic::ScanCandidates(Scan<ItemId>* scan) {
+  // The last candidate cannot subsume any that follow it.
+  const CandidateStore<ItemId>& candidates = scan->chunk->candidates;
+  const size_t end = candidates.empty() ? 0 : candidates.size() - 1;
+  for (;;) {
+    size_t begin = scan->concurrent ?
+        __sync_fetch_and_add(&next_scan_candidate_, kScanBlockSize) :
+        (next_scan_candidate_ += kScanBlockSize) - kScanBlockSize;
+    if (begin >= end)
+      return;
+    size_t block_end = std::min(begin + kScanBlockSize, end);
+    for (size_t i = begin; i < block_end; ++i) {
+      if (candidates.IsLive(i))  // check to make sure not already deleted.
+        DeleteSubsumedCandidates(scan, i);
     }
-    if (start_offset != 0) {
-      if (!PrepareForDataScan(data, 0))
-        return false;  // IO error
-      while (data->Tell() < start_offset &&
-             (result = data->Next(&set_id, &current_set)) > 0) {
-        DeleteSubsumedCandidates(current_set);
+  }
+}
+
+// The state shared by the threads of DeleteSubsumedByPrecedingSets.
+// Each batch is published by bumping generation, after which every
+// thread takes blocks of its sets from next_set and decrements
+// busy_threads once none are left.
+struct AllMaximalSetsLexicographic::Rescan {
+  AllMaximalSetsLexicographic* algorithm;
+  pthread_mutex_t mutex;
+  pthread_cond_t batch_ready;
+  pthread_cond_t batch_done;
+  const SetBatch* batch;
+  size_t next_set;
+  unsigned int generation;
+  size_t busy_threads;
+  bool done;
+};
+
+template <typename ItemId>
+bool AllMaximalSetsLexicographic::DeleteSubsumedByPrecedingSets(
+    Chunk<ItemId>* chunk) {
+  std::cerr << "; Checking against the maximal sets found so far."
+            << std::endl;
+  if (!found_sets_->Seek(0)) {
+    std::cerr << "; ERROR: " << found_sets_->GetErrorMessage() << std::endl;
+    return false;
+  }
+  int result = 0;
+  Scan<ItemId> scan(chunk);
+  std::vector<Scan<ItemId> > scans(thread_count_ > 1 ? thread_count_ : 0,
+                                   Scan<ItemId>(chunk));
+  std::vector<RescanThreadArgs<ItemId> > args(scans.size());
+  std::vector<pthread_t> threads(scans.size());
+  Rescan rescan;
+  size_t started = 0;
+  if (!scans.empty()) {
+    rescan.algorithm = this;
+    pthread_mutex_init(&rescan.mutex, 0);
+    pthread_cond_init(&rescan.batch_ready, 0);
+    pthread_cond_init(&rescan.batch_done, 0);
+    rescan.batch = 0;
+    rescan.next_set = 0;
+    rescan.generation = 0;
+    rescan.busy_threads = 0;
+    rescan.done = false;
+    for (; started < scans.size(); ++started) {
+      scans[started].concurrent = true;
+      args[started].rescan = &rescan;
+      args[started].scan = &scans[started];
+      if (pthread_create(
+              &threads[started], 0, &RescanThreadMain<ItemId>,
+              &args[started])) {
+        std::cerr << "; WARNING: Failed to start scan thread." << std::endl;
+        break;
       }
-      if (result < 0)  // IO error
-        return false;
     }
-    std::cerr << "; Dumping maximal sets." << std::endl;
-    DumpMaximalSets();
-  } while (resume_offset != 0);
+  }
+  if (!started) {
+    SetBatch& batch = rescan_batches_[0];
+    while ((result = found_sets_->NextBatch(&batch, kDefaultBatchSize)) > 0) {
+      for (size_t i = 0; i < batch.size(); ++i)
+        DeleteSubsumedCandidates(&scan, batch[i]);
+    }
+  } else {
+    // The threads check each batch while the next one is read into the
+    // other buffer.
+    SetBatch* batch = &rescan_batches_[0];
+    SetBatch* next_batch = &rescan_batches_[1];
+    result = found_sets_->NextBatch(batch, kDefaultBatchSize);
+    while (result > 0) {
+      pthread_mutex_lock(&rescan.mutex);
+      rescan.batch = batch;
+      rescan.next_set = 0;
+      rescan.busy_threads = started;
+      ++rescan.generation;
+      pthread_cond_broadcast(&rescan.batch_ready);
+      pthread_mutex_unlock(&rescan.mutex);
+      result = found_sets_->NextBatch(next_batch, kDefaultBatchSize);
+      pthread_mutex_lock(&rescan.mutex);
+      while (rescan.busy_threads)
+        pthread_cond_wait(&rescan.batch_done, &rescan.mutex);
+      pthread_mutex_unlock(&rescan.mutex);
+      std::swap(batch, next_batch);
+    }
+    pthread_mutex_lock(&rescan.mutex);
+    rescan.done = true;
+    pthread_cond_broadcast(&rescan.batch_ready);
+    pthread_mutex_unlock(&rescan.mutex);
+    for (size_t i = 0; i < started; ++i)
+      pthread_join(threads[i], 0);
+    pthread_cond_destroy(&rescan.batch_done);
+    pthread_cond_destroy(&rescan.batch_ready);
+    pthread_mutex_destroy(&rescan.mutex);
+  }
+  for (size_t i = 0; i < started; ++i)
+    scan.seek_count += scans[i].seek_count;
+  canidate_seek_count_ += scan.seek_count;
+  if (result < 0) {
+    std::cerr << "; ERROR: " << found_sets_->GetErrorMessage() << std::endl;
+    return false;
+  }
   return true;
 }
 
+/*static*/
+template <typename ItemId>
+void* AllMaximalSetsLexicographic::RescanThreadMain(void* args) {
+  RescanThreadArgs<ItemId>* rescan_args =
+      static_cast<RescanThreadArgs<ItemId>*>(args);
+  rescan_args->rescan->algorithm->RescanSets(
+      rescan_args->rescan, rescan_args->scan);
+  return 0;
+}
+
+template <typename ItemId>
+void AllMaximalSetsLexicographic::RescanSets(
+    Rescan* rescan, Scan<ItemId>* scan) {
+  unsigned int generation = 0;
+  pthread_mutex_lock(&rescan->mutex);
+  for (;;) {
+    while (rescan->generation == generation && !rescan->done)
+      pthread_cond_wait(&rescan->batch_ready, &rescan->mutex);
+    if (rescan->generation == generation)
+      break;  // Done.
+    generation = rescan->generation;
+    const SetBatch& batch = *rescan->batch;
+    pthread_mutex_unlock(&rescan->mutex);
+    for (;;) {
+      size_t begin = __sync_fetch_and_add(&rescan->next_set, kScanBlockSize);
+      if (begin >= batch.size())
+        break;
+      size_t block_end = std::min(begin + kScanBlockSize, batch.size());
+      for (size_t i = begin; i < block_end; ++i)
+        DeleteSubsumedCandidates(scan, batch[i]);
+    }
+    pthread_mutex_lock(&rescan->mutex);
+    if (--rescan->busy_threads == 0)
+      pthread_cond_signal(&rescan->batch_done);
+  }
+  pthread_mutex_unlock(&rescan->mutex);
+}
+
 void AllMaximalSetsLexicographic::Init() {
   maximal_sets_count_ = input_sets_count_ = canidate_seek_count_ = 0;
+  found_sets_ = 0;
   std::cerr << "; Finding all maximal itemsets.\n"
-            << "; Limit on number of items in main memory: "
-            << max_items_in_ram_ << std::endl;
+            << "; Limit on bytes of main memory: "
+            << max_bytes_in_ram_ << std::endl;
 }
 
 bool AllMaximalSetsLexicographic::PrepareForDataScan(
@@ -135,228 +590,412 @@ bool AllMaximalSetsLexicographic::PrepareForDataScan(
   return data->Seek(resume_offset);
 }
 
+template <typename ItemId>
+bool AllMaximalSetsLexicographic::LoadChunk(
+    DataSourceIterator* data, off_t start_offset, Chunk<ItemId>* chunk) {
+  chunk->candidates.Clear();
+  if (!PrepareForDataScan(data, start_offset))
+    return false;  // IO error
+  chunk->start_offset = start_offset;
+  if (!ReadNextChunk(data, chunk))
+    return false;  // IO error
+  if (chunk->candidates.empty())
+    return true;
+  DeleteTriviallySubsumedCandidates(chunk);
+  if (use_trie_)
+    BuildTrie(chunk);
+  else
+    BuildIndex(chunk);
+  return true;
+}
+
+/*static*/
+template <typename ItemId>
+void* AllMaximalSetsLexicographic::LoadThreadMain(void* args) {
+  LoadThreadArgs<ItemId>* load_args =
+      static_cast<LoadThreadArgs<ItemId>*>(args);
+  load_args->result = load_args->algorithm->LoadChunk(
+      load_args->data, load_args->start_offset, load_args->chunk);
+  return 0;
+}
+
+template <typename ItemId>
 bool AllMaximalSetsLexicographic::ReadNextChunk(
-    DataSourceIterator* data, off_t* resume_offset) {
-  *resume_offset = 0;
-  items_in_ram_ = 0;
-  ItemSet current_set;
-  uint32_t set_id;
-  bool result;
-  while ((result = data->Next(&set_id, &current_set)) > 0) {
-    candidates_.push_back(SetProperties::Create(set_id, current_set));
-    items_in_ram_ += current_set.size();
-    ++input_sets_count_;
+    DataSourceIterator* data, Chunk<ItemId>* chunk) {
+  chunk->resume_offset = 0;
+  int result;
+  // The batch is cut off at the set that reaches the RAM limit, so
+  // that Tell() is the exact point at which to resume. NextBatch
+  // counts the limit in items, with each set costing its bookkeeping
+  // in the candidate store on top of its items, and the nodes it may
+  // add to the trie. The index only grows with the first items of the
+  // candidates, so it is accounted for between batches.
+  const size_t set_cost =
+      (chunk->candidates.BytesPerCandidate(!owns_candidates_) +
+       (use_trie_ ? CandidateTrie::kBytesPerCandidate : 0)) /
+      sizeof(uint32_t);
+  uint64_t chunk_bytes = 0;
+  chunk->first_items = 0;
+  chunk->last_first_item = 0;
+  while ((result = data->NextBatch(
+              &batch_, kDefaultBatchSize,
+              ItemsLeftInBudget(chunk_bytes, chunk_bytes_limit_),
+              set_cost)) > 0) {
+    for (size_t i = 0; i < batch_.size(); ++i) {
+      const SetProperties& set = batch_[i];
+      // Sets read from a memory-mapped dataset are retained as views
+      // into the mapping rather than copied.
+      if (!owns_candidates_) {
+        chunk->candidates.AddView(set);
+      } else if (!chunk->candidates.Add(set)) {
+        std::cerr << "; ERROR: Itemset " << set.set_id << " has an item id "
+                  << "exceeding the max_item_id of the dataset header."
+                  << std::endl;
+        return false;
+      }
+      if (set.size &&
+          (!chunk->first_items || set.item[0] != chunk->last_first_item)) {
+        ++chunk->first_items;
+        chunk->last_first_item = set.item[0];
+      }
+    }
+    input_sets_count_ += batch_.size();
     // Check if we've exceeded the RAM limit and if so stop
     // retaining any further itemsets in memory until the next
     // scan.
-    if (items_in_ram_ >= max_items_in_ram_) {
-      *resume_offset = data->Tell();
+    chunk_bytes = ChunkBytes(*chunk);
+    if (chunk_bytes >= chunk_bytes_limit_) {
+      chunk->resume_offset = data->Tell();
       std::cerr << "; Halted scan at input set number "
-                << input_sets_count_ << " with id " << set_id << std::endl;
+                << input_sets_count_ << " with id "
+                << batch_[batch_.size() - 1].set_id << std::endl;
+      // Sets of this chunk can only be subsumed by later sets that
+      // extend them. Any such set follows the copies of the last set
+      // of the chunk, and extends every candidate that it subsumes, so
+      // remember the first set that differs from the last set of the
+      // chunk for DeleteTriviallySubsumedCandidates.
+      size_t last = chunk->candidates.size() - 1;
+      const uint32_t* last_items = chunk->candidates.Items(last, &load_item_buffer_);
+      uint32_t last_size = chunk->candidates.Size(last);
+      do {
+        result = data->NextBatch(&batch_, 1);
+      } while (result > 0 && batch_[0].size == last_size &&
+               std::equal(last_items, last_items + last_size,
+                          batch_[0].begin()));
+      if (result < 0)
+        return false;
+      if (result > 0) {
+        next_chunk_first_set_.assign(batch_[0].begin(), batch_[0].end());
+        has_next_chunk_first_set_ = true;
+      }
       return true;
     }
-  }  // while ((result = data->Next() ...
+  }
   return result == 0;
 }
 
-void AllMaximalSetsLexicographic::DeleteTriviallySubsumedCandidates() {
+template <typename ItemId>
+uint64_t AllMaximalSetsLexicographic::ChunkBytes(
+    const Chunk<ItemId>& chunk) const {
+  // Deleting trivially subsumed candidates can only shrink the index
+  // or trie from this.
+  if (use_trie_) {
+    return chunk.candidates.BytesUsed() +
+        CandidateTrie::BytesFor(chunk.candidates.size());
+  }
+  return chunk.candidates.BytesUsed() +
+      IndexBytes(chunk.first_items, chunk.last_first_item);
+}
+
+template <typename ItemId>
+void AllMaximalSetsLexicographic::DeleteTriviallySubsumedCandidates(
+    Chunk<ItemId>* chunk) {
   // Now iterate over the current chunk backwards and delete
   // itemsets that are tivially subsumed based on prefix comparison.
   std::cerr << "; Deleting trivially subsumed itemsets..." << std::endl;
-  assert(candidates_.size());
-  SetProperties* not_a_prefix_itemset = candidates_.back();
-  for (int i = candidates_.size() - 2; i >= 0; --i) {
-    SetProperties* candidate = candidates_[i];
+  assert(chunk->candidates.size());
+  // The first set of the next chunk (if any) follows the last
+  // candidate, so the last candidate may be a prefix of it.
+  const uint32_t* not_a_prefix_itemset;
+  uint32_t not_a_prefix_size;
+  // Front-coded candidates are decoded into alternating buffers, so
+  // that not_a_prefix_itemset survives decoding the next candidate.
+  ItemSet buffers[2];
+  int buffer = 0;
+  size_t end = chunk->candidates.size();
+  if (has_next_chunk_first_set_) {
+    not_a_prefix_itemset =
+        next_chunk_first_set_.empty() ? 0 : &next_chunk_first_set_[0];
+    not_a_prefix_size = next_chunk_first_set_.size();
+  } else {
+    --end;
+    not_a_prefix_itemset = chunk->candidates.Items(end, &buffers[buffer]);
+    not_a_prefix_size = chunk->candidates.Size(end);
+    buffer ^= 1;
+  }
+  for (size_t i = end; i-- > 0; ) {
+    const uint32_t* candidate = chunk->candidates.Items(i, &buffers[buffer]);
+    uint32_t candidate_size = chunk->candidates.Size(i);
     bool subsumed = false;
-    if (candidate->size < not_a_prefix_itemset->size) {
+    if (candidate_size < not_a_prefix_size) {
       subsumed = true;
-      for (unsigned int j = 0; j < candidate->size; ++j) {
-        if (candidate->item[j] != not_a_prefix_itemset->item[j]) {
+      for (unsigned int j = 0; j < candidate_size; ++j) {
+        if (candidate[j] != not_a_prefix_itemset[j]) {
           subsumed = false;
           break;
         }
       }
     }
     if (subsumed) {
-      items_in_ram_ -= candidate->size;
-      SetProperties::Delete(candidate);
-      candidates_[i] = 0;
+      chunk->candidates.Delete(i);
     } else {
       not_a_prefix_itemset = candidate;
+      not_a_prefix_size = candidate_size;
+      buffer ^= 1;
     }
   }
+  has_next_chunk_first_set_ = false;
 }
 
-void AllMaximalSetsLexicographic::BuildIndex() {
-  // Finally, we compress out the blanks, identify blocks of candidates that
-  // start with the same item id, and build the index.
+template <typename ItemId>
+void AllMaximalSetsLexicographic::BuildIndex(Chunk<ItemId>* chunk) {
+  // Finally, we compress out the deleted candidates, identify blocks of
+  // candidates that start with the same item id, and build the index.
   std::cerr << "; Building index..." << std::endl;
-  int blanks = 0;
-  index_.resize(candidates_.back()->item[0] + 1);
-  int begin_candidate_index = -1;
-  SetProperties* begin_candidate = 0;  // candidate at the beginning of a block.
-  uint32_t previous_item = 0;
-  for (size_t i = 0; i < candidates_.size(); ++i) {
-    SetProperties* candidate = candidates_[i];
-    if (!candidate) {
-      blanks++;
-    } else {
-      candidates_[i - blanks] = candidate;
-      if (!begin_candidate) {
-        begin_candidate = candidate;
-        begin_candidate_index = i - blanks;
-      } else if (candidate->item[0] != begin_candidate->item[0]) {
-        // We've started a new block. Update the index with
-        // the stats from the previous block.
-        for (uint32_t item = previous_item + 1; item <= begin_candidate->item[0]; ++item) {
-          index_[item] = begin_candidate_index;
-        }
-        previous_item = begin_candidate->item[0];
-        begin_candidate = candidate;
-        begin_candidate_index = i - blanks;
+  chunk->candidates.Compact();
+  // Empty sets (which sort first) have no first item to index by. All
+  // candidates of the chunk may also have been subsumed by the first
+  // set of the next chunk.
+  size_t first = 0;
+  while (first < chunk->candidates.size() && !chunk->candidates.Size(first))
+    ++first;
+  chunk->index.clear();
+  chunk->index_items.clear();
+  if (first == chunk->candidates.size())
+    return;
+  uint64_t first_items = 1;
+  uint32_t previous_item = chunk->candidates.Item(first, 0);
+  for (size_t i = first + 1; i < chunk->candidates.size(); ++i) {
+    uint32_t item = chunk->candidates.Item(i, 0);
+    if (item != previous_item) {
+      ++first_items;
+      previous_item = item;
+    }
+  }
+  if (!UseDenseIndex(first_items, previous_item)) {
+    // The first items are sparse, so only they are indexed. They must
+    // be kept increasing for the index to be searched, even should the
+    // input not be sorted.
+    chunk->index_items.reserve(first_items);
+    chunk->index.reserve(first_items + 1);
+    for (size_t i = first; i < chunk->candidates.size(); ++i) {
+      uint32_t item = chunk->candidates.Item(i, 0);
+      if (chunk->index_items.empty() || item > chunk->index_items.back()) {
+        chunk->index_items.push_back(item);
+        chunk->index.push_back(i);
       }
     }
-  }  // for()
-  // Finish processing the final block.
-  for (uint32_t item = previous_item + 1; item <= begin_candidate->item[0]; ++item) {
-    index_[item] = begin_candidate_index;
+    chunk->index.push_back(chunk->candidates.size());
+    return;
+  }
+  chunk->index.assign(static_cast<size_t>(previous_item) + 1, first);
+  previous_item = chunk->candidates.Item(first, 0);
+  for (size_t i = first + 1; i < chunk->candidates.size(); ++i) {
+    uint32_t item = chunk->candidates.Item(i, 0);
+    if (item != previous_item) {
+      // We've started a new block. Items between the previous block and
+      // this one map to its beginning.
+      for (size_t fill = static_cast<size_t>(previous_item) + 1;
+           fill <= item; ++fill)
+        chunk->index[fill] = i;
+      previous_item = item;
+    }
+  }
+}
+
+template <typename ItemId>
+void AllMaximalSetsLexicographic::BuildTrie(Chunk<ItemId>* chunk) {
+  std::cerr << "; Building trie..." << std::endl;
+  chunk->candidates.Compact();
+  chunk->index.clear();
+  chunk->index_items.clear();
+  chunk->trie.Build(chunk->candidates);
+}
+
+template <typename ItemId>
+inline size_t AllMaximalSetsLexicographic::Chunk<ItemId>::IndexLowerBound(
+    uint32_t item) const {
+  if (index_items.empty())
+    return item < index.size() ? index[item] : candidates.size();
+  return index[std::lower_bound(index_items.begin(), index_items.end(),
+                                item) - index_items.begin()];
+}
+
+template <typename ItemId>
+inline size_t AllMaximalSetsLexicographic::Chunk<ItemId>::IndexUpperBound(
+    uint32_t item) const {
+  if (index_items.empty()) {
+    return static_cast<size_t>(item) + 1 < index.size() ?
+        index[static_cast<size_t>(item) + 1] : candidates.size();
   }
-  candidates_.resize(candidates_.size() - blanks);
+  return index[std::upper_bound(index_items.begin(), index_items.end(),
+                                item) - index_items.begin()];
 }
 
-void AllMaximalSetsLexicographic::DeleteSubsumedCandidates(unsigned int current_set_index) {
-  current_set_ = candidates_[current_set_index];
-  assert(current_set_);
-  if (current_set_->size <= 1)
+template <typename ItemId>
+void AllMaximalSetsLexicographic::DeleteSubsumedCandidates(
+    Scan<ItemId>* scan, size_t current_set_index) {
+  const CandidateStore<ItemId>& candidates = scan->chunk->candidates;
+  // Other threads may delete the set while it is being checked.
+  assert(scan->concurrent || candidates.IsLive(current_set_index));
+  if (candidates.Size(current_set_index) <= 1)
     return;
+  const uint32_t* current_set_it =
+      candidates.Items(current_set_index, &scan->current_set_buffer);
+  scan->SetCurrentSet(current_set_it, candidates.Size(current_set_index));
 
-  const uint32_t* current_set_it = current_set_->begin();
   // The first candidate_set we consider is the first set following
   // current_set in the ordering, if one exists.
-  CandidateList::iterator begin_range_it =
-      candidates_.begin() + current_set_index + 1;
-  DeleteSubsumedFromRange(begin_range_it, candidates_.end(), current_set_it, 0);
+  if (use_trie_) {
+    DeleteSubsumedFromNode(
+        scan, CandidateTrie::Root(), candidates.size(),
+        current_set_index + 1, current_set_it);
+    return;
+  }
+  DeleteSubsumedFromRange(
+      scan, current_set_index + 1, candidates.size(), current_set_it, 0);
 }
 
-void AllMaximalSetsLexicographic::DeleteSubsumedCandidates(const ItemSet& itemset) {
-  if (itemset.size() <= 1)
+template <typename ItemId>
+void AllMaximalSetsLexicographic::DeleteSubsumedCandidates(
+    Scan<ItemId>* scan, const SetProperties& itemset) {
+  if (itemset.size <= 1)
     return;
-  current_set_ = SetProperties::Create(0, itemset);
-
-  const uint32_t* current_set_it = current_set_->begin();
+  scan->SetCurrentSet(itemset.begin(), itemset.size);
+  if (use_trie_) {
+    DeleteSubsumedFromNode(
+        scan, CandidateTrie::Root(), scan->chunk->candidates.size(), 0,
+        itemset.begin());
+    return;
+  }
   DeleteSubsumedFromRange(
-      candidates_.begin(), candidates_.end(), current_set_it, 0);
-  SetProperties::Delete(current_set_);
+      scan, 0, scan->chunk->candidates.size(), itemset.begin(), 0);
 }
 
-// Helper function that advances begin_range_it over all subsumed &
+// Helper function that advances begin_range over all subsumed &
 // already deleted candidate sets, and deletes all subsumed itemsets
 // encountered.
+template <typename ItemId>
 inline void AllMaximalSetsLexicographic::DeleteSubsumedSets(
-    CandidateList::iterator* begin_range_it,
-    CandidateList::iterator end_range_it,
+    Scan<ItemId>* scan,
+    size_t* begin_range,
+    size_t end_range,
     unsigned int depth) {
-  // If current_set_->size() == depth, then the current set
+  CandidateStore<ItemId>& candidates = scan->chunk->candidates;
+  // If the current set's size == depth, then the current set
   // cannot *properly* subsume any candidates.
-  if (current_set_->size > depth) {
-    while (*begin_range_it != end_range_it &&
-           (!**begin_range_it || (**begin_range_it)->size == depth)) {
-      if (**begin_range_it) {
-        // Subsumed!
-        items_in_ram_ -= (**begin_range_it)->size;
-        SetProperties::Delete(**begin_range_it);
-        **begin_range_it = 0;
-      }
-      ++(*begin_range_it);
-      }
+  if (scan->current_set_size > depth) {
+    *begin_range = candidates.NextLive(*begin_range, end_range);
+    while (*begin_range != end_range &&
+           candidates.Size(*begin_range) == depth) {
+      // Subsumed!
+      if (scan->concurrent)
+        candidates.DeleteConcurrently(*begin_range);
+      else
+        candidates.Delete(*begin_range);
+      *begin_range = candidates.NextLive(*begin_range + 1, end_range);
+    }
   } else {
     // Otherwise just skip over already-deleted itemsets.
-    while (*begin_range_it != end_range_it && !**begin_range_it) {
-      ++(*begin_range_it);
-    }
+    *begin_range = candidates.NextLive(*begin_range, end_range);
   }
 }
 
-inline
-AllMaximalSetsLexicographic::CandidateList::iterator AllMaximalSetsLexicographic::GetNewBeginRangeIt(
-    CandidateList::iterator begin_range_it,
-    CandidateList::iterator end_range_it,
+template <typename ItemId>
+inline size_t AllMaximalSetsLexicographic::GetNewBeginRange(
+    Scan<ItemId>* scan,
+    size_t begin_range,
+    size_t end_range,
     uint32_t current_item,
     unsigned int depth) {
-  ++canidate_seek_count_;
+  const Chunk<ItemId>& chunk = *scan->chunk;
+  ++scan->seek_count;
   if (depth == 0) {
-    // At depth 0 we can use the index rather than binary search.
-    if (current_item >= index_.size())
-      return end_range_it;
-    if (candidates_.begin() + index_[current_item] > begin_range_it) {
-      begin_range_it = candidates_.begin() + index_[current_item];
-    }
-    while (begin_range_it != end_range_it && !*begin_range_it)
-      ++begin_range_it;
+    // At depth 0 we can use the index rather than searching.
+    size_t position = chunk.IndexLowerBound(current_item);
+    if (position >= end_range)
+      return end_range;
+    if (position > begin_range)
+      begin_range = position;
+    begin_range = chunk.candidates.NextLive(begin_range, end_range);
   } else {
-    begin_range_it = find_new_it(
-        begin_range_it,
-        end_range_it,
+    begin_range = find_new_it(
+        chunk.candidates,
+        begin_range,
+        end_range,
         current_item,
         depth,
         std::greater<uint32_t>());
+    begin_range = chunk.candidates.NextLive(begin_range, end_range);
   }
-  return begin_range_it;
+  return begin_range;
 }
 
-inline
-AllMaximalSetsLexicographic::CandidateList::iterator AllMaximalSetsLexicographic::GetNewEndRangeIt(
-    CandidateList::iterator begin_range_it,
-    CandidateList::iterator end_range_it,
+template <typename ItemId>
+inline size_t AllMaximalSetsLexicographic::GetNewEndRange(
+    Scan<ItemId>* scan,
+    size_t begin_range,
+    size_t end_range,
     uint32_t current_item,
     unsigned int depth) {
-  ++canidate_seek_count_;
-  CandidateList::iterator new_end_range_it;
+  const Chunk<ItemId>& chunk = *scan->chunk;
+  ++scan->seek_count;
+  size_t new_end_range;
   if (depth == 0) {
-    // At depth 0 we can use the index rather than binary search.
-    if (current_item + 1 < index_.size()) {
-      new_end_range_it = candidates_.begin() + index_[current_item + 1];
-      assert(new_end_range_it <= end_range_it);
-    } else {
-      new_end_range_it = end_range_it;
-    }
+    // At depth 0 we can use the index rather than searching.
+    new_end_range = chunk.IndexUpperBound(current_item);
+    assert(new_end_range <= end_range);
   } else {
-    new_end_range_it = find_new_it(
-        begin_range_it,
-        end_range_it,
+    new_end_range = find_new_it(
+        chunk.candidates,
+        begin_range,
+        end_range,
         current_item,
         depth,
         std::equal_to<uint32_t>());
   }
-  return new_end_range_it;
+  return new_end_range;
 }
 
 // This function has 2 important preconditions:
-//   (1) all candidates between begin_range_it and end_range_it have
+//   (1) all candidates between begin_range and end_range have
 //   the same length-d prefix where d is the value of "depth"
 //   (2) *current_set_it <= candidate[d+1] for any candidate with more
 //   than d elements.
+template <typename ItemId>
 void AllMaximalSetsLexicographic::DeleteSubsumedFromRange(
-    CandidateList::iterator begin_range_it,
-    CandidateList::iterator end_range_it,
+    Scan<ItemId>* scan,
+    size_t begin_range,
+    size_t end_range,
     const uint32_t* current_set_it,
     unsigned int depth) {
-  assert(begin_range_it != end_range_it);
-  DeleteSubsumedSets(&begin_range_it, end_range_it, depth);
-  if (begin_range_it == end_range_it || current_set_it == current_set_->end())
+  const CandidateStore<ItemId>& candidates = scan->chunk->candidates;
+  assert(begin_range != end_range);
+  DeleteSubsumedSets(scan, &begin_range, end_range, depth);
+  if (begin_range == end_range || current_set_it == scan->current_set_end)
     return;
 
-  do {  // while (begin_range_it != end_range_it)
+  do {  // while (begin_range != end_range)
     // First thing we do is find the next item in the current_set
     // that, if added to our prefix, could potentially subsume some
     // candidate within the remaining range.
-    uint32_t candidate_item = (**begin_range_it)[depth];
-    assert(current_set_it != current_set_->end());
+    uint32_t candidate_item = candidates.Item(begin_range, depth);
+    assert(current_set_it != scan->current_set_end);
     if (*current_set_it < candidate_item) {
       current_set_it = std::lower_bound(
-          current_set_it, current_set_->end(), candidate_item);
+          current_set_it, scan->current_set_end, candidate_item);
     }
-    if (current_set_it == current_set_->end())
+    if (current_set_it == scan->current_set_end)
       return;
 
     assert(*current_set_it >= candidate_item);
@@ -365,47 +1004,144 @@ void AllMaximalSetsLexicographic::DeleteSubsumedFromRange(
       // The item we found matches the next candidate set item, which
       // means we can extend the prefix. Before we recurse, we must
       // compute an end range for the extended prefix.
-      CandidateList::iterator new_end_range_it = GetNewEndRangeIt(
-          begin_range_it, end_range_it, candidate_item, depth);
-      assert(new_end_range_it >= begin_range_it);
-      if (begin_range_it != new_end_range_it) {
+      size_t new_end_range = GetNewEndRange(
+          scan, begin_range, end_range, candidate_item, depth);
+      assert(new_end_range >= begin_range);
+      if (begin_range != new_end_range) {
         DeleteSubsumedFromRange(
-            begin_range_it, new_end_range_it, current_set_it + 1, depth + 1);
+            scan, begin_range, new_end_range, current_set_it + 1, depth + 1);
       }
-      begin_range_it = new_end_range_it;
-      while (begin_range_it != end_range_it && !*begin_range_it)
-        ++begin_range_it;
+      begin_range = candidates.NextLive(new_end_range, end_range);
     } else {
       // Advance the begin_range until we reach potentially subsumable candidates.
-      begin_range_it = GetNewBeginRangeIt(
-          begin_range_it, end_range_it, *current_set_it, depth);
+      begin_range = GetNewBeginRange(
+          scan, begin_range, end_range, *current_set_it, depth);
+    }
+  } while (begin_range != end_range);
+}
+
+template <typename ItemId>
+void AllMaximalSetsLexicographic::DeleteSubsumedFromNode(
+    Scan<ItemId>* scan,
+    size_t node,
+    size_t end,
+    size_t first,
+    const uint32_t* current_set_it) {
+  CandidateStore<ItemId>& candidates = scan->chunk->candidates;
+  const CandidateTrie& trie = scan->chunk->trie;
+  // The candidates equal to the prefix are subsumed, unless the prefix
+  // is the whole current set.
+  const uint32_t depth = trie.Depth(node);
+  size_t own_end = trie.OwnEnd(node, end);
+  if (scan->current_set_size > depth) {
+    for (size_t i = candidates.NextLive(
+             std::max(trie.Begin(node), first), own_end);
+         i != own_end; i = candidates.NextLive(i + 1, own_end)) {
+      // Subsumed!
+      if (scan->concurrent)
+        candidates.DeleteConcurrently(i);
+      else
+        candidates.Delete(i);
+    }
+  }
+
+  // Descend to each child whose item is in the rest of the current set,
+  // finding the next such child by a search among the children.
+  size_t child = trie.FirstChild(node);
+  const size_t last_child = child + trie.ChildCount(node);
+  while (child != last_child && current_set_it != scan->current_set_end) {
+    uint32_t child_item = trie.Item(child);
+    if (*current_set_it < child_item) {
+      current_set_it = std::lower_bound(
+          current_set_it, scan->current_set_end, child_item);
+      if (current_set_it == scan->current_set_end)
+        return;
+    }
+    if (*current_set_it > child_item) {
+      ++scan->seek_count;
+      child = trie.LowerBoundChild(
+          child + 1, last_child, *current_set_it);
+      continue;
     }
-  } while (begin_range_it != end_range_it);
+    size_t child_end =
+        child + 1 != last_child ? trie.Begin(child + 1) : end;
+    size_t child_begin = std::max(trie.Begin(child), first);
+    if (child_begin < child_end &&
+        candidates.NextLive(child_begin, child_end) != child_end) {
+      // The rest of the edge into the child must be in the current set
+      // too.
+      const uint32_t* child_set_it = current_set_it + 1;
+      const size_t edge_candidate = trie.Begin(child);
+      const uint32_t child_depth = trie.Depth(child);
+      uint32_t edge_depth = depth + 1;
+      if (child_depth - edge_depth <=
+          static_cast<size_t>(scan->current_set_end - child_set_it)) {
+        for (; edge_depth < child_depth; ++edge_depth) {
+          uint32_t item = candidates.Item(edge_candidate, edge_depth);
+          child_set_it = std::lower_bound(
+              child_set_it, scan->current_set_end, item);
+          if (child_set_it == scan->current_set_end || *child_set_it != item)
+            break;
+          ++child_set_it;
+        }
+        if (edge_depth == child_depth) {
+          DeleteSubsumedFromNode(
+              scan, child, child_end, first, child_set_it);
+        }
+      }
+    }
+    ++child;
+  }
 }
 
-void AllMaximalSetsLexicographic::DumpMaximalSets() {
-  for (unsigned int i = 0; i < candidates_.size(); ++i) {
-    SetProperties* maximal_set = candidates_[i];
-    if (maximal_set) {
-      FoundMaximalSet(*maximal_set);
-      SetProperties::Delete(maximal_set);
+template <typename ItemId>
+bool AllMaximalSetsLexicographic::DumpMaximalSets(Chunk<ItemId>* chunk) {
+  CandidateStore<ItemId>& candidates = chunk->candidates;
+  const bool keep = found_sets_ && chunk->resume_offset != 0;
+  bool success = true;
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (!candidates.IsLive(i))
+      continue;
+    FoundMaximalSet(*chunk, i);
+    if (keep && success) {
+      success = found_sets_->Append(
+          candidates.SetId(i), candidates.Items(i, &item_buffer_),
+          candidates.Size(i));
     }
   }
-  candidates_.clear();
+  candidates.Clear();
+  chunk->trie.Clear();
   std::cout << std::flush;
+  if (!success) {
+    std::cerr << "; ERROR: " << found_sets_->GetErrorMessage() << std::endl;
+    return false;
+  }
+  return true;
 }
 
-void AllMaximalSetsLexicographic::FoundMaximalSet(const SetProperties& maximal_set) {
+template <typename ItemId>
+void AllMaximalSetsLexicographic::FoundMaximalSet(
+    const Chunk<ItemId>& chunk, size_t maximal_set) {
   ++maximal_sets_count_;
   switch (output_mode_) {
     case COUNT_ONLY:
       break;
     case ID:
-      std::cout << maximal_set.set_id << '\n';
+      std::cout << chunk.candidates.SetId(maximal_set) << '\n';
       break;
-    case ID_AND_ITEMS:
-      std::cout << maximal_set << '\n';
+    case ID_AND_ITEMS: {
+      // Same format as operator<<(std::ostream&, const SetProperties&).
+      const uint32_t* items =
+          chunk.candidates.Items(maximal_set, &item_buffer_);
+      std::cout << chunk.candidates.SetId(maximal_set) << ": ";
+      for (uint32_t i = 0; i < chunk.candidates.Size(maximal_set); ++i) {
+        if (i != 0)
+          std::cout << ' ';
+        std::cout << items[i];
+      }
+      std::cout << '\n';
       break;
+    }
     default:
       std::cout << "Huh?\n";
       assert(0);
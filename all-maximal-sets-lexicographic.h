@@ -41,16 +41,26 @@
 #include <vector>
 #include <utility>
 #include "basic-types.h"
+#include "candidate-store.h"
+#include "candidate-trie.h"
+#include "huge-page-allocator.h"
+#include "data-source-iterator.h"
 
 namespace google_extremal_sets {
 
-class DataSourceIterator;
-class SetProperties;
+class MappedSnapshot;
 
 class AllMaximalSetsLexicographic {
  public:
   AllMaximalSetsLexicographic()
-      : max_items_in_ram_(std::numeric_limits<uint32_t>::max()),
+      : has_next_chunk_first_set_(false),
+        found_sets_(0),
+        max_bytes_in_ram_(std::numeric_limits<uint64_t>::max()),
+        chunk_bytes_limit_(std::numeric_limits<uint64_t>::max()),
+        front_coded_(false),
+        use_trie_(false),
+        pipelined_(false),
+        thread_count_(1),
         output_mode_(ID) {
   }
 
@@ -60,23 +70,88 @@ class AllMaximalSetsLexicographic {
   // call to data->GetErrorMessage() will return a human-readable
   // description of the problem.
   //
-  // The caller must provide an estimate of the max_item_id which will
-  // be used to preallocate buffers.  The correct output will be
-  // produced even if the estimates are inaccurate (provided there is
-  // sufficient memory for the buffers to be allocated to the
-  // specified size.)
+  // Item ids may be arbitrary 32-bit integers, since the index over
+  // the candidates switches to a sparse representation when their
+  // first items are sparse; max_item_id is ignored.
+  // If the dataset header records metadata (see DatasetMetadata), the
+  // buffers are sized from it, and datasets recorded as being
+  // sorted in other than lexicographic order are rejected. If it shows
+  // that all item ids fit in 16 bits, copied candidates store them as
+  // such, fitting twice as many items into the RAM limit and halving
+  // the bandwidth consumed by checking them.
   //
   // This method may output status & progress messages to stderr.
   bool FindAllMaximalSets(DataSourceIterator* data, uint32_t max_item_id);
 
-  // To specify a bound on the number of 4-byte item ids that will be
-  // stored in main memory during algorithm execution. Should the
-  // dataset contain more items than the limit, the algorithm will
-  // switch to an "out of core" mode and perform multiple passes over
-  // the data in order to compute the output. Default is to impose
+  // Reads the "data" stream as FindAllMaximalSets does, and writes the
+  // candidates and their index, as they are once built and before any
+  // subsumption checking, to a snapshot file at snapshot_path (see
+  // index-snapshot.h). Since a snapshot holds a single chunk, the
+  // dataset must fit within the RAM limit. Returns false on error.
+  bool SaveSnapshot(DataSourceIterator* data, const char* snapshot_path);
+
+  // Like FindAllMaximalSets, but for the dataset from which the
+  // snapshot at snapshot_path was saved. The candidates are mapped from
+  // the snapshot rather than read and indexed again. The RAM limit and
+  // front coding settings do not apply; the snapshot keeps those in
+  // effect when it was saved. Returns false on error, which is
+  // reported to stderr.
+  bool FindAllMaximalSetsInSnapshot(const char* snapshot_path);
+
+  // To specify a bound on the number of bytes of main memory used by
+  // the candidates and their index during algorithm execution (see
+  // memory-budget.h for choosing one). Should the candidates not fit,
+  // the algorithm will switch to an "out of core" mode and perform
+  // multiple passes over the data in order to compute the output. The
+  // buffers of the data source are not included. Default is to impose
   // no RAM limit.
-  void SetMaxItemsInRam(int max) {
-    max_items_in_ram_ = max;
+  void SetMaxBytesInRam(uint64_t max) {
+    max_bytes_in_ram_ = max;
+  }
+
+  // Requests that candidates be front coded in memory, so that each
+  // only stores the items following the prefix it shares with its
+  // predecessor, and only those count towards the limit set by
+  // SetMaxBytesInRam. Since sorted datasets share long prefixes this
+  // fits several times more candidates into each chunk, reducing the
+  // number of passes, at some cost in subsumption checking speed. Has
+  // no effect on memory-mapped datasets, whose itemsets are not
+  // copied. Default is false.
+  void SetFrontCodedCandidates(bool front_coded) {
+    front_coded_ = front_coded;
+  }
+
+  // Requests that each chunk of candidates be indexed by an explicit
+  // prefix trie (see candidate-trie.h) instead of by first item alone.
+  // Checking a set for subsumption then descends the trie, finding the
+  // candidates that extend a prefix by one more item by a search among
+  // the children of its node rather than among the candidates sharing
+  // the prefix. The trie takes up to CandidateTrie::kBytesPerCandidate
+  // bytes per candidate of the limit set by SetMaxBytesInRam. Default
+  // is false.
+  void SetCandidateTrie(bool use_trie) {
+    use_trie_ = use_trie;
+  }
+
+  // Requests that, when the dataset does not fit in a single chunk, each
+  // chunk be read and indexed by another thread while the previous one
+  // is checked against itself, so that reading the dataset overlaps
+  // with subsumption checking. Two chunks are then held at once, so
+  // each may only take half of the limit set by SetMaxBytesInRam.
+  // Default is false.
+  void SetPipelinedChunks(bool pipelined) {
+    pipelined_ = pipelined;
+  }
+
+  // Sets the number of threads that check the candidates of each
+  // chunk against each other, and against the sets preceding the chunk
+  // in out of core mode. Candidates are handed out to the threads in
+  // small blocks as they become free, as are the preceding sets while
+  // the next batch of them is read, and subsumed candidates are
+  // deleted with atomic operations, so the result is the same as that
+  // of a single thread. Default is 1.
+  void SetThreadCount(int thread_count) {
+    thread_count_ = thread_count < 1 ? 1 : thread_count;
   }
 
   // Set the output mode. Default is "ID".
@@ -95,72 +170,263 @@ class AllMaximalSetsLexicographic {
   // by FindAllMaximalSets.
   long long CandidateSeekCount() const { return canidate_seek_count_; }
 
-  // A list of itemsets used to store candidates within the candidate
-  // map.
-  typedef std::vector<SetProperties*> CandidateList;
-
  private:
   // First method called by FindAllMaximalSets for rudimentary variable
   // initialization.
   void Init();
 
+  // Returns true if the candidates read from the data are to be stored
+  // with 16-bit item ids, which is when they are copied and the dataset
+  // header shows that all ids fit.
+  bool UseNarrowItems(DataSourceIterator* data) const;
+
+  // A chunk of candidates, with item ids of type ItemId, and the index
+  // over them.
+  template <typename ItemId>
+  struct Chunk {
+    Chunk() : first_items(0), last_first_item(0), start_offset(0),
+              resume_offset(0) {}
+
+    // Return the position of the first candidate whose first item is
+    // at least, or respectively greater than, the given item.
+    size_t IndexLowerBound(uint32_t item) const;
+    size_t IndexUpperBound(uint32_t item) const;
+
+    // The candidate itemsets of the chunk, in increasing lexocographic
+    // order. Subsumed candidates are marked deleted, and the whole
+    // chunk is released at once by DumpMaximalSets.
+    CandidateStore<ItemId> candidates;
+
+    // Index into candidates. If index_items is empty the index is
+    // dense, and maps each item id to the position within candidates
+    // containing the first set in the lexicographic ordering to follow
+    // the singleton set { item_id }. Otherwise it is sparse:
+    // index_items holds the distinct first items of the candidates in
+    // increasing order, index[i] is the position of the first
+    // candidate starting with index_items[i], and index.back() is the
+    // number of candidates.
+    std::vector<size_t, HugePageAllocator<size_t> > index;
+    std::vector<uint32_t, HugePageAllocator<uint32_t> > index_items;
+
+    // Prefix trie over candidates, used in place of the index if
+    // use_trie_.
+    CandidateTrie trie;
+
+    // The number of distinct first items among the candidates read into
+    // the chunk, and the last of them, from which ChunkBytes bounds the
+    // size of the index.
+    uint64_t first_items;
+    uint32_t last_first_item;
+
+    // The offset within the data at which the chunk begins, and the
+    // offset at which the next chunk begins or 0 if this is the last
+    // one.
+    off_t start_offset;
+    off_t resume_offset;
+  };
+
+  // Do the work of FindAllMaximalSets, SaveSnapshot and
+  // FindAllMaximalSetsInSnapshot once the item id type of the
+  // candidates is chosen. FindAllMaximalSetsIn checks chunks[0], while
+  // chunks[1] is loaded if pipelined_.
+  template <typename ItemId>
+  bool FindAllMaximalSetsIn(DataSourceIterator* data,
+                            Chunk<ItemId>* chunks);
+  template <typename ItemId>
+  bool SaveSnapshotOf(DataSourceIterator* data, const char* snapshot_path,
+                      Chunk<ItemId>* chunks);
+  template <typename ItemId>
+  bool FindAllMaximalSetsInSnapshotOf(const MappedSnapshot& snapshot,
+                                      const char* snapshot_path,
+                                      Chunk<ItemId>* chunk);
+
+  // Configures the candidate stores of the chunks for the data and
+  // sizes them from the dataset metadata, if any. Sets *fits_in_ram to
+  // true if the metadata shows that the candidates fit in a single
+  // chunk. Returns false if the dataset cannot be processed.
+  template <typename ItemId>
+  bool PrepareCandidates(DataSourceIterator* data, Chunk<ItemId>* chunks,
+                         bool* fits_in_ram);
+
   // Prepare datastructures for scanning the data beginning at the
   // provided offset. Returns false if IO error encountered.
   bool PrepareForDataScan(DataSourceIterator* data, off_t seek_offset);
 
-  // Scans the input data from beginning to end, and reads in a chunk
-  // of data to process, up to the max_items_in_ram_ limit. Returns
-  // false on IO error. seek_offset will contain the point at which
-  // scanning stopped if the max_items_in_ram_ limit was reached.
-  // Otherwise it is set to 0.
-  bool ReadNextChunk(DataSourceIterator* data, off_t* seek_offset);
+  // Reads the chunk beginning at start_offset into *chunk, deletes its
+  // trivially subsumed candidates, and indexes it. Returns false on IO
+  // error.
+  template <typename ItemId>
+  bool LoadChunk(DataSourceIterator* data, off_t start_offset,
+                 Chunk<ItemId>* chunk);
+  template <typename ItemId>
+  struct LoadThreadArgs {
+    AllMaximalSetsLexicographic* algorithm;
+    DataSourceIterator* data;
+    off_t start_offset;
+    Chunk<ItemId>* chunk;
+    bool result;
+  };
+  template <typename ItemId>
+  static void* LoadThreadMain(void* args);
+
+  // Scans the input data from the current position, and reads in a
+  // chunk of data to process, up to the chunk_bytes_limit_ limit.
+  // Returns false on IO error, or if an item does not fit in an ItemId.
+  // chunk->resume_offset will contain the point at which scanning
+  // stopped if the limit was reached. Otherwise it is set to 0. In the
+  // former case the items of the set following the chunk are left in
+  // next_chunk_first_set_.
+  template <typename ItemId>
+  bool ReadNextChunk(DataSourceIterator* data, Chunk<ItemId>* chunk);
 
-  // Iterates over the current chunk backwards and delete itemsets
-  // that are tivially subsumed based on prefix comparison.
-  void DeleteTriviallySubsumedCandidates();
+  // Returns the bytes of memory used by the chunk: the candidates, and
+  // the index that BuildIndex will build over them.
+  template <typename ItemId>
+  uint64_t ChunkBytes(const Chunk<ItemId>& chunk) const;
+
+  // Iterates over the chunk backwards and delete itemsets that are
+  // tivially subsumed based on prefix comparison.
+  template <typename ItemId>
+  void DeleteTriviallySubsumedCandidates(Chunk<ItemId>* chunk);
 
   // Compresses out the blanks left by deleting trivially subsumed
   // itemsets, identifies blocks of candidates that start with the
   // same item id, and builds the index that maps each item to the
   // first candidate that starts with that item.
-  void BuildIndex();
+  template <typename ItemId>
+  void BuildIndex(Chunk<ItemId>* chunk);
+
+  // Compresses out the deleted candidates like BuildIndex, and builds
+  // the trie over the rest instead of the index.
+  template <typename ItemId>
+  void BuildTrie(Chunk<ItemId>* chunk);
+
+  // The state of a thread checking the candidates of a chunk for
+  // subsumption by one set at a time.
+  template <typename ItemId>
+  struct Scan {
+    explicit Scan(Chunk<ItemId>* chunk)
+        : chunk(chunk), current_set_end(0), current_set_size(0),
+          seek_count(0), concurrent(false) {}
+
+    // Sets the itemset that DeleteSubsumedFromRange checks against.
+    void SetCurrentSet(const uint32_t* items, uint32_t size) {
+      current_set_end = items + size;
+      current_set_size = size;
+    }
+
+    Chunk<ItemId>* chunk;
+    const uint32_t* current_set_end;
+    uint32_t current_set_size;
+    // Decoding buffer for front-coded candidates.
+    ItemSet current_set_buffer;
+    long long seek_count;
+    // True if other threads are deleting candidates at the same time.
+    bool concurrent;
+  };
+
+  // Deletes the candidates of the chunk subsumed by other candidates
+  // of the chunk, using thread_count_ threads.
+  template <typename ItemId>
+  void DeleteSubsumedWithinChunk(Chunk<ItemId>* chunk);
+
+  // Body of each thread of DeleteSubsumedWithinChunk, which checks
+  // blocks of candidates taken from next_scan_candidate_ until none
+  // are left.
+  template <typename ItemId>
+  void ScanCandidates(Scan<ItemId>* scan);
+  template <typename ItemId>
+  struct ScanThreadArgs {
+    AllMaximalSetsLexicographic* algorithm;
+    Scan<ItemId>* scan;
+  };
+  template <typename ItemId>
+  static void* ScanThreadMain(void* args);
+
+  // Deletes the candidates of the chunk subsumed by the sets preceding
+  // it in the data, using thread_count_ threads besides the calling
+  // one, which reads the sets. Only the maximal sets among them need
+  // to be checked, and these are read back from found_sets_ rather
+  // than from the data. Returns false on IO error.
+  template <typename ItemId>
+  bool DeleteSubsumedByPrecedingSets(Chunk<ItemId>* chunk);
+
+  // Body of each thread of DeleteSubsumedByPrecedingSets, which checks
+  // blocks of the sets of each batch until the rescan is done.
+  struct Rescan;
+  template <typename ItemId>
+  void RescanSets(Rescan* rescan, Scan<ItemId>* scan);
+  template <typename ItemId>
+  struct RescanThreadArgs {
+    Rescan* rescan;
+    Scan<ItemId>* scan;
+  };
+  template <typename ItemId>
+  static void* RescanThreadMain(void* args);
 
   // Delete any candidate subsumed by the given input_set.
-  void DeleteSubsumedCandidates(unsigned int candidate_index);
-  void DeleteSubsumedCandidates(const ItemSet& itemset);
+  template <typename ItemId>
+  void DeleteSubsumedCandidates(Scan<ItemId>* scan, size_t candidate_index);
+  template <typename ItemId>
+  void DeleteSubsumedCandidates(Scan<ItemId>* scan,
+                                const SetProperties& itemset);
 
   // Call FoundMaximalSet for all sets that remain as candidates, and
-  // release them from memory.  The candidate_ set will be empty
-  // upon return.
-  void DumpMaximalSets();
+  // release the chunk's memory.  The candidate_ set will be empty
+  // upon return. If further chunks follow, the sets are also appended
+  // to found_sets_. Returns false on IO error.
+  template <typename ItemId>
+  bool DumpMaximalSets(Chunk<ItemId>* chunk);
 
-  // Invoked for each maximal set found.
-  void FoundMaximalSet(const SetProperties& maximal_set);
+  // Invoked for each maximal set found, given its candidate index.
+  template <typename ItemId>
+  void FoundMaximalSet(const Chunk<ItemId>& chunk, size_t maximal_set);
 
-  // Deletes all candidates from the specified range that are subsumed
-  // by the current_set_.
+  // Deletes all candidates from the specified range of candidate
+  // indices that are subsumed by the current set of the scan.
+  template <typename ItemId>
   void DeleteSubsumedFromRange(
-    CandidateList::iterator begin_range_it,
-    CandidateList::iterator end_range_it,
+    Scan<ItemId>* scan,
+    size_t begin_range,
+    size_t end_range,
     const uint32_t* current_set_it,
     unsigned int depth);
 
+  // Deletes all candidates at or after first that are subsumed by the
+  // current set of the scan and lie below the given node of the trie
+  // of its chunk, whose candidates end at end. The prefix of the node
+  // is contained in the current set, and current_set_it follows the
+  // last of its items there.
+  template <typename ItemId>
+  void DeleteSubsumedFromNode(
+    Scan<ItemId>* scan,
+    size_t node,
+    size_t end,
+    size_t first,
+    const uint32_t* current_set_it);
+
   // Invoked by Recurse to delete & advance over any candidates that
   // are equal to the current prefix (and are hence subsumed).
+  template <typename ItemId>
   void DeleteSubsumedSets(
-    CandidateList::iterator* begin_range_it,
-    CandidateList::iterator end_range_it,
+    Scan<ItemId>* scan,
+    size_t* begin_range,
+    size_t end_range,
     unsigned int depth);
 
-  CandidateList::iterator GetNewBeginRangeIt(
-      CandidateList::iterator begin_range_it,
-      CandidateList::iterator end_range_it,
+  template <typename ItemId>
+  size_t GetNewBeginRange(
+      Scan<ItemId>* scan,
+      size_t begin_range,
+      size_t end_range,
       unsigned int current_item,
       unsigned int depth);
 
-  CandidateList::iterator GetNewEndRangeIt(
-      CandidateList::iterator begin_range_it,
-      CandidateList::iterator end_range_it,
+  template <typename ItemId>
+  size_t GetNewEndRange(
+      Scan<ItemId>* scan,
+      size_t begin_range,
+      size_t end_range,
       unsigned int current_item,
       unsigned int depth);
 
@@ -169,22 +435,44 @@ class AllMaximalSetsLexicographic {
   long input_sets_count_;
   long long canidate_seek_count_;
 
-  // Maps each item to a list of "candidate itemsets", each of which
-  // contains the item as its first entry.  Itemsets in each candidate
-  // list appear in increasing order of cardinality, then increasing
-  // lexocographic order. Some entries may be NULL.
-  CandidateList candidates_;
+  // The chunk being checked, and the one being loaded while it is if
+  // pipelined_, with 32-bit item ids, and with 16-bit ones for
+  // datasets whose ids all fit. Only one pair is used by each call.
+  Chunk<uint32_t> chunks_[2];
+  Chunk<uint16_t> narrow_chunks_[2];
 
-  // Index into candidates_. Maps each item id to the position within
-  // candidates_ containing the first set in the lexicographic
-  // ordering to follow the singleton set { item_id }.
-  std::vector<CandidateList::size_type> index_;
+  // True if the candidates are copied rather than being views into a
+  // memory-mapped dataset.
+  bool owns_candidates_;
 
   // Temporary/global variables
-  SetProperties* current_set_;
+  bool has_next_chunk_first_set_;
+  ItemSet next_chunk_first_set_;
+  // Decoding buffers for front-coded candidates. The loader keeps its
+  // own, since the next chunk may load while this one is dumped.
+  ItemSet item_buffer_;
+  ItemSet load_item_buffer_;
+  SetBatch batch_;
+  // The maximal sets of the chunks checked so far, when the data takes
+  // more than one, or NULL.
+  DataSourceIterator* found_sets_;
+  // The batches of found_sets_ read by DeleteSubsumedByPrecedingSets,
+  // one being checked while the other is read if thread_count_ > 1.
+  // They are separate from batch_ so that the next chunk can be read
+  // at the same time.
+  SetBatch rescan_batches_[2];
+  // The first candidate not yet handed out to a thread of
+  // DeleteSubsumedWithinChunk.
+  size_t next_scan_candidate_;
 
   // Configuration options.
-  uint32_t items_in_ram_, max_items_in_ram_;
+  uint64_t max_bytes_in_ram_;
+  // The part of max_bytes_in_ram_ that each chunk may take.
+  uint64_t chunk_bytes_limit_;
+  bool front_coded_;
+  bool use_trie_;
+  bool pipelined_;
+  int thread_count_;
   OutputModeEnum output_mode_;
 };
 
@@ -21,22 +21,27 @@
 #include <assert.h>
 #include <algorithm>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include "set-properties.h"
 #include "data-source-iterator.h"
+#include "index-snapshot.h"
+#include "memory-budget.h"
 
 namespace google_extremal_sets {
 
 namespace {
 
 // Returns true if set2 properly subsumes set1.
-inline bool IsSubsumedBy(const SetProperties& set1, const SetProperties& set2) {
+template <typename ItemId>
+inline bool IsSubsumedBy(const BasicSetProperties<ItemId>& set1,
+                         const BasicSetProperties<ItemId>& set2) {
   if (set1.size >= set2.size)
     return false;
-  const uint32_t* it1 = set1.begin();
-  const uint32_t* it2 = set2.begin();
-  const uint32_t* it1_end = set1.end();
-  const uint32_t* it2_end = set2.end();
+  const ItemId* it1 = set1.begin();
+  const ItemId* it2 = set2.begin();
+  const ItemId* it1_end = set1.end();
+  const ItemId* it2_end = set2.end();
 
   while (it1 != it1_end) {
     it2 = std::lower_bound(it2, it2_end, *it1);
@@ -48,19 +53,31 @@ inline bool IsSubsumedBy(const SetProperties& set1, const SetProperties& set2) {
   return true;
 }
 
+// Appends the itemset to the list, and returns the number of bytes by
+// which this grew the list's heap allocation.
+template <class List>
+inline size_t PushBack(List* list, typename List::value_type set) {
+  size_t capacity = list->capacity();
+  list->push_back(set);
+  if (list->capacity() == capacity)
+    return 0;
+  return HeapBytes(list->capacity() * sizeof(set)) -
+      HeapBytes(capacity * sizeof(set));
+}
+
 // Used to free up all itemset resources when it goes out of scope.
+template <class List>
 class CleanerUpper {
 public:
-  CleanerUpper(OccursList* all_sets) :
-    all_sets_(all_sets) {}
+  CleanerUpper(List* all_sets, SetArena* arena) :
+    all_sets_(all_sets), arena_(arena) {}
   ~CleanerUpper() {
-    for (unsigned int i = 0; i < all_sets_->size(); ++i) {
-      SetProperties::Delete((*all_sets_)[i]);
-    }
     all_sets_->clear();
+    arena_->Clear();
   }
 private:
-  OccursList* all_sets_;
+  List* all_sets_;
+  SetArena* arena_;
 };
 
 }  // namespace
@@ -68,42 +85,267 @@ private:
 bool AllMaximalSetsSateLite::FindAllMaximalSets(
     DataSourceIterator* data,
     uint32_t max_item_id,
-    uint32_t max_items_in_ram,
+    uint64_t max_bytes_in_ram,
     OutputModeEnum output_mode) {
   Init();
+  if (UseNarrowItems(data)) {
+    return FindAllMaximalSetsIn(data, max_item_id, max_bytes_in_ram,
+                                output_mode, &narrow_sets_);
+  }
+  return FindAllMaximalSetsIn(data, max_item_id, max_bytes_in_ram,
+                              output_mode, &sets_);
+}
+
+bool AllMaximalSetsSateLite::UseNarrowItems(DataSourceIterator* data) const {
+  // Only copies can store narrower ids than the dataset.
+  const DatasetMetadata* metadata = data->GetMetadata();
+  return !data->IsMapped() && metadata &&
+      metadata->max_item_id <= kMaxNarrowItemId;
+}
+
+template <typename ItemId>
+bool AllMaximalSetsSateLite::FindAllMaximalSetsIn(
+    DataSourceIterator* data,
+    uint32_t max_item_id,
+    uint64_t max_bytes_in_ram,
+    OutputModeEnum output_mode,
+    SetIndex<ItemId>* index) {
+  typedef typename SetIndex<ItemId>::OccursList OccursList;
+  CleanerUpper<OccursList> cleanup(&index->all_sets, &arena_);
+  if (!IndexDataset(data, max_item_id, max_bytes_in_ram, index))
+    return false;
+
+  std::cerr << "; Starting subsumption checking scan." << std::endl;
+  const OccursList& all_sets = index->all_sets;
+  for (unsigned int i = 0; i < all_sets.size(); ++i) {
+    if (!IsSubsumed(*all_sets[i], *index))
+      FoundMaximalSet(*(all_sets[i]), output_mode);
+  }
+  return true;
+}
 
+template <typename ItemId>
+bool AllMaximalSetsSateLite::IndexDataset(
+    DataSourceIterator* data,
+    uint32_t max_item_id,
+    uint64_t max_bytes_in_ram,
+    SetIndex<ItemId>* index) {
+  typedef typename SetIndex<ItemId>::OccursList OccursList;
   // Vars set by the data source iterator.
   int result;
-  uint32_t set_id;
-  std::vector<uint32_t> current_set;
+  SetBatch batch;
 
-  if (!PrepareForDataScan(data, max_item_id, 0))
+  if (!PrepareForDataScan(data, max_item_id, 0, index))
     return false;  // IO error
-  uint32_t items_in_ram = 0;
-  CleanerUpper cleanup(&all_sets_);
+  // Sets read from a memory-mapped dataset are indexed as views into
+  // the mapping rather than copied.
+  owns_sets_ = !data->IsMapped();
+  // Only itemsets of 32-bit ids can be views.
+  assert(owns_sets_ || sizeof(ItemId) == sizeof(uint32_t));
+  // The growth of every list is accounted for exactly, since the slack
+  // of many small lists adds up. The table of lists and the item map
+  // are added in as they grow.
+  uint64_t bytes_in_ram = HeapBytes(
+      index->all_sets.capacity() * sizeof(const BasicSetProperties<ItemId>*));
 
   // This loop scans the input data from beginning to end and indexes
   // each candidate on the occurrs_ lists.
-  while ((result = data->Next(&set_id, &current_set)) > 0) {
-    SetProperties* index_me = SetProperties::Create(set_id, current_set);
-    items_in_ram += current_set.size();
-    all_sets_.push_back(index_me);
-    if (items_in_ram >= max_items_in_ram) {
-      std::cerr << "; ERROR: max_items_in_ram exceeded." << std::endl;
-      return false;
+  while ((result = data->NextBatch(&batch, kDefaultBatchSize)) > 0) {
+    for (size_t b = 0; b < batch.size(); ++b) {
+      const SetProperties& current_set = batch[b];
+      const BasicSetProperties<ItemId>* index_me;
+      if (owns_sets_) {
+        // The items are checked before they are copied rather than
+        // trusting the max_item_id of the dataset header, since a
+        // stale header would otherwise have ids silently truncated.
+        if (!BasicSetProperties<ItemId>::Fits(current_set)) {
+          std::cerr << "; ERROR: Itemset " << current_set.set_id
+                    << " has an item id exceeding the max_item_id of the "
+                    << "dataset header." << std::endl;
+          return false;
+        }
+        index_me = arena_.Create<ItemId>(current_set);
+        bytes_in_ram += sizeof(BasicSetProperties<ItemId>) +
+            current_set.size * sizeof(ItemId);
+      } else {
+        // The record is used in place, so count its span of the
+        // mapping.
+        index_me =
+            reinterpret_cast<const BasicSetProperties<ItemId>*>(&current_set);
+        bytes_in_ram += (2 + current_set.size) * sizeof(uint32_t);
+      }
+      bytes_in_ram += PushBack(&index->all_sets, index_me);
+      ++input_sets_count_;
+      for (unsigned int i = 0; i < index_me->size; ++i) {
+        uint32_t slot = index->item_slots.Insert(index_me->item[i]);
+        if (slot == index->occurs.size())
+          index->occurs.push_back(OccursList());
+        bytes_in_ram += PushBack(&index->occurs[slot], index_me);
+      }
+      if (bytes_in_ram + index->occurs.capacity() * sizeof(OccursList) +
+              index->item_slots.BytesUsed() >= max_bytes_in_ram) {
+        std::cerr << "; ERROR: max_bytes_in_ram exceeded." << std::endl;
+        return false;
+      }
     }
-    ++input_sets_count_;
-    for (unsigned int i = 0; i < index_me->size; ++i) {
-      occurs_[index_me->item[i]].push_back(index_me);
+  }
+  return result == 0;  // false on IO error
+}
+
+bool AllMaximalSetsSateLite::SaveSnapshot(
+    DataSourceIterator* data,
+    uint32_t max_item_id,
+    uint64_t max_bytes_in_ram,
+    const char* snapshot_path) {
+  Init();
+  if (UseNarrowItems(data)) {
+    return SaveSnapshotOf(data, max_item_id, max_bytes_in_ram,
+                          snapshot_path, &narrow_sets_);
+  }
+  return SaveSnapshotOf(data, max_item_id, max_bytes_in_ram, snapshot_path,
+                        &sets_);
+}
+
+template <typename ItemId>
+bool AllMaximalSetsSateLite::SaveSnapshotOf(
+    DataSourceIterator* data,
+    uint32_t max_item_id,
+    uint64_t max_bytes_in_ram,
+    const char* snapshot_path,
+    SetIndex<ItemId>* index) {
+  typedef typename SetIndex<ItemId>::OccursList OccursList;
+  CleanerUpper<OccursList> cleanup(&index->all_sets, &arena_);
+  if (!IndexDataset(data, max_item_id, max_bytes_in_ram, index))
+    return false;
+  const OccursList& all_sets = index->all_sets;
+
+  std::cerr << "; Writing snapshot: " << snapshot_path << std::endl;
+  std::auto_ptr<SnapshotWriter> writer(
+      SnapshotWriter::Get(snapshot_path, SATELITE_SNAPSHOT));
+  if (!writer.get())
+    return false;
+  uint64_t parameters[2] = {
+    static_cast<uint64_t>(input_sets_count_), 0/*reserved*/ };
+  if (!writer->WriteSection(SECTION_PARAMETERS, parameters, 2) ||
+      !writer->BeginSection(SECTION_RECORDS)) {
+    return false;
+  }
+  // The records are written in the order of all_sets, noting the
+  // word offset at which each begins. Records always hold 32-bit ids,
+  // so narrow itemsets are widened on the way out.
+  std::vector<uint64_t> record_offsets(all_sets.size());
+  uint64_t offset = 0;
+  ItemSet record;
+  for (size_t i = 0; i < all_sets.size(); ++i) {
+    const BasicSetProperties<ItemId>& set = *all_sets[i];
+    record_offsets[i] = offset;
+    offset += 2 + set.size;
+    record.clear();
+    record.push_back(set.set_id);
+    record.push_back(set.size);
+    record.insert(record.end(), set.begin(), set.end());
+    if (!writer->Write(&record[0], record.size() * sizeof(uint32_t)))
+      return false;
+  }
+  // The occurs lists are written in increasing order of their items.
+  // Each holds the itemsets containing its item in the order of
+  // all_sets, so the lists can be laid out back to back from their
+  // sizes, and then filled by a pass over all_sets. The lists
+  // themselves are released first to make room.
+  ItemMap& item_slots = index->item_slots;
+  std::vector<uint32_t> slots;
+  item_slots.SlotsInItemOrder(&slots);
+  std::vector<uint32_t> items(slots.size());
+  std::vector<uint32_t> positions(slots.size());
+  std::vector<uint64_t> occurs_begin(slots.size() + 1, 0);
+  for (size_t i = 0; i < slots.size(); ++i) {
+    items[i] = item_slots.Item(slots[i]);
+    positions[slots[i]] = i;
+    occurs_begin[i + 1] = occurs_begin[i] + index->occurs[slots[i]].size();
+  }
+  index->occurs.clear();
+  std::vector<uint64_t> occurs(occurs_begin.back());
+  std::vector<uint64_t> cursors(occurs_begin.begin(), occurs_begin.end() - 1);
+  for (size_t i = 0; i < all_sets.size(); ++i) {
+    const BasicSetProperties<ItemId>& set = *all_sets[i];
+    for (uint32_t j = 0; j < set.size; ++j) {
+      uint32_t position = positions[item_slots.Find(set.item[j])];
+      occurs[cursors[position]++] = record_offsets[i];
     }
   }
-  if (result != 0)
-    return false;  // IO error
+  item_slots.Clear();
+  return writer->WriteSection(SECTION_OCCURS_ITEMS, items) &&
+      writer->WriteSection(SECTION_OCCURS_BEGIN, occurs_begin) &&
+      writer->WriteSection(SECTION_OCCURS, occurs) &&
+      writer->Close();
+}
+
+bool AllMaximalSetsSateLite::FindAllMaximalSetsInSnapshot(
+    const char* snapshot_path, OutputModeEnum output_mode) {
+  Init();
+  std::auto_ptr<MappedSnapshot> snapshot(
+      MappedSnapshot::Get(snapshot_path, SATELITE_SNAPSHOT));
+  const uint64_t* parameters;
+  const uint32_t* records;
+  const uint32_t* items;
+  const uint64_t* occurs_begin;
+  const uint64_t* occurs;
+  size_t parameter_count, record_words, item_count, begin_count, occurs_count;
+  if (!snapshot.get() ||
+      !snapshot->GetArray(SECTION_PARAMETERS, &parameters, &parameter_count) ||
+      !snapshot->GetArray(SECTION_RECORDS, &records, &record_words) ||
+      !snapshot->GetArray(SECTION_OCCURS_ITEMS, &items, &item_count) ||
+      !snapshot->GetArray(SECTION_OCCURS_BEGIN, &occurs_begin, &begin_count) ||
+      !snapshot->GetArray(SECTION_OCCURS, &occurs, &occurs_count)) {
+    return false;
+  }
+  // Check that every record and list entry lies within its section, so
+  // that no access can stray outside of the mapping.
+  bool valid = parameter_count > 0 && begin_count == item_count + 1 &&
+      occurs_begin[0] == 0 && occurs_begin[item_count] == occurs_count;
+  for (size_t i = 1; valid && i < item_count; ++i)
+    valid = items[i - 1] < items[i];
+  for (size_t i = 1; valid && i <= item_count; ++i)
+    valid = occurs_begin[i - 1] <= occurs_begin[i];
+  for (size_t i = 0; valid && i < occurs_count; ++i) {
+    valid = occurs[i] + 2 <= record_words &&
+        records[occurs[i] + 1] <= record_words - occurs[i] - 2;
+  }
+  for (size_t offset = 0; valid && offset < record_words; ) {
+    valid = offset + 2 <= record_words &&
+        records[offset + 1] <= record_words - offset - 2;
+    if (valid)
+      offset += 2 + records[offset + 1];
+  }
+  if (!valid) {
+    std::cerr << "ERROR: Inconsistent snapshot file (" << snapshot_path
+              << ")\n";
+    return false;
+  }
+  input_sets_count_ = parameters[0];
 
   std::cerr << "; Starting subsumption checking scan." << std::endl;
-  for (unsigned int i = 0; i < all_sets_.size(); ++i) {
-    if (!IsSubsumed(*all_sets_[i]))
-      FoundMaximalSet(*(all_sets_[i]), output_mode);
+  for (size_t offset = 0; offset < record_words; ) {
+    const SetProperties& candidate =
+        *reinterpret_cast<const SetProperties*>(records + offset);
+    offset += 2 + candidate.size;
+    // An empty itemset is subsumed by any other.
+    bool subsumed = candidate.size == 0 && occurs_count > 0;
+    const uint32_t* item = candidate.size ?
+        std::lower_bound(items, items + item_count, candidate[0]) :
+        items + item_count;
+    if (item != items + item_count && *item == candidate[0]) {
+      size_t i = item - items;
+      for (uint64_t j = occurs_begin[i];
+           !subsumed && j < occurs_begin[i + 1]; ++j) {
+        ++subsumption_checks_count_;
+        subsumed = IsSubsumedBy(
+            candidate,
+            *reinterpret_cast<const SetProperties*>(records + occurs[j]));
+      }
+    }
+    if (!subsumed)
+      FoundMaximalSet(candidate, output_mode);
   }
   return true;
 }
@@ -112,19 +354,37 @@ void AllMaximalSetsSateLite::Init() {
   maximal_sets_count_ = input_sets_count_ = subsumption_checks_count_ = 0;
 }
 
+template <typename ItemId>
 bool AllMaximalSetsSateLite::PrepareForDataScan(
-    DataSourceIterator* data, uint32_t max_item_id, off_t resume_offset) {
-  occurs_.clear();
-  occurs_.resize(max_item_id);
+    DataSourceIterator* data, uint32_t, off_t resume_offset,
+    SetIndex<ItemId>* index) {
+  index->occurs.clear();
+  index->item_slots.Clear();
+  const DatasetMetadata* metadata = data->GetMetadata();
+  if (metadata) {
+    index->all_sets.reserve(metadata->set_count);
+    // There can be no more lists than distinct items.
+    index->occurs.reserve(
+        std::min<uint64_t>(static_cast<uint64_t>(metadata->max_item_id) + 1,
+                           metadata->total_items));
+  }
   std::cerr << "; Starting new dataset scan at offset: "
             << resume_offset << std::endl;
   return data->Seek(resume_offset);
 }
 
-bool AllMaximalSetsSateLite::IsSubsumed(const SetProperties& candidate) {
-  const OccursList& occurs = occurs_[candidate[0]];
+template <typename ItemId>
+bool AllMaximalSetsSateLite::IsSubsumed(
+    const BasicSetProperties<ItemId>& candidate,
+    const SetIndex<ItemId>& index) {
+  // An empty itemset is subsumed by any other, and has no item to look
+  // up.
+  if (candidate.size == 0)
+    return !index.occurs.empty();
+  const typename SetIndex<ItemId>::OccursList& occurs =
+      index.occurs[index.item_slots.Find(candidate[0])];
   for (unsigned int j = 0; j < occurs.size(); ++j) {
-    SetProperties* check_me = occurs[j];
+    const BasicSetProperties<ItemId>* check_me = occurs[j];
     ++subsumption_checks_count_;
     if (IsSubsumedBy(candidate, *check_me))
       return true;
@@ -132,8 +392,10 @@ bool AllMaximalSetsSateLite::IsSubsumed(const SetProperties& candidate) {
   return false;
 }
 
+template <typename ItemId>
 void AllMaximalSetsSateLite::FoundMaximalSet(
-    const SetProperties& maximal_set, OutputModeEnum output_mode) {
+    const BasicSetProperties<ItemId>& maximal_set,
+    OutputModeEnum output_mode) {
   ++maximal_sets_count_;
   switch (output_mode) {
     case COUNT_ONLY:
@@ -144,7 +406,7 @@ void AllMaximalSetsSateLite::FoundMaximalSet(
     case ID_AND_ITEMS:
       std::cout << maximal_set.set_id << ":";
       for (unsigned int i = 0; i < maximal_set.size; ++i) {
-        std::cout << ' ' << maximal_set.item[i];
+        std::cout << ' ' << static_cast<uint32_t>(maximal_set.item[i]);
       }
       std::cout << '\n';
       break;
@@ -37,14 +37,13 @@
 
 #include <vector>
 #include "basic-types.h"
+#include "huge-page-allocator.h"
+#include "item-map.h"
+#include "set-arena.h"
 
 namespace google_extremal_sets {
 
 class DataSourceIterator;
-class SetProperties;
-
-// A list of itemsets used to store candidates within the map.
-typedef std::vector<SetProperties*> OccursList;
 
 class AllMaximalSetsSateLite {
  public:
@@ -57,22 +56,46 @@ class AllMaximalSetsSateLite {
   // call to data->GetErrorMessage() will return a human-readable
   // description of the problem.
   //
-  // The caller must provide an upperbound on max_item_id which will
-  // be used to preallocate buffers.
+  // Item ids may be arbitrary 32-bit integers: there is an occurs list
+  // for each distinct item rather than for each possible item id, so
+  // max_item_id is ignored. If the dataset header records metadata
+  // (see DatasetMetadata), the buffers are preallocated from it. If it
+  // also shows that all item ids fit in 16 bits, copied itemsets and
+  // the occurs lists holding them store the ids as such, halving the
+  // memory they take and the bandwidth consumed by checking them.
   //
-  // The caller must also specify a bound on the number of 4-byte item
-  // ids that will be stored in main memory during algorithm
-  // execution. Should the dataset contain more items than the limit,
-  // the algorithm will return false and fail to produce correct
+  // The caller must also specify a bound on the number of bytes of
+  // main memory used by the itemsets and the occurs lists during
+  // algorithm execution (see memory-budget.h for choosing one); the
+  // buffers of the data source are not included. Should the index not
+  // fit, the algorithm will return false and fail to produce correct
   // results.
   //
   // This method may output status & progress messages to stderr.
   bool FindAllMaximalSets(
       DataSourceIterator* data,
       uint32_t max_item_id,
-      uint32_t max_items_in_ram,
+      uint64_t max_bytes_in_ram,
       OutputModeEnum output_mode);
 
+  // Reads and indexes the "data" stream as FindAllMaximalSets does,
+  // and writes the itemsets and their occurs lists to a snapshot file
+  // at snapshot_path (see index-snapshot.h) instead of checking them
+  // for subsumption. Returns false on error.
+  bool SaveSnapshot(
+      DataSourceIterator* data,
+      uint32_t max_item_id,
+      uint64_t max_bytes_in_ram,
+      const char* snapshot_path);
+
+  // Like FindAllMaximalSets, but for the dataset from which the
+  // snapshot at snapshot_path was saved. The itemsets and occurs lists
+  // are used in place from the mapped snapshot rather than read and
+  // indexed again. Returns false on error, which is reported to
+  // stderr.
+  bool FindAllMaximalSetsInSnapshot(
+      const char* snapshot_path, OutputModeEnum output_mode);
+
   // Returns the number of maximal sets found by the last call to
   // FindAllMaximalSets.
   long MaximalSetsCount() const { return maximal_sets_count_; }
@@ -90,29 +113,86 @@ class AllMaximalSetsSateLite {
   // initialization.
   void Init();
 
+  // The indexed itemsets, with item ids of type ItemId, and the occurs
+  // lists over them.
+  template <typename ItemId>
+  struct SetIndex {
+    // A list of itemsets used to store candidates within the map.
+    typedef std::vector<const BasicSetProperties<ItemId>*> OccursList;
+
+    // Stores a pointer to each indexed itemset.
+    OccursList all_sets;
+
+    // Maps each item to the list of itemsets that contain the item,
+    // which is occurs[item_slots.Find(item)].
+    std::vector<OccursList, HugePageAllocator<OccursList> > occurs;
+    ItemMap item_slots;
+  };
+
+  // Returns true if the itemsets of the data are to be indexed with
+  // 16-bit item ids.
+  bool UseNarrowItems(DataSourceIterator* data) const;
+
+  // Does the work of FindAllMaximalSets, and respectively of
+  // SaveSnapshot, once the item id type of the index is chosen.
+  template <typename ItemId>
+  bool FindAllMaximalSetsIn(
+      DataSourceIterator* data,
+      uint32_t max_item_id,
+      uint64_t max_bytes_in_ram,
+      OutputModeEnum output_mode,
+      SetIndex<ItemId>* index);
+  template <typename ItemId>
+  bool SaveSnapshotOf(
+      DataSourceIterator* data,
+      uint32_t max_item_id,
+      uint64_t max_bytes_in_ram,
+      const char* snapshot_path,
+      SetIndex<ItemId>* index);
+
   // Prepare datastructures for scanning the data beginning at the
   // provided offset. Returns false if IO error encountered.
+  template <typename ItemId>
   bool PrepareForDataScan(
-      DataSourceIterator* data, uint32_t max_item_i, off_t seek_offset);
+      DataSourceIterator* data, uint32_t max_item_i, off_t seek_offset,
+      SetIndex<ItemId>* index);
+
+  // Reads all itemsets of the data into index->all_sets and indexes
+  // them on the occurs lists. Returns false on error.
+  template <typename ItemId>
+  bool IndexDataset(
+      DataSourceIterator* data,
+      uint32_t max_item_id,
+      uint64_t max_bytes_in_ram,
+      SetIndex<ItemId>* index);
 
-  // Once the occurs_ lists have been populated, this method can be
+  // Once the occurs lists have been populated, this method can be
   // called to determine whether a given candidate is properly
   // subsumed by some other set.
-  bool IsSubsumed(const SetProperties& candidate);
+  template <typename ItemId>
+  bool IsSubsumed(const BasicSetProperties<ItemId>& candidate,
+                  const SetIndex<ItemId>& index);
 
   // Invoked for each maximal set found.
-  void FoundMaximalSet(const SetProperties& maximal_set, OutputModeEnum mode);
+  template <typename ItemId>
+  void FoundMaximalSet(const BasicSetProperties<ItemId>& maximal_set,
+                       OutputModeEnum mode);
 
   // Stats variables.
   long maximal_sets_count_;
   long input_sets_count_;
   long long subsumption_checks_count_;
 
-  // Stores a pointer to each indexed itemset.
-  OccursList all_sets_;
+  // The index, with 32-bit item ids, and with 16-bit ones for datasets
+  // whose ids all fit. Only one is used by each call.
+  SetIndex<uint32_t> sets_;
+  SetIndex<uint16_t> narrow_sets_;
 
-  // Maps each item to the list of itemsets that contain the item.
-  std::vector<OccursList> occurs_;
+  // True if the indexed itemsets were allocated by us rather than
+  // being views into a memory-mapped dataset, in which case they are
+  // held by arena_.
+  bool owns_sets_;
+  SetArena arena_;
 };
 
 }  // namespace google_extremal_sets
@@ -0,0 +1,173 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// Constants and helpers describing the on-disk dataset formats shared
+// by DataSourceIterator and AprioriWriter.
+//
+// A legacy "apriori binary" file is a plain sequence of records:
+//
+//   <set id> <number of items> <item 1> ... <item n>
+//
+// Newer files begin with a file header, which is distinguished from a
+// legacy record by having kHeaderMarker in the position of the record
+// length (a length no valid record can have):
+//
+//   <kHeaderMagic> <kHeaderMarker> <format version> <header bytes>
+//   <flags> <sets per block>
+//
+// All header fields are 4-byte integers. "header bytes" is the total
+// length of the header, so that readers can skip fields they do not
+// understand.
+//
+// If kFlagMetadata is set, the fixed fields are followed by a
+// description of the dataset (see DatasetMetadata):
+//
+//   <set count> <total items> <max item id> <sort order>
+//   <histogram length n> <reserved> <histogram 0> ... <histogram n-1>
+//
+// where the set count, total items and histogram entries are 8-byte
+// integers, and histogram entry i is the number of sets with i items.
+//
+// Format version 1 is the apriori binary record format following the
+// header. Format version 2 ("compressed apriori") stores the itemsets
+// in independently decodable blocks:
+//
+//   <payload bytes> <number of sets> <payload>
+//
+// where the payload holds, for every set, the varint-encoded set id,
+// the number of leading items shared with the previous set of the
+// block (only if kFlagFrontCoded is set), the number of remaining
+// items, and then the remaining items, each encoded as the varint
+// difference from the preceding item of the set (the first item of a
+// set is relative to 0).
+//
+// A dataset may be accompanied by an index sidecar file, named after
+// the dataset with an ".idx" suffix, which records the position (as
+// returned by DataSourceIterator::Tell) of every N-th itemset:
+//
+//   <kIndexMagic> <N> <number of entries> <reserved>
+//   <IndexEntry 1> ... <IndexEntry n>
+// ---
+// Author: Roberto Bayardo
+
+#ifndef _APRIORI_FORMAT_H_
+#define _APRIORI_FORMAT_H_
+
+#include <vector>
+#include "basic-types.h"
+
+namespace google_extremal_sets {
+
+const uint32_t kHeaderMagic = 0x49525041;  // "APRI" in little endian.
+const uint32_t kHeaderMarker = 0xffffffff;
+
+const uint32_t kFormatBinary = 1;
+const uint32_t kFormatCompressed = 2;
+
+// Size of the fixed portion of the file header, in bytes.
+const uint32_t kBaseHeaderBytes = 24;
+
+// Header flags.
+const uint32_t kFlagFrontCoded = 1;
+const uint32_t kFlagMetadata = 2;
+
+// Size of the fixed portion of the metadata, in bytes.
+const uint32_t kBaseMetadataBytes = 32;
+
+// Sort orders recorded in the metadata.
+enum SortOrder {
+  SORT_UNKNOWN = 0,
+  SORT_LEXICOGRAPHIC = 1,  // Increasing lexicographic order.
+  SORT_CARDINALITY = 2     // Increasing cardinality, then lexicographic.
+};
+
+// Positions within compressed files (as returned by
+// DataSourceIterator::Tell) encode the file offset of a block in the
+// high bits and the index of a set within the block in the low
+// kBlockIndexBits bits, which limits the number of sets per block.
+const int kBlockIndexBits = 16;
+const uint32_t kMaxSetsPerBlock = (1 << kBlockIndexBits) - 1;
+
+// Magic number identifying an index sidecar file.
+const uint32_t kIndexMagic = 0x58495041;  // "APIX" in little endian.
+
+// Suffix appended to a dataset path to obtain its index sidecar path.
+const char kIndexSuffix[] = ".idx";
+
+struct IndexEntry {
+  uint64_t ordinal;     // number of itemsets preceding this one.
+  uint64_t position;    // position of the itemset within the dataset.
+  uint32_t first_item;  // first item of the itemset, or 0 if empty.
+  uint32_t reserved;
+};
+
+// Summary of a dataset that writers can record in the file header so
+// that the algorithms can size their data structures up front.
+struct DatasetMetadata {
+  DatasetMetadata()
+      : set_count(0), total_items(0), max_item_id(0),
+        sort_order(SORT_UNKNOWN) {
+  }
+
+  // Accounts for a set with the given items.
+  void Add(const uint32_t* items, uint32_t size) {
+    ++set_count;
+    total_items += size;
+    for (uint32_t i = 0; i < size; ++i) {
+      if (items[i] > max_item_id)
+        max_item_id = items[i];
+    }
+    if (size >= cardinality_histogram.size())
+      cardinality_histogram.resize(size + 1);
+    ++cardinality_histogram[size];
+  }
+
+  uint64_t set_count;
+  uint64_t total_items;
+  uint32_t max_item_id;
+  uint32_t sort_order;  // a SortOrder
+  std::vector<uint64_t> cardinality_histogram;
+};
+
+// Appends the varint encoding of value to out, returning the advanced
+// output pointer. out must have room for 5 bytes.
+inline unsigned char* EncodeVarint(uint32_t value, unsigned char* out) {
+  while (value >= 0x80) {
+    *out++ = static_cast<unsigned char>(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = static_cast<unsigned char>(value);
+  return out;
+}
+
+// Decodes a varint from [in, end) into *value. Returns the advanced
+// input pointer, or NULL if the input is truncated or malformed.
+inline const unsigned char* DecodeVarint(
+    const unsigned char* in, const unsigned char* end, uint32_t* value) {
+  uint32_t result = 0;
+  for (int shift = 0; shift < 35 && in != end; shift += 7) {
+    uint32_t byte = *in++;
+    result |= (byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      *value = result;
+      return in;
+    }
+  }
+  return 0;
+}
+
+}  // namespace google_extremal_sets
+
+#endif  // _APRIORI_FORMAT_H_
@@ -0,0 +1,236 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ---
+// Author: Roberto Bayardo
+
+#include "apriori-writer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <iostream>
+
+#include "apriori-format.h"
+#include "set-properties.h"
+
+namespace {
+
+// Number of sets placed in each block of a compressed dataset. Larger
+// blocks compress slightly better since the first set of a block
+// cannot be front coded, but make seeks more expensive.
+const uint32_t kSetsPerBlock = 4096;
+
+}  // namespace
+
+namespace google_extremal_sets {
+
+/*static*/
+AprioriWriter* AprioriWriter::Get(
+    const char* output_path, Format format, bool front_coded,
+    const DatasetMetadata* metadata) {
+  FILE* output = fopen(output_path, "wb");
+  if (!output) {
+    std::cerr << "; Could not open output file for writing: "
+              << output_path << ": " << strerror(errno) << "\n";
+    return 0;
+  }
+  AprioriWriter* writer =
+      new AprioriWriter(output, output_path, format, front_coded);
+  if (!writer->WriteHeader(metadata)) {
+    std::cerr << "; Failed to write header to output file: "
+              << output_path << "\n";
+    delete writer;
+    return 0;
+  }
+  return writer;
+}
+
+AprioriWriter::AprioriWriter(
+    FILE* output, const char* output_path, Format format, bool front_coded)
+    : output_(output),
+      output_path_(output_path),
+      format_(format),
+      front_coded_(front_coded),
+      failed_(false),
+      bytes_written_(0),
+      sets_written_(0),
+      index_interval_(0),
+      block_sets_(0) {
+}
+
+AprioriWriter::~AprioriWriter() {
+  if (output_)
+    Close();
+}
+
+namespace {
+
+// Appends a 64-bit header field as two 4-byte integers in memory order.
+void AppendUint64(uint64_t value, std::vector<uint32_t>* header) {
+  uint32_t words[2];
+  memcpy(words, &value, sizeof(value));
+  header->push_back(words[0]);
+  header->push_back(words[1]);
+}
+
+}  // namespace
+
+bool AprioriWriter::WriteHeader(const DatasetMetadata* metadata) {
+  if (format_ == BINARY && !metadata)
+    return true;  // Legacy files have no header.
+  std::vector<uint32_t> header;
+  header.push_back(kHeaderMagic);
+  header.push_back(kHeaderMarker);
+  header.push_back(format_ == BINARY ? kFormatBinary : kFormatCompressed);
+  header.push_back(0);  // header bytes, filled in below.
+  header.push_back((front_coded_ && format_ == COMPRESSED ?
+                    kFlagFrontCoded : 0) |
+                   (metadata ? kFlagMetadata : 0));
+  header.push_back(format_ == COMPRESSED ? kSetsPerBlock : 0);
+  if (metadata) {
+    AppendUint64(metadata->set_count, &header);
+    AppendUint64(metadata->total_items, &header);
+    header.push_back(metadata->max_item_id);
+    header.push_back(metadata->sort_order);
+    header.push_back(metadata->cardinality_histogram.size());
+    header.push_back(0);  // reserved
+    for (size_t i = 0; i < metadata->cardinality_histogram.size(); ++i)
+      AppendUint64(metadata->cardinality_histogram[i], &header);
+  }
+  header[3] = header.size() * sizeof(uint32_t);
+  bytes_written_ = header[3];
+  return fwrite(&header[0], sizeof(uint32_t), header.size(), output_) ==
+      header.size();
+}
+
+bool AprioriWriter::Write(const SetProperties& set) {
+  return Write(set.set_id, set.item, set.size);
+}
+
+bool AprioriWriter::Write(uint32_t set_id, const ItemSet& items) {
+  return Write(set_id, items.empty() ? 0 : &items[0], items.size());
+}
+
+bool AprioriWriter::Write(
+    uint32_t set_id, const uint32_t* items, uint32_t size) {
+  if (failed_)
+    return false;
+  if (index_interval_ && sets_written_ % index_interval_ == 0) {
+    IndexEntry entry;
+    entry.ordinal = sets_written_;
+    entry.position = format_ == BINARY ? bytes_written_ :
+        (bytes_written_ << kBlockIndexBits) | block_sets_;
+    entry.first_item = size ? items[0] : 0;
+    entry.reserved = 0;
+    index_.push_back(entry);
+  }
+  ++sets_written_;
+  if (format_ == BINARY) {
+    uint32_t record_header[2] = { set_id, size };
+    if (fwrite(record_header, sizeof(record_header), 1, output_) != 1 ||
+        fwrite(items, sizeof(uint32_t), size, output_) != size) {
+      failed_ = true;
+    }
+    bytes_written_ += sizeof(uint32_t) * (2 + size);
+    return !failed_;
+  }
+
+  for (uint32_t i = 1; i < size; ++i) {
+    if (items[i - 1] >= items[i]) {
+      std::cerr << "; Items of set " << set_id
+                << " are not strictly increasing.\n";
+      failed_ = true;
+      return false;
+    }
+  }
+  uint32_t prefix = 0;
+  if (front_coded_ && block_sets_) {
+    while (prefix < size && prefix < previous_set_.size() &&
+           items[prefix] == previous_set_[prefix]) {
+      ++prefix;
+    }
+  }
+
+  // Worst case is 5 bytes per varint.
+  size_t old_size = block_.size();
+  block_.resize(old_size + 5 * (3 + size));
+  unsigned char* out = &block_[old_size];
+  out = EncodeVarint(set_id, out);
+  if (front_coded_)
+    out = EncodeVarint(prefix, out);
+  out = EncodeVarint(size - prefix, out);
+  uint32_t previous_item = prefix ? items[prefix - 1] : 0;
+  for (uint32_t i = prefix; i < size; ++i) {
+    out = EncodeVarint(items[i] - previous_item, out);
+    previous_item = items[i];
+  }
+  block_.resize(out - &block_[0]);
+  if (front_coded_)
+    previous_set_.assign(items, items + size);
+
+  if (++block_sets_ == kSetsPerBlock)
+    return FlushBlock();
+  return true;
+}
+
+bool AprioriWriter::FlushBlock() {
+  if (!block_sets_)
+    return true;
+  uint32_t block_header[2];
+  block_header[0] = block_.size();
+  block_header[1] = block_sets_;
+  if (fwrite(block_header, sizeof(block_header), 1, output_) != 1 ||
+      fwrite(&block_[0], 1, block_.size(), output_) != block_.size()) {
+    failed_ = true;
+  }
+  bytes_written_ += sizeof(block_header) + block_.size();
+  block_.clear();
+  block_sets_ = 0;
+  return !failed_;
+}
+
+bool AprioriWriter::Close() {
+  if (format_ == COMPRESSED)
+    FlushBlock();
+  if (fclose(output_))
+    failed_ = true;
+  output_ = 0;
+  if (index_interval_ && !failed_ && !WriteIndex())
+    failed_ = true;
+  return !failed_;
+}
+
+bool AprioriWriter::WriteIndex() {
+  std::string index_path = output_path_ + kIndexSuffix;
+  FILE* index_file = fopen(index_path.c_str(), "wb");
+  if (!index_file) {
+    std::cerr << "; Could not open index file for writing: "
+              << index_path << ": " << strerror(errno) << "\n";
+    return false;
+  }
+  uint32_t header[4] = {
+    kIndexMagic, index_interval_, static_cast<uint32_t>(index_.size()), 0
+  };
+  bool success = fwrite(header, sizeof(header), 1, index_file) == 1;
+  if (success && !index_.empty()) {
+    success = fwrite(&index_[0], sizeof(IndexEntry), index_.size(),
+                     index_file) == index_.size();
+  }
+  if (fclose(index_file))
+    success = false;
+  return success;
+}
+
+}  // namespace google_extremal_sets
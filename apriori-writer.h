@@ -0,0 +1,106 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// Writer for apriori binary and compressed apriori datasets. See
+// apriori-format.h for a description of the formats.
+// ---
+// Author: Roberto Bayardo
+
+#ifndef _APRIORI_WRITER_H_
+#define _APRIORI_WRITER_H_
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "apriori-format.h"
+#include "basic-types.h"
+
+namespace google_extremal_sets {
+
+class AprioriWriter {
+ public:
+  enum Format {
+    BINARY,     // Apriori binary records.
+    COMPRESSED  // Block-compressed, delta & varint encoded items.
+  };
+
+  // Factory method for obtaining a writer of the given format to the
+  // file at output_path. For the COMPRESSED format, front_coded
+  // specifies whether items shared with the previous set are elided.
+  // If metadata is non-NULL it is recorded in the file header, in
+  // which case BINARY files get a header as well; it must describe the
+  // sets that will be written. Returns NULL on error and reports the
+  // error details to stderr.
+  static AprioriWriter* Get(
+      const char* output_path, Format format, bool front_coded,
+      const DatasetMetadata* metadata);
+
+  // Closes the file if Close() has not already been called.
+  ~AprioriWriter();
+
+  // Requests that an index sidecar file recording the position of every
+  // interval-th set be written alongside the dataset when it is
+  // closed. Must be called before the first Write().
+  void EnableIndex(uint32_t interval) { index_interval_ = interval; }
+
+  // Appends the set to the output. Items of sets written to a
+  // COMPRESSED dataset must be strictly increasing. Returns false on
+  // error.
+  bool Write(const SetProperties& set);
+
+  // Like Write above, but takes the set id and items separately so
+  // that callers need not build a SetProperties object.
+  bool Write(uint32_t set_id, const ItemSet& items);
+  bool Write(uint32_t set_id, const uint32_t* items, uint32_t size);
+
+  // Flushes any buffered data and closes the output file, then writes
+  // the index sidecar if enabled. Returns false on IO error.
+  bool Close();
+
+ private:
+  AprioriWriter(
+      FILE* output, const char* output_path, Format format, bool front_coded);
+
+  // Writes the index sidecar file.
+  bool WriteIndex();
+
+  bool WriteHeader(const DatasetMetadata* metadata);
+
+  // Writes out the current block of a COMPRESSED dataset.
+  bool FlushBlock();
+
+  FILE* output_;
+  const std::string output_path_;
+  const Format format_;
+  const bool front_coded_;
+  bool failed_;
+
+  // Number of bytes and sets written so far. For COMPRESSED datasets
+  // the bytes only include complete blocks.
+  uint64_t bytes_written_;
+  uint64_t sets_written_;
+
+  uint32_t index_interval_;  // 0 if no index is to be written.
+  std::vector<IndexEntry> index_;
+
+  // Current block of a COMPRESSED dataset.
+  std::vector<unsigned char> block_;
+  uint32_t block_sets_;
+  ItemSet previous_set_;
+};
+
+}  // namespace google_extremal_sets
+
+#endif  // _APRIORI_WRITER_H_
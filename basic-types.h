@@ -22,7 +22,9 @@
 #define _BASIC_TYPES_H_
 
 #ifdef MICROSOFT   // MS VC++ specific code
+typedef unsigned __int16 uint16_t;
 typedef unsigned __int32 uint32_t;
+typedef unsigned __int64 uint64_t;
 #else
 #include <stdint.h>
 #include <sys/types.h>
@@ -34,6 +36,15 @@ namespace google_extremal_sets {
 
 typedef std::vector<uint32_t> ItemSet;
 
+// Itemsets whose item ids are of type ItemId (see set-properties.h).
+// Datasets hold 32-bit ids, but the algorithms store copies of their
+// itemsets with 16-bit ids when all of them are at most
+// kMaxNarrowItemId.
+template <typename ItemId> class BasicSetProperties;
+typedef BasicSetProperties<uint32_t> SetProperties;
+typedef BasicSetProperties<uint16_t> NarrowSetProperties;
+const uint32_t kMaxNarrowItemId = 0xffff;
+
 enum OutputModeEnum {
   COUNT_ONLY,   // Only count maximal sets. No output to stdout.
   ID,           // Output ids of maximal sets to stdout.
@@ -0,0 +1,396 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ---
+// Author: Roberto Bayardo
+
+#include "candidate-store.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "index-snapshot.h"
+#include "set-properties.h"
+
+namespace {
+
+// Every kRestartInterval-th candidate of a front-coded store is stored
+// in full, bounding the walk performed by CandidateStore::Item.
+const size_t kRestartInterval = 16;
+
+// Flags of the SECTION_CANDIDATE_FORMAT section of a snapshot.
+const uint32_t kFormatFrontCoded = 1;
+const uint32_t kFormatNarrow = 2;
+
+}  // namespace
+
+namespace google_extremal_sets {
+
+namespace {
+
+// Returns the position of the lowest set bit of a non-zero word.
+inline int LowestBit(uint64_t word) {
+#ifdef __GNUC__
+  return __builtin_ctzll(word);
+#else
+  int bit = 0;
+  while (!(word & 1)) {
+    word >>= 1;
+    ++bit;
+  }
+  return bit;
+#endif
+}
+
+// Moves count items within the vector from one offset to another.
+template <typename Vector>
+inline void MoveItems(Vector* items, size_t from, size_t to, size_t count) {
+  memmove(&(*items)[to], &(*items)[from],
+          count * sizeof(typename Vector::value_type));
+}
+
+}  // namespace
+
+template <typename ItemId>
+void CandidateStore<ItemId>::Reserve(size_t sets, size_t items) {
+  offsets_.reserve(sets);
+  sizes_.reserve(sets);
+  set_ids_.reserve(sets);
+  live_.reserve(sets / 64 + 1);
+  live_words_.reserve(sets / (64 * 64) + 1);
+  if (front_coded_)
+    prefixes_.reserve(sets);
+  if (!views_) {
+    items_.reserve(items);
+    base_ = items_.empty() ? 0 : &items_[0];
+  }
+}
+
+template <typename ItemId>
+void CandidateStore<ItemId>::Append(ptrdiff_t offset, uint32_t size, uint32_t set_id) {
+  size_t i = sizes_.size();
+  if ((i & 63) == 0) {
+    size_t word = i >> 6;
+    if ((word & 63) == 0)
+      live_words_.push_back(0);
+    live_words_[word >> 6] |= static_cast<uint64_t>(1) << (word & 63);
+    live_.push_back(0);
+  }
+  live_[i >> 6] |= static_cast<uint64_t>(1) << (i & 63);
+  offsets_.push_back(offset);
+  sizes_.push_back(size);
+  set_ids_.push_back(set_id);
+}
+
+template <typename ItemId>
+bool CandidateStore<ItemId>::Add(const SetProperties& set) {
+  assert(!views_ || empty());
+  views_ = false;
+  uint32_t prefix = 0;
+  if (front_coded_ && size() % kRestartInterval) {
+    while (prefix < set.size && prefix < last_items_.size() &&
+           set.item[prefix] == last_items_[prefix]) {
+      ++prefix;
+    }
+  }
+  // Narrow items are checked as they are copied rather than trusting
+  // the max_item_id of the dataset header, since a stale header would
+  // otherwise have ids silently truncated. The shared prefix was
+  // checked along with the preceding candidate.
+  const size_t offset = items_.size();
+  if (sizeof(ItemId) < sizeof(uint32_t)) {
+    const uint32_t high_mask = ~static_cast<uint32_t>(ItemId(-1));
+    uint32_t high_bits = 0;
+    for (const uint32_t* it = set.begin() + prefix; it != set.end(); ++it) {
+      high_bits |= *it & high_mask;
+      items_.push_back(*it);
+    }
+    if (high_bits) {
+      items_.resize(offset);
+      return false;
+    }
+  } else {
+    items_.insert(items_.end(), set.begin() + prefix, set.end());
+  }
+  base_ = items_.empty() ? 0 : &items_[0];
+  if (front_coded_) {
+    prefixes_.push_back(prefix);
+    last_items_.assign(set.begin(), set.end());
+  }
+  Append(offset, set.size, set.set_id);
+  return true;
+}
+
+template <typename ItemId>
+void CandidateStore<ItemId>::AddView(const SetProperties& set) {
+  assert(views_ || empty());
+  assert(sizeof(ItemId) == sizeof(uint32_t));
+  if (empty()) {
+    views_ = true;
+    base_ = reinterpret_cast<const ItemId*>(set.item);
+  }
+  const ItemId* items = reinterpret_cast<const ItemId*>(set.item);
+  assert(items >= base_);
+  Append(items - base_, set.size, set.set_id);
+}
+
+template <typename ItemId>
+const uint32_t* CandidateStore<ItemId>::Items(size_t i, ItemSet* buffer) const {
+  if (!front_coded_ && sizeof(ItemId) == sizeof(uint32_t))
+    return reinterpret_cast<const uint32_t*>(base_ + offsets_[i]);
+  buffer->resize(sizes_[i]);
+  if (buffer->empty())
+    return 0;
+  uint32_t* items = &(*buffer)[0];
+  if (!front_coded_) {
+    CopyItems(offsets_[i], sizes_[i], items);
+    return items;
+  }
+  // Fill in the items from the back: each candidate on the way back
+  // supplies the items from its prefix length up to where the
+  // candidate after it took over.
+  uint32_t limit = sizes_[i];
+  for (size_t j = i; limit > 0; --j) {
+    uint32_t prefix = prefixes_[j];
+    if (prefix < limit) {
+      CopyItems(offsets_[j], limit - prefix, items + prefix);
+      limit = prefix;
+    }
+  }
+  return items;
+}
+
+template <typename ItemId>
+void CandidateStore<ItemId>::CopyItems(
+    ptrdiff_t offset, uint32_t count, uint32_t* out) const {
+  std::copy(base_ + offset, base_ + offset + count, out);
+}
+
+template <typename ItemId>
+size_t CandidateStore<ItemId>::NextLive(size_t i, size_t end) const {
+  if (i >= end)
+    return end;
+  uint64_t live = LiveWord(i) >> (i & 63);
+  if (live) {
+    i += LowestBit(live);
+    return i < end ? i : end;
+  }
+  // Find the next non-zero word of live_ through the summary.
+  const size_t end_word = (end + 63) >> 6;
+  size_t word = (i >> 6) + 1;
+  while (word < end_word) {
+    uint64_t summary = __atomic_load_n(&live_words_[word >> 6],
+                                       __ATOMIC_RELAXED) >> (word & 63);
+    if (!summary) {
+      word = (word | 63) + 1;
+      continue;
+    }
+    word += LowestBit(summary);
+    if (word >= end_word)
+      break;
+    // The word may have been cleared by another thread since the
+    // summary was read.
+    live = LiveWord(word << 6);
+    if (live) {
+      i = (word << 6) + LowestBit(live);
+      return i < end ? i : end;
+    }
+    ++word;
+  }
+  return end;
+}
+
+template <typename ItemId>
+void CandidateStore<ItemId>::SummarizeLive() {
+  live_words_.assign((live_.size() + 63) / 64, 0);
+  for (size_t word = 0; word < live_.size(); ++word) {
+    if (live_[word])
+      live_words_[word >> 6] |= static_cast<uint64_t>(1) << (word & 63);
+  }
+}
+
+template <typename ItemId>
+size_t CandidateStore<ItemId>::BytesUsed() const {
+  size_t bytes = size() * (sizeof(ptrdiff_t) + 2 * sizeof(uint32_t)) +
+      (live_.size() + live_words_.size()) * sizeof(uint64_t) +
+      (prefixes_.size() + last_items_.size()) * sizeof(uint32_t);
+  if (!views_) {
+    bytes += items_.size() * sizeof(ItemId);
+  } else if (!empty()) {
+    // The span of the views includes the record headers of all but
+    // the first.
+    bytes += (2 + offsets_.back() + sizes_.back()) * sizeof(uint32_t);
+  }
+  return bytes;
+}
+
+template <typename ItemId>
+void CandidateStore<ItemId>::Compact() {
+  if (front_coded_)
+    return;
+  size_t out = 0;
+  size_t item_out = 0;
+  for (size_t i = 0; i < size(); ++i) {
+    if (!IsLive(i))
+      continue;
+    if (!views_) {
+      // Candidates only move towards the front, so this never
+      // overwrites items that have yet to be moved.
+      if (static_cast<size_t>(offsets_[i]) != item_out && sizes_[i])
+        MoveItems(&items_, offsets_[i], item_out, sizes_[i]);
+      offsets_[out] = item_out;
+      item_out += sizes_[i];
+    } else {
+      offsets_[out] = offsets_[i];
+    }
+    sizes_[out] = sizes_[i];
+    set_ids_[out] = set_ids_[i];
+    ++out;
+  }
+  offsets_.resize(out);
+  sizes_.resize(out);
+  set_ids_.resize(out);
+  if (!views_)
+    items_.resize(item_out);
+  live_.assign((out + 63) / 64, ~static_cast<uint64_t>(0));
+  if (out & 63)
+    live_.back() = (static_cast<uint64_t>(1) << (out & 63)) - 1;
+  SummarizeLive();
+}
+
+template <typename ItemId>
+void CandidateStore<ItemId>::Clear() {
+  items_.clear();
+  base_ = 0;
+  views_ = false;
+  offsets_.clear();
+  sizes_.clear();
+  set_ids_.clear();
+  live_.clear();
+  live_words_.clear();
+  prefixes_.clear();
+  last_items_.clear();
+}
+
+template <typename ItemId>
+bool CandidateStore<ItemId>::Save(SnapshotWriter* writer) const {
+  uint32_t format[2] = {
+    (front_coded_ ? kFormatFrontCoded : 0) |
+        (sizeof(ItemId) < sizeof(uint32_t) ? kFormatNarrow : 0),
+    0  // reserved
+  };
+  if (!writer->WriteSection(SECTION_CANDIDATE_FORMAT, format, 2) ||
+      !writer->WriteSection(SECTION_CANDIDATE_SIZES, sizes_) ||
+      !writer->WriteSection(SECTION_CANDIDATE_IDS, set_ids_) ||
+      !writer->WriteSection(SECTION_CANDIDATE_LIVE, live_) ||
+      !writer->WriteSection(SECTION_CANDIDATE_PREFIXES, prefixes_)) {
+    return false;
+  }
+  if (!views_) {
+    return writer->WriteSection(SECTION_CANDIDATE_OFFSETS, offsets_) &&
+        writer->WriteSection(SECTION_CANDIDATE_ITEMS, items_);
+  }
+  // Views are interleaved with the other contents of the dataset, so
+  // their items are gathered back to back.
+  if (!writer->BeginSection(SECTION_CANDIDATE_OFFSETS))
+    return false;
+  ptrdiff_t offset = 0;
+  for (size_t i = 0; i < size(); ++i) {
+    if (!writer->Write(&offset, sizeof(offset)))
+      return false;
+    offset += sizes_[i];
+  }
+  if (!writer->BeginSection(SECTION_CANDIDATE_ITEMS))
+    return false;
+  for (size_t i = 0; i < size(); ++i) {
+    if (!writer->Write(base_ + offsets_[i], sizes_[i] * sizeof(ItemId)))
+      return false;
+  }
+  return true;
+}
+
+template <typename ItemId>
+bool CandidateStore<ItemId>::Load(const MappedSnapshot& snapshot) {
+  Clear();
+  const uint32_t* format;
+  const ptrdiff_t* offsets;
+  const uint32_t* sizes;
+  const uint32_t* set_ids;
+  const uint64_t* live;
+  const uint32_t* prefixes;
+  size_t format_count, count, sizes_count, set_ids_count, live_count,
+      prefixes_count;
+  if (!snapshot.GetArray(SECTION_CANDIDATE_FORMAT, &format, &format_count) ||
+      !snapshot.GetArray(SECTION_CANDIDATE_OFFSETS, &offsets, &count) ||
+      !snapshot.GetArray(SECTION_CANDIDATE_SIZES, &sizes, &sizes_count) ||
+      !snapshot.GetArray(SECTION_CANDIDATE_IDS, &set_ids, &set_ids_count) ||
+      !snapshot.GetArray(SECTION_CANDIDATE_LIVE, &live, &live_count) ||
+      !snapshot.GetArray(SECTION_CANDIDATE_PREFIXES, &prefixes,
+                         &prefixes_count)) {
+    return false;
+  }
+  bool valid = format_count > 0 &&
+      SavedCandidateItemBytes(snapshot) == sizeof(ItemId);
+  if (valid) {
+    front_coded_ = (format[0] & kFormatFrontCoded) != 0;
+    valid = sizes_count == count && set_ids_count == count &&
+        live_count == (count + 63) / 64 &&
+        prefixes_count == (front_coded_ ? count : 0);
+  }
+  size_t item_count = 0;
+  if (valid)
+    valid = snapshot.GetArray(SECTION_CANDIDATE_ITEMS, &base_, &item_count);
+  // Check that every candidate lies within the items, and that every
+  // front-coded prefix is available from the preceding candidate, so
+  // that no access can stray outside of the mapping.
+  for (size_t i = 0; valid && i < count; ++i) {
+    uint32_t prefix = front_coded_ ? prefixes[i] : 0;
+    valid = prefix <= sizes[i] &&
+        (prefix == 0 || (i > 0 && prefix <= sizes[i - 1])) &&
+        offsets[i] >= 0 &&
+        static_cast<size_t>(offsets[i]) <= item_count &&
+        sizes[i] - prefix <= item_count - offsets[i];
+  }
+  if (!valid) {
+    std::cerr << "ERROR: Inconsistent candidates in snapshot file.\n";
+    Clear();
+    front_coded_ = false;
+    return false;
+  }
+  views_ = true;
+  offsets_.assign(offsets, offsets + count);
+  sizes_.assign(sizes, sizes + count);
+  set_ids_.assign(set_ids, set_ids + count);
+  live_.assign(live, live + live_count);
+  SummarizeLive();
+  prefixes_.assign(prefixes, prefixes + prefixes_count);
+  return true;
+}
+
+size_t SavedCandidateItemBytes(const MappedSnapshot& snapshot) {
+  const uint32_t* format;
+  size_t format_count;
+  if (!snapshot.GetArray(SECTION_CANDIDATE_FORMAT, &format, &format_count) ||
+      format_count == 0) {
+    return 0;
+  }
+  return (format[0] & kFormatNarrow) ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+template class CandidateStore<uint32_t>;
+template class CandidateStore<uint16_t>;
+
+}  // namespace google_extremal_sets
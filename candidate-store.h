@@ -0,0 +1,222 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// CandidateStore: a list of candidate itemsets stored as parallel
+// arrays rather than as individually allocated objects.
+// ---
+// Author: Roberto Bayardo
+
+#ifndef _CANDIDATE_STORE_H_
+#define _CANDIDATE_STORE_H_
+
+#include <stddef.h>
+#include <vector>
+#include "basic-types.h"
+#include "huge-page-allocator.h"
+
+namespace google_extremal_sets {
+
+class MappedSnapshot;
+class SnapshotWriter;
+
+// The items of all candidates are kept back to back in a single array,
+// with the offset, size and id of each candidate in arrays of their
+// own, and deletions recorded in a bitmap, which is summarized by a
+// second bitmap of its non-zero words so that long runs of deleted
+// candidates are skipped 4096 at a time. Scanning a range of
+// candidates therefore reads sequential memory instead of following a
+// pointer per candidate. Candidates are identified by their index in
+// the list.
+//
+// Copied candidates can optionally be front coded: a candidate then
+// only stores the items following the prefix it shares with its
+// predecessor. Every kRestartInterval-th candidate is stored in full,
+// so that finding any item takes a bounded walk back to the nearest
+// candidate that stores it.
+//
+// The store is a template over the type of the stored item ids. When
+// every item id is at most kMaxNarrowItemId, a CandidateStore<uint16_t>
+// holds copies with 16-bit ids, halving the memory they take and the
+// bandwidth consumed by scanning them. Only a CandidateStore<uint32_t>
+// can hold views.
+template <typename ItemId>
+class CandidateStore {
+ public:
+  CandidateStore() : base_(0), views_(false), front_coded_(false) {}
+
+  // Selects whether copied candidates are front coded. May only be
+  // called while the store is empty.
+  void SetFrontCoded(bool front_coded) { front_coded_ = front_coded; }
+
+  // Bytes of memory used by each copied item.
+  static size_t BytesPerItem() { return sizeof(ItemId); }
+
+  // Number of candidates, including deleted ones.
+  size_t size() const { return sizes_.size(); }
+  bool empty() const { return sizes_.empty(); }
+
+  // Preallocates room for the given number of candidates and items.
+  void Reserve(size_t sets, size_t items);
+
+  // Appends a copy of the itemset. Returns false, leaving the store
+  // unchanged, if one of its items does not fit in an ItemId.
+  bool Add(const SetProperties& set);
+
+  // Appends the itemset without copying its items, which must remain
+  // valid for as long as the store holds them. A store holds either
+  // copies or views, and all views must point into the same object
+  // (e.g. one memory-mapped dataset) in increasing order of address.
+  // ItemId must be uint32_t.
+  void AddView(const SetProperties& set);
+
+  bool IsLive(size_t i) const {
+    return (LiveWord(i) >> (i & 63)) & 1;
+  }
+  void Delete(size_t i) {
+    uint64_t& word = live_[i >> 6];
+    word &= ~(static_cast<uint64_t>(1) << (i & 63));
+    if (!word)
+      ClearLiveWord(i >> 6, false);
+  }
+
+  // Like Delete, but safe while other threads delete candidates (and
+  // check whether they are live) too. Bits are only ever cleared, so
+  // only the thread clearing the last bit of a word clears its bit in
+  // the summary.
+  void DeleteConcurrently(size_t i) {
+    uint64_t bit = static_cast<uint64_t>(1) << (i & 63);
+    if (__sync_fetch_and_and(&live_[i >> 6], ~bit) == bit)
+      ClearLiveWord(i >> 6, true);
+  }
+
+  // Returns the index of the first live candidate in [i, end), or end
+  // if there is none.
+  size_t NextLive(size_t i, size_t end) const;
+
+  uint32_t Size(size_t i) const { return sizes_[i]; }
+  uint32_t SetId(size_t i) const { return set_ids_[i]; }
+
+  uint32_t Item(size_t i, uint32_t depth) const {
+    if (front_coded_) {
+      // Deleted candidates keep their items, so the walk need not
+      // check liveness.
+      while (prefixes_[i] > depth)
+        --i;
+      return base_[offsets_[i] + depth - prefixes_[i]];
+    }
+    return base_[offsets_[i] + depth];
+  }
+
+  // Returns the items of the i-th candidate. Front-coded or narrow
+  // candidates are decoded into *buffer; otherwise the items are
+  // returned in place, and remain valid until the store is next
+  // modified (other than by Delete).
+  const uint32_t* Items(size_t i, ItemSet* buffer) const;
+
+  // Bytes of memory used by each candidate besides its stored items,
+  // depending on whether the store holds views. For views this
+  // includes the record header that precedes the items within the
+  // dataset.
+  size_t BytesPerCandidate(bool views) const {
+    return sizeof(ptrdiff_t) + 2 * sizeof(uint32_t) +
+        (front_coded_ ? sizeof(uint32_t) : 0) +
+        (views ? 2 * sizeof(uint32_t) : 0);
+  }
+
+  // Bytes of memory used by the candidates, counting the span of the
+  // dataset covered by views. Capacity reserved beyond what is in use
+  // is not counted, since the pages of large arrays are not resident
+  // until they are first written.
+  size_t BytesUsed() const;
+
+  // Removes the deleted candidates, preserving the order of the
+  // rest. Front-coded stores keep their deleted candidates, whose
+  // items may be shared with later ones.
+  void Compact();
+
+  // Removes all candidates. The memory is kept for reuse.
+  void Clear();
+
+  // Writes the candidates to the snapshot as its SECTION_CANDIDATE_*
+  // sections (see index-snapshot.h). Returns false on IO error.
+  bool Save(SnapshotWriter* writer) const;
+
+  // Replaces the candidates with those saved in the snapshot. Their
+  // items are used in place, like views, so the snapshot must stay
+  // mapped for as long as the store holds them; the remaining arrays
+  // are copied, since deleting candidates modifies them. Returns false
+  // and reports the error to stderr if the snapshot is invalid or its
+  // items are not ItemIds (see SavedCandidateItemBytes).
+  bool Load(const MappedSnapshot& snapshot);
+
+ private:
+  // Appends the bookkeeping for a new live candidate.
+  void Append(ptrdiff_t offset, uint32_t size, uint32_t set_id);
+
+  // Copies count stored items from the given offset to out.
+  void CopyItems(ptrdiff_t offset, uint32_t count, uint32_t* out) const;
+
+  // Returns the word of the live_ bitmap holding bit i. Deletions only
+  // ever clear bits, so a stale word at worst has a candidate checked
+  // that has just been deleted.
+  uint64_t LiveWord(size_t i) const {
+    return __atomic_load_n(&live_[i >> 6], __ATOMIC_RELAXED);
+  }
+
+  // Clears the bit of live_words_ for the given word of live_, which
+  // has become zero.
+  void ClearLiveWord(size_t word, bool concurrently) {
+    uint64_t bit = static_cast<uint64_t>(1) << (word & 63);
+    if (concurrently)
+      __sync_fetch_and_and(&live_words_[word >> 6], ~bit);
+    else
+      live_words_[word >> 6] &= ~bit;
+  }
+
+  // Rebuilds live_words_ from live_.
+  void SummarizeLive();
+
+  // Items of the candidates, if they are copies.
+  std::vector<ItemId, HugePageAllocator<ItemId> > items_;
+
+  // Candidate i's items begin at base_ + offsets_[i]. base_ points into
+  // items_ or, for views, at the first item of the first view.
+  const ItemId* base_;
+  bool views_;
+  bool front_coded_;
+  std::vector<ptrdiff_t, HugePageAllocator<ptrdiff_t> > offsets_;
+  std::vector<uint32_t, HugePageAllocator<uint32_t> > sizes_;
+  std::vector<uint32_t, HugePageAllocator<uint32_t> > set_ids_;
+
+  // Bit i is set while candidate i has not been deleted, and bit w of
+  // live_words_ while word w of live_ is non-zero.
+  std::vector<uint64_t, HugePageAllocator<uint64_t> > live_;
+  std::vector<uint64_t, HugePageAllocator<uint64_t> > live_words_;
+
+  // For front-coded stores, the number of leading items candidate i
+  // shares with candidate i - 1 and does not store, and the items of
+  // the last candidate added.
+  std::vector<uint32_t, HugePageAllocator<uint32_t> > prefixes_;
+  ItemSet last_items_;
+};
+
+// Returns the bytes taken by each item of the candidates saved in the
+// snapshot, i.e. the size of the ItemId of the CandidateStore that can
+// load them, or 0 if the snapshot holds no candidates.
+size_t SavedCandidateItemBytes(const MappedSnapshot& snapshot);
+
+}  // namespace google_extremal_sets
+
+#endif  // _CANDIDATE_STORE_H_
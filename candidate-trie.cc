@@ -0,0 +1,129 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ---
+// Author: Roberto Bayardo
+
+#include "candidate-trie.h"
+
+#include "candidate-store.h"
+
+namespace {
+
+using google_extremal_sets::CandidateStore;
+
+// Returns the position following the candidates of [first, last) whose
+// item at the given depth is that of the candidate at first. The items
+// at that depth increase over the range, and the runs of equal items
+// are typically short, so the search gallops ahead of first.
+template <typename ItemId>
+size_t GroupEnd(const CandidateStore<ItemId>& candidates,
+                size_t first, size_t last, unsigned int depth) {
+  const uint32_t item = candidates.Item(first, depth);
+  size_t low = first;
+  size_t high = last;
+  size_t step = 1;
+  while (step < high - low) {
+    size_t probe = low + step;
+    if (candidates.Item(probe, depth) != item) {
+      high = probe;
+      break;
+    }
+    low = probe;
+    step <<= 1;
+  }
+  ++low;
+  while (low < high) {
+    size_t middle = low + ((high - low) >> 1);
+    if (candidates.Item(middle, depth) == item)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+}  // namespace
+
+namespace google_extremal_sets {
+
+template <typename ItemId>
+void CandidateTrie::Build(const CandidateStore<ItemId>& candidates) {
+  nodes_.clear();
+  nodes_.reserve(2 * candidates.size() + 1);
+  Node root;
+  root.first_child = root.begin = 0;
+  root.item = root.depth = root.child_count = 0;
+  nodes_.push_back(root);
+  BuildChildren(candidates, Root(), 0, candidates.size());
+}
+
+template <typename ItemId>
+void CandidateTrie::BuildChildren(const CandidateStore<ItemId>& candidates,
+                                  size_t node, size_t begin, size_t end) {
+  const uint32_t depth = nodes_[node].depth;
+  // The candidates equal to the prefix sort first.
+  while (begin < end && candidates.Size(begin) == depth)
+    ++begin;
+  if (begin == end)
+    return;
+  // Nodes_ grows as the subtrees are built, so nodes are referred to by
+  // index throughout.
+  const size_t first_child = nodes_.size();
+  for (size_t group = begin; group < end;
+       group = GroupEnd(candidates, group, end, depth)) {
+    Node child;
+    child.first_child = 0;
+    child.begin = group;
+    child.item = candidates.Item(group, depth);
+    child.depth = depth + 1;
+    child.child_count = 0;
+    nodes_.push_back(child);
+  }
+  const size_t last_child = nodes_.size();
+  nodes_[node].first_child = first_child;
+  nodes_[node].child_count = last_child - first_child;
+  for (size_t child = first_child; child < last_child; ++child) {
+    size_t child_begin = nodes_[child].begin;
+    size_t child_end =
+        child + 1 < last_child ? nodes_[child + 1].begin : end;
+    // Extend the edge for as long as no candidate ends and all agree on
+    // the next item, which in sorted order is when the first and last
+    // candidates do.
+    uint32_t child_depth = depth + 1;
+    while (candidates.Size(child_begin) > child_depth &&
+           candidates.Size(child_end - 1) > child_depth &&
+           candidates.Item(child_begin, child_depth) ==
+               candidates.Item(child_end - 1, child_depth))
+      ++child_depth;
+    nodes_[child].depth = child_depth;
+    BuildChildren(candidates, child, child_begin, child_end);
+  }
+}
+
+template void CandidateTrie::Build(const CandidateStore<uint32_t>&);
+template void CandidateTrie::Build(const CandidateStore<uint16_t>&);
+
+size_t CandidateTrie::LowerBoundChild(
+    size_t child, size_t last, uint32_t item) const {
+  while (child < last) {
+    size_t middle = child + ((last - child) >> 1);
+    if (nodes_[middle].item < item)
+      child = middle + 1;
+    else
+      last = middle;
+  }
+  return child;
+}
+
+}  // namespace google_extremal_sets
@@ -0,0 +1,118 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// CandidateTrie: an explicit prefix tree over a lexicographically
+// sorted CandidateStore.
+// ---
+// Author: Roberto Bayardo
+
+#ifndef _CANDIDATE_TRIE_H_
+#define _CANDIDATE_TRIE_H_
+
+#include <vector>
+#include "basic-types.h"
+#include "huge-page-allocator.h"
+
+namespace google_extremal_sets {
+
+template <typename ItemId> class CandidateStore;
+
+// Each node of the trie stands for a prefix shared by a contiguous range
+// of the candidates, starting with those equal to it. Chains of nodes
+// with a single child and no candidates of their own are collapsed into
+// one, so the trie has at most two nodes per candidate, and the items
+// along the edge into a node are not copied but read from the first
+// candidate below it. The children of a node are contiguous and in
+// increasing order of the first item on their edge, so descending to
+// the child for an item is a search among the children alone.
+//
+// The trie only refers to candidates by position, so deleting
+// candidates from the store leaves it valid; nodes whose candidates are
+// all deleted are recognized through CandidateStore::NextLive.
+class CandidateTrie {
+ private:
+  struct Node {
+    uint64_t first_child;
+    uint64_t begin;
+    uint32_t item;
+    uint32_t depth;
+    uint32_t child_count;
+  };
+
+ public:
+  // Bytes of memory used by the trie for each candidate, at most.
+  static const size_t kBytesPerCandidate = 2 * sizeof(Node);
+
+  // Bytes of memory used by a trie over the given number of
+  // candidates, at most.
+  static uint64_t BytesFor(uint64_t candidates) {
+    return candidates * kBytesPerCandidate + sizeof(Node);
+  }
+
+  // Builds the trie over all of the candidates, deleted or not, which
+  // must be in increasing lexicographic order.
+  template <typename ItemId>
+  void Build(const CandidateStore<ItemId>& candidates);
+
+  // Removes all nodes. The memory is kept for reuse.
+  void Clear() { nodes_.clear(); }
+
+  // The node of the empty prefix, which has the empty candidates as
+  // its own.
+  static size_t Root() { return 0; }
+
+  // Length of the prefix of the node.
+  uint32_t Depth(size_t node) const { return nodes_[node].depth; }
+
+  // The first item on the edge into the node, i.e. the item of its
+  // prefix at the depth of its parent.
+  uint32_t Item(size_t node) const { return nodes_[node].item; }
+
+  // Position of the first candidate with the prefix of the node. The
+  // candidates with the prefix end where those of the next sibling
+  // begin, or for the last child, where those of its parent end.
+  size_t Begin(size_t node) const { return nodes_[node].begin; }
+
+  // Position following the last candidate equal to the prefix of the
+  // node, given the end of the node's candidates.
+  size_t OwnEnd(size_t node, size_t end) const {
+    return nodes_[node].child_count ?
+        nodes_[nodes_[node].first_child].begin : end;
+  }
+
+  // The children of the node are [FirstChild, FirstChild + ChildCount).
+  size_t FirstChild(size_t node) const { return nodes_[node].first_child; }
+  size_t ChildCount(size_t node) const { return nodes_[node].child_count; }
+
+  // Returns the first of the children [child, last) of a node whose
+  // item is at least the given item, or last if there is none.
+  size_t LowerBoundChild(size_t child, size_t last, uint32_t item) const;
+
+  // Bytes of memory used by the nodes.
+  uint64_t BytesUsed() const { return nodes_.size() * sizeof(Node); }
+
+ private:
+  // Adds the children of the node, whose candidates are [begin, end),
+  // and the subtrees below them.
+  template <typename ItemId>
+  void BuildChildren(const CandidateStore<ItemId>& candidates,
+                     size_t node, size_t begin, size_t end);
+
+  std::vector<Node, HugePageAllocator<Node> > nodes_;
+};
+
+}  // namespace google_extremal_sets
+
+#endif  // _CANDIDATE_TRIE_H_
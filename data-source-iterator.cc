@@ -18,12 +18,26 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#ifndef MICROSOFT
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include <iostream>
 #include <string>
 #include <vector>
 
+#include "apriori-format.h"
+#ifndef MICROSOFT
+#include "read-ahead-reader.h"
+#endif
+#include "set-properties.h"
+
 #ifdef MICROSOFT
 #define fseeko _fseeki64
 #define ftello _ftelli64
@@ -36,6 +50,44 @@ namespace {
 // improperly formatted binary data.
 const uint32_t kMaxVectorSize = 99999;
 
+// Sanity limit on the size of file headers.
+const uint32_t kMaxHeaderBytes = 1 << 24;
+
+// Size of the buffer NextText parses from when the data is not mapped.
+const size_t kTextBufferSize = 1 << 20;
+
+// Separators of the text format: blank, \t, \n, \v, \f and \r.
+inline bool IsTextSpace(char c) {
+  return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+}
+
+// Size of the buffer used when copying streamed input to the spill
+// file.
+const size_t kSpillBufferSize = 1 << 20;
+
+// Opens an anonymous temporary file for spilling streamed input, in
+// $TMPDIR if set. Returns NULL on error.
+FILE* OpenSpillFile() {
+#ifdef MICROSOFT
+  return tmpfile();
+#else
+  const char* directory = getenv("TMPDIR");
+  if (!directory || !*directory)
+    directory = "/tmp";
+  std::string path = std::string(directory) + "/ams-spill-XXXXXX";
+  std::vector<char> name(path.begin(), path.end());
+  name.push_back('\0');
+  int fd = mkstemp(&name[0]);
+  if (fd < 0)
+    return 0;
+  unlink(&name[0]);  // The file goes away once closed.
+  FILE* spill = fdopen(fd, "w+b");
+  if (!spill)
+    close(fd);
+  return spill;
+#endif
+}
+
 std::string ToString(uint32_t l) {
   char buf[30];
   sprintf(buf, "%u", l);
@@ -48,27 +100,284 @@ namespace google_extremal_sets {
 
 /*static*/
 DataSourceIterator* DataSourceIterator::Get(const char* filename) {
-  FILE* data = fopen(filename, "rb");
+  bool stream = strcmp(filename, "-") == 0;
+  FILE* data = stream ? stdin : fopen(filename, "rb");
   if (!data) {
     std::cerr << "ERROR: Failed to open input file ("
               << filename << "): " << strerror(errno) << "\n";
     return 0;
   }
-  return new DataSourceIterator(data);
+  DataSourceIterator* iterator = new DataSourceIterator(data, filename);
+  iterator->stream_ = stream;
+  if (!iterator->ReadHeader()) {
+    std::cerr << "ERROR: Invalid header in input file ("
+              << filename << "): " << iterator->GetErrorMessage() << "\n";
+    delete iterator;
+    return 0;
+  }
+  return iterator;
 }
 
-DataSourceIterator::DataSourceIterator(FILE* data)
+bool DataSourceIterator::ReadHeader() {
+  std::vector<uint32_t> header(kBaseHeaderBytes / 4);
+  size_t bytes_read = ReadBytes(&header[0], 8);
+  if (bytes_read != 8 ||
+      header[0] != kHeaderMagic || header[1] != kHeaderMarker) {
+    // A legacy apriori binary (or text) file without header.
+    clearerr(data_);
+    if (stream_) {
+      // The input cannot be rewound, so hand the bytes back to
+      // ReadBytes instead.
+      pushback_.assign(reinterpret_cast<const char*>(&header[0]), bytes_read);
+      stream_offset_ = 0;
+    }
+    return Seek(0);
+  }
+  if (ReadBytes(&header[2], kBaseHeaderBytes - 8) !=
+      kBaseHeaderBytes - 8) {
+    error_ = "Truncated file header.";
+    return false;
+  }
+  // Read the rest of the header, if any.
+  uint32_t header_bytes = header[3];
+  if (header_bytes > kBaseHeaderBytes && header_bytes <= kMaxHeaderBytes &&
+      header_bytes % 4 == 0) {
+    header.resize(header_bytes / 4);
+    if (ReadBytes(&header[kBaseHeaderBytes / 4],
+                  header_bytes - kBaseHeaderBytes) !=
+        header_bytes - kBaseHeaderBytes) {
+      error_ = "Truncated file header.";
+      return false;
+    }
+  }
+  return ParseHeader(&header[0]);
+}
+
+namespace {
+
+// Reads a 64-bit header field stored as two 4-byte integers.
+uint64_t ReadUint64(const uint32_t* field) {
+  uint64_t value;
+  memcpy(&value, field, sizeof(value));
+  return value;
+}
+
+}  // namespace
+
+bool DataSourceIterator::ParseHeader(const uint32_t* header) {
+  format_ = header[2];
+  data_begin_ = header[3];
+  flags_ = header[4];
+  if (format_ != kFormatBinary && format_ != kFormatCompressed) {
+    error_ = "Unsupported dataset format version " + ToString(format_);
+    return false;
+  }
+  if (data_begin_ < kBaseHeaderBytes || data_begin_ > kMaxHeaderBytes ||
+      data_begin_ % 4 != 0) {
+    error_ = "Invalid file header length.";
+    return false;
+  }
+  if (flags_ & kFlagMetadata) {
+    const uint32_t* fields = header + kBaseHeaderBytes / 4;
+    if (data_begin_ < kBaseHeaderBytes + kBaseMetadataBytes ||
+        (data_begin_ - kBaseHeaderBytes - kBaseMetadataBytes) / 8 <
+        fields[6]) {
+      error_ = "Truncated dataset metadata.";
+      return false;
+    }
+    metadata_.set_count = ReadUint64(&fields[0]);
+    metadata_.total_items = ReadUint64(&fields[2]);
+    metadata_.max_item_id = fields[4];
+    metadata_.sort_order = fields[5];
+    metadata_.cardinality_histogram.resize(fields[6]);
+    for (uint32_t i = 0; i < fields[6]; ++i) {
+      metadata_.cardinality_histogram[i] =
+          ReadUint64(&fields[kBaseMetadataBytes / 4 + 2 * i]);
+    }
+    has_metadata_ = true;
+  }
+  next_block_offset_ = block_offset_ = data_begin_;
+  return mapped_ || Seek(0);
+}
+
+/*static*/
+DataSourceIterator* DataSourceIterator::GetMapped(const char* filename) {
+#ifdef MICROSOFT
+  std::cerr << "ERROR: Memory-mapped input is not supported on this "
+            << "platform (" << filename << ")\n";
+  return 0;
+#else
+  if (strcmp(filename, "-") == 0) {
+    std::cerr << "ERROR: Memory-mapped input requires a file, not a "
+              << "stream.\n";
+    return 0;
+  }
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "ERROR: Failed to open input file ("
+              << filename << "): " << strerror(errno) << "\n";
+    return 0;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat)) {
+    std::cerr << "ERROR: Failed to stat input file ("
+              << filename << "): " << strerror(errno) << "\n";
+    close(fd);
+    return 0;
+  }
+  DataSourceIterator* iterator = new DataSourceIterator(0, filename);
+  iterator->mapped_ = true;
+  iterator->map_size_ = file_stat.st_size;
+  if (iterator->map_size_) {
+    void* map = mmap(0, iterator->map_size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+      std::cerr << "ERROR: Failed to map input file ("
+                << filename << "): " << strerror(errno) << "\n";
+      close(fd);
+      delete iterator;
+      return 0;
+    }
+    iterator->map_ = static_cast<const char*>(map);
+  }
+  close(fd);
+
+  const uint32_t* header = reinterpret_cast<const uint32_t*>(iterator->map_);
+  if (iterator->map_size_ >= kBaseHeaderBytes &&
+      header[0] == kHeaderMagic && header[1] == kHeaderMarker) {
+    if (iterator->map_size_ < header[3]) {
+      std::cerr << "ERROR: Truncated header in input file ("
+                << filename << ")\n";
+      delete iterator;
+      return 0;
+    }
+    if (!iterator->ParseHeader(header)) {
+      std::cerr << "ERROR: Invalid header in input file (" << filename
+                << "): " << iterator->GetErrorMessage() << "\n";
+      delete iterator;
+      return 0;
+    }
+    if (iterator->format_ == kFormatCompressed) {
+      // Compressed itemsets must be decoded, so there is nothing to
+      // gain from the mapping.
+      std::cerr << "; Compressed dataset will be read without mmap.\n";
+      delete iterator;
+      return Get(filename);
+    }
+    iterator->map_position_ = iterator->data_begin_;
+  }
+  return iterator;
+#endif
+}
+
+/*static*/
+DataSourceIterator* DataSourceIterator::GetTemporary() {
+  FILE* data = OpenSpillFile();
+  if (!data) {
+    std::cerr << "ERROR: Failed to create temporary file: "
+              << strerror(errno) << "\n";
+    return 0;
+  }
+  // The file is empty, so it has no header and is read as legacy
+  // apriori binary.
+  return new DataSourceIterator(data, "(temporary)");
+}
+
+DataSourceIterator::DataSourceIterator(FILE* data, const char* filepath)
     : data_(data),
-      lines_processed_(0) {
+      filepath_(filepath),
+      lines_processed_(0),
+      read_ahead_(0),
+      format_(kFormatBinary),
+      flags_(0),
+      data_begin_(0),
+      has_metadata_(false),
+      block_cursor_(0),
+      block_sets_(0),
+      block_index_(0),
+      block_offset_(0),
+      next_block_offset_(0),
+      mapped_(false),
+      map_(0),
+      map_size_(0),
+      map_position_(0),
+      text_cursor_(0),
+      text_end_(0),
+      stream_(false),
+      stream_offset_(0),
+      spill_(0),
+      spill_begin_(0),
+      file_base_(0),
+      appending_(false) {
 }
 
 DataSourceIterator::~DataSourceIterator() {
-  fclose(data_);
+#ifndef MICROSOFT
+  delete read_ahead_;
+#endif
+  read_ahead_ = 0;
+  if (data_ && data_ != stdin)
+    fclose(data_);
   data_ = 0;
+  if (spill_)
+    fclose(spill_);
+  spill_ = 0;
+#ifndef MICROSOFT
+  if (map_)
+    munmap(const_cast<char*>(map_), map_size_);
+#endif
+  map_ = 0;
 }
 
 bool DataSourceIterator::Seek(off_t resume_offset) {
-  if (fseeko(data_, resume_offset, 0)) {
+  // Offset 0 always denotes the first itemset, which follows the file
+  // header if there is one.
+  if (format_ == kFormatCompressed)
+    return SeekCompressed(resume_offset);
+  if (resume_offset == 0)
+    resume_offset = data_begin_;
+  // Discard any buffered text.
+  text_cursor_ = text_end_ = 0;
+  if (mapped_) {
+    if (resume_offset < 0 || static_cast<size_t>(resume_offset) > map_size_) {
+      error_ = "Seek offset beyond end of mapped dataset.";
+      return false;
+    }
+    map_position_ = resume_offset;
+    return true;
+  }
+  return SeekBytes(resume_offset);
+}
+
+bool DataSourceIterator::SeekBytes(off_t offset) {
+  if (stream_) {
+    if (offset == stream_offset_)
+      return true;
+    if (!spill_ || offset < spill_begin_) {
+      error_ = "Cannot seek within streamed input that was not spilled.";
+      return false;
+    }
+    // Copy the rest of the input to the spill file and continue from
+    // there.
+    std::vector<char> buffer(kSpillBufferSize);
+    while (ReadStream(&buffer[0], buffer.size()) > 0) {
+    }
+    if (ReadFailed()) {
+      error_ = ReadErrorMessage();
+      return false;
+    }
+    data_ = spill_;
+    spill_ = 0;
+    file_base_ = spill_begin_;
+    stream_ = false;
+  }
+#ifndef MICROSOFT
+  if (read_ahead_) {
+    read_ahead_->Seek(offset);
+    return true;
+  }
+#endif
+  appending_ = false;
+  if (fseeko(data_, offset - file_base_, 0)) {
     error_ = "fseek failed: " +  std::string(strerror(errno));
     return false;
   }
@@ -76,17 +385,491 @@ bool DataSourceIterator::Seek(off_t resume_offset) {
 }
 
 off_t DataSourceIterator::Tell() {
-  return ftello(data_);
+  if (format_ == kFormatCompressed)
+    return (block_offset_ << kBlockIndexBits) | block_index_;
+  if (mapped_)
+    return map_position_;
+  // Text read into the buffer but not yet parsed has not been consumed.
+  off_t buffered = text_end_ - text_cursor_;
+  if (stream_)
+    return stream_offset_ - buffered;
+#ifndef MICROSOFT
+  if (read_ahead_)
+    return read_ahead_->Tell() - buffered;
+#endif
+  return ftello(data_) + file_base_ - buffered;
+}
+
+bool DataSourceIterator::SeekCompressed(off_t position) {
+  off_t offset = position >> kBlockIndexBits;
+  uint32_t index = position & kMaxSetsPerBlock;
+  if (position == 0)
+    offset = data_begin_;
+  if (block_sets_ && offset == block_offset_) {
+    // The block is already loaded, so just rewind within it.
+    block_cursor_ = 0;
+    block_index_ = 0;
+    previous_.clear();
+  } else {
+    if (!SeekBytes(offset))
+      return false;
+    next_block_offset_ = block_offset_ = offset;
+    block_sets_ = block_index_ = 0;
+    if (index && LoadBlock() <= 0) {
+      if (error_.empty())
+        error_ = "Seek position beyond end of compressed dataset.";
+      return false;
+    }
+  }
+  // Sets are variable length, so skipping them requires decoding.
+  uint32_t set_id;
+  while (block_index_ < index) {
+    if (block_index_ == block_sets_) {
+      error_ = "Seek position beyond end of compressed block.";
+      return false;
+    }
+    if (ReadCompressed(&set_id, &record_, 0) <= 0)
+      return false;
+    --lines_processed_;
+  }
+  return true;
+}
+
+bool DataSourceIterator::LoadIndex() {
+  index_.clear();
+  std::string index_path = filepath_ + kIndexSuffix;
+  FILE* index_file = fopen(index_path.c_str(), "rb");
+  if (!index_file) {
+    error_ = "Failed to open index file " + index_path + ": " +
+        std::string(strerror(errno));
+    return false;
+  }
+  uint32_t header[4];
+  bool success = fread(header, sizeof(header), 1, index_file) == 1 &&
+      header[0] == kIndexMagic;
+  if (success) {
+    index_.resize(header[2]);
+    success = index_.empty() ||
+        fread(&index_[0], sizeof(IndexEntry), index_.size(), index_file) ==
+        index_.size();
+  }
+  fclose(index_file);
+  if (!success) {
+    error_ = "Invalid index file " + index_path;
+    index_.clear();
+  }
+  return success;
+}
+
+namespace {
+
+bool CompareOrdinal(const IndexEntry& e1, const IndexEntry& e2) {
+  return e1.ordinal < e2.ordinal;
+}
+
+bool CompareFirstItem(const IndexEntry& e1, const IndexEntry& e2) {
+  return e1.first_item < e2.first_item;
+}
+
+}  // namespace
+
+bool DataSourceIterator::SeekToIndexEntry(
+    const IndexEntry& key, bool by_item, uint64_t* ordinal) {
+  // Find the last entry at or before the key's ordinal. When seeking by
+  // item the entry's item must be strictly smaller, since itemsets
+  // starting with the key's item may precede it.
+  std::vector<IndexEntry>::const_iterator it = by_item ?
+      std::lower_bound(index_.begin(), index_.end(), key, CompareFirstItem) :
+      std::upper_bound(index_.begin(), index_.end(), key, CompareOrdinal);
+  if (it == index_.begin()) {
+    *ordinal = 0;
+    return Seek(0);
+  }
+  --it;
+  *ordinal = it->ordinal;
+  return Seek(it->position);
+}
+
+bool DataSourceIterator::SeekToSet(uint64_t ordinal) {
+  IndexEntry key;
+  key.ordinal = ordinal;
+  uint64_t current;
+  if (!SeekToIndexEntry(key, false, &current))
+    return false;
+  const SetProperties* set;
+  for (; current < ordinal; ++current) {
+    if (Next(&set) <= 0) {
+      if (error_.empty())
+        error_ = "Seek beyond the last itemset.";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool DataSourceIterator::SeekToItem(uint32_t item) {
+  IndexEntry key;
+  key.first_item = item;
+  uint64_t ordinal;
+  if (!SeekToIndexEntry(key, true, &ordinal))
+    return false;
+  const SetProperties* set;
+  off_t position = Tell();
+  int result;
+  while ((result = Next(&set)) > 0) {
+    if (set->size && set->item[0] >= item)
+      return Seek(position);
+    position = Tell();
+  }
+  return result == 0;
+}
+
+void DataSourceIterator::SplitPoints(
+    int parts, std::vector<off_t>* positions) const {
+  positions->clear();
+  positions->push_back(0);
+  if (index_.empty() || parts <= 1)
+    return;
+  uint64_t total = index_.back().ordinal;
+  size_t entry = 0;
+  for (int i = 1; i < parts; ++i) {
+    uint64_t target = total * i / parts;
+    while (entry < index_.size() && index_[entry].ordinal < target)
+      ++entry;
+    if (entry == index_.size())
+      break;
+    if (index_[entry].ordinal != 0 &&
+        static_cast<off_t>(index_[entry].position) != positions->back()) {
+      positions->push_back(index_[entry].position);
+    }
+  }
+}
+
+bool DataSourceIterator::EnableReadAhead(
+    int buffer_count, size_t buffer_size, bool direct) {
+#ifdef MICROSOFT
+  error_ = "Read-ahead is not supported on this platform.";
+  return false;
+#else
+  if (mapped_ || read_ahead_ || stream_ || file_base_) {
+    error_ = "Read-ahead requires a plain file-backed iterator.";
+    return false;
+  }
+  // Buffered but unparsed text is re-read through the new reader.
+  off_t offset = ftello(data_) - (text_end_ - text_cursor_);
+  text_cursor_ = text_end_ = 0;
+  if (direct) {
+    read_ahead_ = ReadAheadReader::GetDirect(
+        filepath_.c_str(), offset, buffer_count, buffer_size);
+  } else {
+    read_ahead_ =
+        ReadAheadReader::Get(fileno(data_), offset, buffer_count, buffer_size);
+  }
+  if (!read_ahead_) {
+    error_ = "Failed to initialize read-ahead.";
+    return false;
+  }
+  return true;
+#endif
+}
+
+bool DataSourceIterator::BeginSpill() {
+  if (!stream_ || spill_)
+    return true;
+  spill_ = OpenSpillFile();
+  if (!spill_) {
+    error_ = "Failed to create spill file: " + std::string(strerror(errno));
+    return false;
+  }
+  if (format_ == kFormatCompressed) {
+    // Positions within the current block are resolved by re-reading
+    // the block, so it must be spilled as well.
+    if (block_sets_) {
+      spill_begin_ = block_offset_;
+      uint32_t block_header[2];
+      block_header[0] = block_.size();
+      block_header[1] = block_sets_;
+      fwrite(block_header, sizeof(block_header), 1, spill_);
+      fwrite(&block_[0], 1, block_.size(), spill_);
+    } else {
+      spill_begin_ = next_block_offset_;
+    }
+  } else {
+    // Text that was read but not yet parsed must be spilled as well.
+    spill_begin_ = Tell();
+    if (text_cursor_ != text_end_)
+      fwrite(text_cursor_, 1, text_end_ - text_cursor_, spill_);
+  }
+  if (ferror(spill_)) {
+    error_ = ReadErrorMessage();
+    return false;
+  }
+  return true;
+}
+
+bool DataSourceIterator::Append(
+    uint32_t set_id, const uint32_t* items, uint32_t size) {
+  uint32_t record_header[2] = { set_id, size };
+  // Stdio requires a seek when switching from reading to writing, and
+  // SeekBytes provides the one for switching back.
+  if ((!appending_ && fseeko(data_, 0, SEEK_END)) ||
+      fwrite(record_header, sizeof(record_header), 1, data_) != 1 ||
+      (size && fwrite(items, sizeof(*items), size, data_) != size)) {
+    error_ = "Temporary file write error: " + std::string(strerror(errno));
+    return false;
+  }
+  appending_ = true;
+  return true;
+}
+
+size_t DataSourceIterator::ReadStream(void* buffer, size_t bytes) {
+  char* out = static_cast<char*>(buffer);
+  size_t copied = std::min(bytes, pushback_.size());
+  if (copied) {
+    memcpy(out, pushback_.data(), copied);
+    pushback_.erase(0, copied);
+  }
+  if (copied < bytes)
+    copied += fread(out + copied, 1, bytes - copied, data_);
+  if (spill_ && copied)
+    fwrite(out, 1, copied, spill_);
+  stream_offset_ += copied;
+  return copied;
+}
+
+inline size_t DataSourceIterator::ReadBytes(void* buffer, size_t bytes) {
+  if (stream_)
+    return ReadStream(buffer, bytes);
+#ifndef MICROSOFT
+  if (read_ahead_)
+    return read_ahead_->Read(buffer, bytes);
+#endif
+  return fread(buffer, 1, bytes, data_);
+}
+
+inline bool DataSourceIterator::ReadFailed() {
+#ifndef MICROSOFT
+  if (read_ahead_)
+    return read_ahead_->HasError();
+#endif
+  return ferror(data_) || (spill_ && ferror(spill_));
+}
+
+std::string DataSourceIterator::ReadErrorMessage() {
+#ifndef MICROSOFT
+  if (read_ahead_)
+    return "Dataset read error, " + read_ahead_->GetErrorMessage();
+#endif
+  if (spill_ && ferror(spill_))
+    return "Spill file write error: " + std::string(strerror(errno));
+  return "Dataset read error, ferror code=" + ToString(ferror(data_));
+}
+
+int DataSourceIterator::NextMapped(const SetProperties** set) {
+  size_t remaining = map_size_ - map_position_;
+  if (remaining == 0)
+    return 0;
+  const uint32_t* record =
+      reinterpret_cast<const uint32_t*>(map_ + map_position_);
+  if (remaining < 4) {
+    error_ = "Dataset format error. Partial vector id encountered.";
+    return -1;
+  }
+  if (remaining < 8) {
+    error_ = "Dataset format error. Partial vector length encountered "
+        "for vector id " + ToString(record[0]);
+    return -1;
+  }
+  uint32_t vector_size = record[1];
+  if (vector_size > kMaxVectorSize) {
+    error_ = "Dataset format error. Size of vector id " +
+        ToString(record[0]) +
+        " exceeds maximum: " +
+        ToString(vector_size);
+    return -1;
+  }
+  size_t record_size = 4 * (2 + static_cast<size_t>(vector_size));
+  if (remaining < record_size) {
+    error_ = "Dataset format error. Dataset truncated while reading "
+        "features from vector id " +
+        ToString(record[0]);
+    return -1;
+  }
+  // The layout of SetProperties matches that of an apriori binary
+  // record, so the record can be handed out as-is.
+  *set = reinterpret_cast<const SetProperties*>(record);
+  map_position_ += record_size;
+  lines_processed_++;
+  return 1;
+}
+
+int DataSourceIterator::Next(const SetProperties** set) {
+  if (mapped_)
+    return NextMapped(set);
+  uint32_t vector_id;
+  int result = ReadSet(&vector_id, &record_, 2);
+  if (result <= 0)
+    return result;
+  record_[0] = vector_id;
+  record_[1] = record_.size() - 2;
+  *set = reinterpret_cast<const SetProperties*>(&record_[0]);
+  return 1;
 }
 
 int DataSourceIterator::Next(uint32_t* vector_id, std::vector<uint32_t>* vec) {
+  if (mapped_) {
+    const SetProperties* set;
+    int result = NextMapped(&set);
+    if (result > 0) {
+      *vector_id = set->set_id;
+      vec->assign(set->begin(), set->end());
+    }
+    return result;
+  }
+  return ReadSet(vector_id, vec, 0);
+}
+
+int DataSourceIterator::NextBatch(
+    SetBatch* batch, size_t max_sets, size_t max_items, size_t set_cost) {
+  batch->Clear();
+  size_t sets_read = 0;
+  int result;
+  do {
+    if (mapped_) {
+      const SetProperties* set;
+      if ((result = NextMapped(&set)) <= 0)
+        break;
+      batch->sets_.push_back(set);
+      batch->item_count_ += set->size;
+    } else {
+      // Read the items straight into the arena, after room for the
+      // record header.
+      std::vector<uint32_t>& records = batch->records_;
+      size_t offset = records.size();
+      uint32_t vector_id;
+      if ((result = ReadSet(&vector_id, &records, offset + 2)) <= 0) {
+        records.resize(offset);
+        break;
+      }
+      uint32_t vector_size = records.size() - offset - 2;
+      records[offset] = vector_id;
+      records[offset + 1] = vector_size;
+      batch->offsets_.push_back(offset);
+      batch->item_count_ += vector_size;
+    }
+  } while (++sets_read < max_sets &&
+           batch->item_count_ + sets_read * set_cost < max_items);
+
+  // The arena may have moved while it grew, so the views are only set
+  // up once it is complete.
+  for (size_t i = 0; i < batch->offsets_.size(); ++i) {
+    batch->sets_.push_back(reinterpret_cast<const SetProperties*>(
+        &batch->records_[batch->offsets_[i]]));
+  }
+  if (result < 0)
+    return -1;
+  return batch->size() ? 1 : 0;
+}
+
+inline int DataSourceIterator::ReadSet(
+    uint32_t* vector_id, std::vector<uint32_t>* vec, size_t item_offset) {
+  if (format_ == kFormatCompressed)
+    return ReadCompressed(vector_id, vec, item_offset);
+  return ReadBinary(vector_id, vec, item_offset);
+}
+
+int DataSourceIterator::LoadBlock() {
+  block_offset_ = next_block_offset_;
+  block_sets_ = block_index_ = 0;
+  uint32_t block_header[2];
+  size_t bytes_read = ReadBytes(block_header, sizeof(block_header));
+  if (bytes_read != sizeof(block_header)) {
+    if (ReadFailed()) {
+      error_ = ReadErrorMessage();
+      return -1;
+    }
+    if (bytes_read == 0)
+      return 0;
+    error_ = "Dataset format error. Partial block header encountered.";
+    return -1;
+  }
+  if (block_header[0] == 0 ||
+      block_header[1] == 0 || block_header[1] > kMaxSetsPerBlock) {
+    error_ = "Dataset format error. Invalid set count in block at offset " +
+        ToString(block_offset_);
+    return -1;
+  }
+  block_.resize(block_header[0]);
+  bytes_read = block_.empty() ? 0 : ReadBytes(&block_[0], block_.size());
+  if (bytes_read != block_.size()) {
+    error_ = ReadFailed() ? ReadErrorMessage() :
+        "Dataset format error. Dataset truncated in block at offset " +
+        ToString(block_offset_);
+    return -1;
+  }
+  block_cursor_ = 0;
+  block_sets_ = block_header[1];
+  previous_.clear();
+  next_block_offset_ = block_offset_ + sizeof(block_header) + block_.size();
+  return 1;
+}
+
+int DataSourceIterator::ReadCompressed(
+    uint32_t* vector_id, std::vector<uint32_t>* vec, size_t item_offset) {
+  if (block_index_ == block_sets_) {
+    int result = LoadBlock();
+    if (result <= 0)
+      return result;
+  }
+  const unsigned char* in = &block_[0] + block_cursor_;
+  const unsigned char* end = &block_[0] + block_.size();
+  uint32_t prefix_size = 0;
+  uint32_t suffix_size = 0;
+  in = DecodeVarint(in, end, vector_id);
+  if (in && (flags_ & kFlagFrontCoded))
+    in = DecodeVarint(in, end, &prefix_size);
+  if (in)
+    in = DecodeVarint(in, end, &suffix_size);
+  if (!in || prefix_size > previous_.size() || suffix_size > kMaxVectorSize ||
+      prefix_size + suffix_size > kMaxVectorSize) {
+    error_ = "Dataset format error. Corrupt set header in block at offset " +
+        ToString(block_offset_);
+    return -1;
+  }
+  uint32_t vector_size = prefix_size + suffix_size;
+  vec->resize(item_offset + vector_size);
+  uint32_t* out = vector_size ? &(*vec)[item_offset] : 0;
+  // The shared prefix is copied from the previous set of the block.
+  if (prefix_size)
+    memcpy(out, &previous_[0], 4 * prefix_size);
+  uint32_t item = prefix_size ? out[prefix_size - 1] : 0;
+  for (uint32_t i = prefix_size; i < vector_size; ++i) {
+    uint32_t delta;
+    if (!(in = DecodeVarint(in, end, &delta))) {
+      error_ = "Dataset format error. Truncated itemset in block at offset " +
+          ToString(block_offset_);
+      return -1;
+    }
+    item += delta;
+    out[i] = item;
+  }
+  if (flags_ & kFlagFrontCoded)
+    previous_.assign(out, out + vector_size);
+  block_cursor_ = in - &block_[0];
+  ++block_index_;
+  lines_processed_++;
+  return 1;
+}
+
+int DataSourceIterator::ReadBinary(
+    uint32_t* vector_id, std::vector<uint32_t>* vec, size_t item_offset) {
   size_t bytes_read;
   uint32_t vector_size;
 
-  while ((bytes_read = fread(vector_id, 1, 4, data_)) == 4) {
-    bytes_read = fread(&vector_size, 1, 4, data_);
+  while ((bytes_read = ReadBytes(vector_id, 4)) == 4) {
+    bytes_read = ReadBytes(&vector_size, 4);
     if (bytes_read != 4) {
-      if (ferror(data_))
+      if (ReadFailed())
         break;
       error_ = "Dataset format error. Partial vector length encountered "
           "for vector id " + ToString(*vector_id);
@@ -99,10 +882,10 @@ int DataSourceIterator::Next(uint32_t* vector_id, std::vector<uint32_t>* vec) {
           ToString(vector_size);
       return -1;
     }
-    vec->resize(vector_size);
-    bytes_read = fread(&((*vec)[0]), 1, 4 * vector_size, data_);
+    vec->resize(item_offset + vector_size);
+    bytes_read = ReadBytes(&((*vec)[item_offset]), 4 * vector_size);
     if (bytes_read != 4 * vector_size) {
-      if (ferror(data_))
+      if (ReadFailed())
         break;
       error_ = "Dataset format error. Dataset truncated while reading "
           "features from vector id " +
@@ -112,8 +895,8 @@ int DataSourceIterator::Next(uint32_t* vector_id, std::vector<uint32_t>* vec) {
     lines_processed_++;
     return 1;
   }
-  if (ferror(data_)) {
-    error_ = "Dataset read error, ferror code=" + ToString(ferror(data_));
+  if (ReadFailed()) {
+    error_ = ReadErrorMessage();
     return -1;
   }
   if (bytes_read != 0) {
@@ -123,37 +906,107 @@ int DataSourceIterator::Next(uint32_t* vector_id, std::vector<uint32_t>* vec) {
   return 0;
 }
 
-int DataSourceIterator::NextText(uint32_t* vector_id, std::vector<uint32_t>* vec) {
-  vec->clear();
-  // First read the vector ID
-  int scan_result = fscanf(data_, "%u", vector_id);
-  if (!scan_result) {
-    if (ferror(data_)) {
-      error_ = "Dataset read error, ferror code=" + ToString(ferror(data_));
-      return -1;
-    }
-    // Otherwise we're eof()
-    return 0;
+int DataSourceIterator::FillTextBuffer() {
+  if (mapped_)
+    return 0;  // The whole mapping is the buffer.
+  if (text_buffer_.empty())
+    text_buffer_.resize(kTextBufferSize);
+  size_t bytes_read = ReadBytes(&text_buffer_[0], text_buffer_.size());
+  text_cursor_ = &text_buffer_[0];
+  text_end_ = text_cursor_ + bytes_read;
+  if (bytes_read)
+    return 1;
+  if (ReadFailed()) {
+    error_ = ReadErrorMessage();
+    return -1;
   }
-  if (scan_result == EOF)
-    return 0;
+  return 0;
+}
 
-  // Now read the item ids, until we reach the "0" terminator.
-  uint32_t item_id;
-  while ((scan_result = fscanf(data_, "%u", &item_id)) != EOF && scan_result != 0) {
-    if (item_id)
-      vec->push_back(item_id);
-    else {
-      lines_processed_++;
-      return 1;
+inline int DataSourceIterator::NextTextValue(uint32_t* value) {
+  // Work on local copies of the cursor so the compiler can keep them
+  // in registers; they are written back before every refill.
+  const char* cursor = text_cursor_;
+  const char* end = text_end_;
+  while (true) {
+    while (cursor != end && IsTextSpace(*cursor))
+      ++cursor;
+    if (cursor != end)
+      break;
+    text_cursor_ = cursor;
+    int result = FillTextBuffer();
+    if (result <= 0)
+      return result;
+    cursor = text_cursor_;
+    end = text_end_;
+  }
+  uint32_t digit = static_cast<unsigned char>(*cursor) - '0';
+  if (digit > 9) {
+    text_cursor_ = cursor;
+    error_ = "Dataset format error: Unexpected character '" +
+        std::string(1, *cursor) + "' after vector " +
+        ToString(lines_processed_);
+    return -1;
+  }
+  // A number may straddle two buffers, so keep accumulating digits
+  // across refills.
+  uint64_t result = 0;
+  while (true) {
+    while (cursor != end &&
+           (digit = static_cast<unsigned char>(*cursor) - '0') <= 9) {
+      result = result * 10 + digit;
+      if (result > 0xffffffffULL) {
+        text_cursor_ = cursor;
+        error_ = "Dataset format error: Integer overflow after vector " +
+            ToString(lines_processed_);
+        return -1;
+      }
+      ++cursor;
     }
+    text_cursor_ = cursor;
+    if (cursor != end)
+      break;
+    int fill_result = FillTextBuffer();
+    if (fill_result < 0)
+      return -1;
+    if (fill_result == 0)
+      break;
+    cursor = text_cursor_;
+    end = text_end_;
   }
-  if (ferror(data_)) {
-    error_ = "Dataset read error, ferror code=" + ToString(ferror(data_));
+  if (cursor != end && !IsTextSpace(*cursor)) {
+    error_ = "Dataset format error: Unexpected character '" +
+        std::string(1, *cursor) + "' after vector " +
+        ToString(lines_processed_);
     return -1;
   }
-  error_ = "Dataset format error: Final vector not properly terminated.";
-  return -1;
+  *value = static_cast<uint32_t>(result);
+  return 1;
+}
+
+int DataSourceIterator::NextText(uint32_t* vector_id, std::vector<uint32_t>* vec) {
+  if (mapped_) {
+    text_cursor_ = map_ + map_position_;
+    text_end_ = map_ + map_size_;
+  }
+  vec->clear();
+  // First read the vector ID
+  int result = NextTextValue(vector_id);
+  if (result > 0) {
+    // Now read the item ids, until we reach the "0" terminator.
+    uint32_t item_id;
+    while ((result = NextTextValue(&item_id)) > 0 && item_id)
+      vec->push_back(item_id);
+    if (result > 0)
+      lines_processed_++;
+    else if (result == 0)
+      error_ = "Dataset format error: Final vector not properly terminated.";
+    if (result == 0)
+      result = -1;
+  }
+  if (mapped_)
+    map_position_ = text_cursor_ - map_;
+  return result;
 }
 
 }  // namespace google_extremal_sets
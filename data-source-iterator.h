@@ -22,18 +22,87 @@
 
 #include <stdio.h>
 #include <string>
+#include <vector>
+#include "apriori-format.h"
 #include "basic-types.h"
 
 namespace google_extremal_sets {
 
+class ReadAheadReader;
+
+// Number of itemsets the algorithms request per call to NextBatch.
+const size_t kDefaultBatchSize = 1024;
+
+// A batch of itemsets read by DataSourceIterator::NextBatch. The
+// itemsets are stored back to back as apriori binary records in a
+// single arena that is reused by subsequent batches, so reading a
+// batch performs no per-set allocation.
+class SetBatch {
+ public:
+  SetBatch() : item_count_(0) {}
+
+  // Number of itemsets in the batch.
+  size_t size() const { return sets_.size(); }
+
+  // Total number of items over all itemsets in the batch.
+  size_t ItemCount() const { return item_count_; }
+
+  // Returns the i-th itemset of the batch. The itemset is valid until
+  // the batch is refilled, unless it was read from a memory-mapped
+  // dataset, in which case it persists like those returned by
+  // DataSourceIterator::Next(const SetProperties**).
+  const SetProperties& operator[](size_t i) const { return *sets_[i]; }
+
+ private:
+  friend class DataSourceIterator;
+
+  void Clear() {
+    sets_.clear();
+    records_.clear();
+    offsets_.clear();
+    item_count_ = 0;
+  }
+
+  std::vector<const SetProperties*> sets_;
+  // The arena of records, and the offset of each record within it.
+  std::vector<uint32_t> records_;
+  std::vector<size_t> offsets_;
+  size_t item_count_;
+};
+
 class DataSourceIterator {
  public:
   // Factory method for obtaining an iterator. The filepath is the
-  // pathname to the file containing the data. Returns NULL on error
-  // and reports the error details to stderr.
+  // pathname to the file containing the data, or "-" to read the data
+  // from stdin (see BeginSpill). Returns NULL on error and reports the
+  // error details to stderr.
   static DataSourceIterator* Get(const char* filepath);
+
+  // Like Get, but memory-maps the (apriori binary) file read-only
+  // instead of reading it through stdio. Itemsets returned by
+  // Next(const SetProperties**) then point directly into the mapping
+  // and remain valid for the lifetime of the iterator. Returns NULL on
+  // error and reports the error details to stderr.
+  static DataSourceIterator* GetMapped(const char* filepath);
+
+  // Returns an iterator over a new, empty anonymous temporary file (in
+  // $TMPDIR, or /tmp) of apriori binary records, which the caller fills
+  // with Append and reads back after a Seek. Returns NULL on error and
+  // reports the error details to stderr.
+  static DataSourceIterator* GetTemporary();
   ~DataSourceIterator();
 
+  // Returns true if this iterator was obtained from GetMapped(), in
+  // which case the itemsets returned by Next(const SetProperties**)
+  // persist until the iterator is destroyed.
+  bool IsMapped() const { return mapped_; }
+
+  // Returns the metadata recorded in the file header, or NULL if the
+  // dataset does not describe itself.
+  const DatasetMetadata* GetMetadata() const {
+    return has_metadata_ ? &metadata_ : 0;
+  }
+
   // Returns a human-readable string describing any error condition
   // encountered during a call to Next()/NextText().
   std::string GetErrorMessage() { return error_; }
@@ -45,8 +114,36 @@ class DataSourceIterator {
   // for many dataset format errors, but not all of them. For example
   // it does not check that the items are duplicate free and are
   // consistently ordered according to frequency.
+  //
+  // Compressed apriori datasets (see apriori-format.h) are detected
+  // by their file header and decoded transparently.
   int Next(uint32_t* vector_id_, ItemSet* input_vector);
 
+  // Like Next, but avoids copying the itemset into a caller-provided
+  // vector. On success *set points at a read-only view of the
+  // itemset. If IsMapped() the view points into the mapped file and
+  // persists; otherwise it points into an internal buffer that is
+  // only valid until the next call to any Next method.
+  int Next(const SetProperties** set);
+
+  // Reads up to max_sets itemsets into the batch, replacing its
+  // previous contents. Reading also stops early once the batch holds
+  // max_items or more items, so Tell() afterwards is the position
+  // following the itemset that reached the limit. Each itemset counts
+  // as set_cost items in addition to its own towards that limit, which
+  // lets callers express a memory budget that includes per-set
+  // overhead. At least one itemset is read unless EOF is
+  // reached. Returns -1 on error, 0 if there were no itemsets left,
+  // and 1 otherwise.
+  int NextBatch(SetBatch* batch, size_t max_sets, size_t max_items,
+                size_t set_cost);
+  int NextBatch(SetBatch* batch, size_t max_sets, size_t max_items) {
+    return NextBatch(batch, max_sets, max_items, 0);
+  }
+  int NextBatch(SetBatch* batch, size_t max_sets) {
+    return NextBatch(batch, max_sets, static_cast<size_t>(-1));
+  }
+
   // Like Next, but used when testing with text format files.  Text
   // format assumes whitespace separators between vector and item
   // IDs. Instead of encoding vector lengths, use item id "0" to
@@ -60,17 +157,182 @@ class DataSourceIterator {
   // The first value for a vector is its ID. The remaining values are
   // the IDs of its elements. End of line chars are encouraged, but
   // are not required to separate the vectors.
+  //
+  // The text is parsed from large buffers (or directly from the
+  // mapping if IsMapped()), so unlike the binary formats it may also
+  // be read with read-ahead enabled.
   int NextText(uint32_t* vector_id_, ItemSet* input_vector);
 
+  // Tell returns the position of the next itemset, which Seek
+  // accepts to resume reading from there. Position 0 is always the
+  // first itemset. For apriori binary files positions are byte
+  // offsets; for compressed files they are opaque (but increasing).
   bool Seek(off_t seek_offset);
   off_t Tell();
 
+  // Loads the index sidecar file written alongside the dataset (see
+  // apriori-format.h). Returns false if there is no valid index, in
+  // which case the seek methods below fall back to scanning from the
+  // beginning of the dataset.
+  bool LoadIndex();
+
+  // Positions the iterator at the itemset with the given ordinal (0 for
+  // the first itemset). Returns false on error or if the dataset has
+  // too few itemsets.
+  bool SeekToSet(uint64_t ordinal);
+
+  // Positions the iterator at the first itemset whose first item is
+  // greater than or equal to item. The dataset must be sorted in
+  // lexicographic order. Returns false on error; EOF is not an error.
+  bool SeekToItem(uint32_t item);
+
+  // Splits the dataset into "parts" ranges holding roughly the same
+  // number of itemsets, based on the index. On return positions holds
+  // the starting position of each range (the first being 0); each
+  // range extends to the start of the next, and the last to EOF. Fewer
+  // ranges are returned if the index is too coarse.
+  void SplitPoints(int parts, std::vector<off_t>* positions) const;
+
+  // Streamed input (stdin) can only be read sequentially. To allow
+  // later passes to Seek() back to the current position or beyond,
+  // BeginSpill copies all input read from here on to an anonymous
+  // temporary file (in $TMPDIR, or /tmp), which replaces the stream
+  // once the iterator seeks. Does nothing for input that is already
+  // seekable. Returns false on error.
+  bool BeginSpill();
+
+  // Appends the itemset to the end of a dataset obtained from
+  // GetTemporary. Reading after appending must begin with a Seek.
+  // Returns false on error.
+  bool Append(uint32_t set_id, const uint32_t* items, uint32_t size);
+
+  // Switches a (non-mapped) iterator to reading through a
+  // background thread that prefetches buffer_count buffers of
+  // buffer_size bytes ahead of the current position. Seek() discards
+  // the prefetched data and restarts read-ahead at the new offset.
+  // Returns false on error.
+  //
+  // If direct is true the file is read with O_DIRECT, bypassing the
+  // page cache so that repeated scans of a large dataset do not evict
+  // the algorithm's own memory, and with io_uring (when the kernel
+  // supports it) all buffers are filled concurrently.
+  bool EnableReadAhead(int buffer_count, size_t buffer_size, bool direct);
+  bool EnableReadAhead(int buffer_count, size_t buffer_size) {
+    return EnableReadAhead(buffer_count, buffer_size, false);
+  }
+
  private:
-  DataSourceIterator(FILE* data);
+  DataSourceIterator(FILE* data, const char* filepath);
+
+  // Seeks to the last index entry preceding the key's ordinal or item
+  // and sets *ordinal to the ordinal of the entry (or to 0 if there is
+  // none, in which case it seeks to the beginning). Returns false on
+  // error.
+  bool SeekToIndexEntry(
+      const IndexEntry& key, bool by_item, uint64_t* ordinal);
+
+  // Detects and parses the file header, if any. Returns false on error.
+  bool ReadHeader();
+  bool ParseHeader(const uint32_t* header);
+
+  // Low-level reads from the underlying file, through the read-ahead
+  // buffers if enabled. ReadBytes returns the number of bytes read.
+  size_t ReadBytes(void* buffer, size_t bytes);
+  size_t ReadStream(void* buffer, size_t bytes);
+  bool SeekBytes(off_t offset);
+  bool ReadFailed();
+  std::string ReadErrorMessage();
+
+  // Reads the next record in whatever format the file has, placing its
+  // items in vec starting at item_offset. Same return values as Next.
+  int ReadSet(uint32_t* vector_id, ItemSet* vec, size_t item_offset);
+
+  // Reads the next apriori binary record from data_, placing its
+  // items in vec starting at item_offset. Same return values as Next.
+  int ReadBinary(uint32_t* vector_id, ItemSet* vec, size_t item_offset);
+
+  // Compressed format counterparts. LoadBlock reads the block at
+  // next_block_offset_ and returns 1 on success, 0 on EOF or -1 on
+  // error.
+  int ReadCompressed(uint32_t* vector_id, ItemSet* vec, size_t item_offset);
+  int LoadBlock();
+  bool SeekCompressed(off_t position);
+
+  // Validates the record header at the current map position and
+  // advances over it. Same return values as Next.
+  int NextMapped(const SetProperties** set);
+
+  // Buffered text parsing for NextText. FillTextBuffer reads the next
+  // buffer of text and returns 1 on success, 0 on EOF or -1 on
+  // error. NextTextValue parses the next whitespace-delimited integer,
+  // with the same return values.
+  int FillTextBuffer();
+  int NextTextValue(uint32_t* value);
 
   FILE* data_;
+  const std::string filepath_;
   int lines_processed_;
   std::string error_;
+
+  // Entries of the index sidecar, if loaded.
+  std::vector<IndexEntry> index_;
+
+  // Non-NULL if EnableReadAhead() was called.
+  ReadAheadReader* read_ahead_;
+
+  // File header fields. data_begin_ is the byte offset of the first
+  // itemset (or block).
+  uint32_t format_;
+  uint32_t flags_;
+  off_t data_begin_;
+  bool has_metadata_;
+  DatasetMetadata metadata_;
+
+  // Compressed format state: the current block and the position of
+  // the next set within it, plus the items of the previous set for
+  // undoing front coding.
+  std::vector<unsigned char> block_;
+  size_t block_cursor_;
+  uint32_t block_sets_;
+  uint32_t block_index_;
+  off_t block_offset_;
+  off_t next_block_offset_;
+  ItemSet previous_;
+
+  // Memory-mapped state, used only by iterators obtained from
+  // GetMapped(). map_size_ and map_position_ are in bytes.
+  bool mapped_;
+  const char* map_;
+  size_t map_size_;
+  size_t map_position_;
+
+  // Holds the record returned by Next(const SetProperties**) when the
+  // data is not memory mapped.
+  std::vector<uint32_t> record_;
+
+  // Text that has been read but not yet parsed by NextText is
+  // [text_cursor_, text_end_), which points into text_buffer_ (or into
+  // the mapping).
+  std::vector<char> text_buffer_;
+  const char* text_cursor_;
+  const char* text_end_;
+
+  // Streamed input state. stream_offset_ is the position of the next
+  // byte of the stream, and pushback_ holds bytes that ReadHeader read
+  // ahead. Once spilling, everything read is also written to spill_,
+  // whose first byte is at position spill_begin_. When the iterator
+  // then switches over to reading the spill file, file_base_ is the
+  // position of its first byte.
+  bool stream_;
+  off_t stream_offset_;
+  std::string pushback_;
+  FILE* spill_;
+  off_t spill_begin_;
+  off_t file_base_;
+
+  // True if the last operation on data_ was an Append, so that the
+  // next one need not seek to the end.
+  bool appending_;
 };
 
 }  // google_extremal_sets
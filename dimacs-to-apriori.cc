@@ -15,6 +15,7 @@
 // Author: Roberto Bayardo
 
 #include "dimacs-to-apriori.h"
+#include "apriori-writer.h"
 #include "set-properties.h"
 
 #include <errno.h>
@@ -33,6 +34,27 @@ using __gnu_cxx::hash_map;
 
 namespace {
 
+// Size of the buffer the DIMACS lexer parses from.
+const size_t kBufferSize = 1 << 20;
+
+// Literals must fit in an int.
+const int kMaxLiteralDigits = 10;
+const uint64_t kMaxLiteral = 0x7fffffff;
+
+// The lexer refills its buffer whenever fewer than this many bytes
+// remain, which is more than enough to hold any valid literal and its
+// terminating character.
+const size_t kMaxTokenBytes = 32;
+
+inline bool IsDigit(char c) {
+  return static_cast<unsigned char>(c - '0') <= 9;
+}
+
+// Blank, \t, \n, \v, \f and \r.
+inline bool IsSpace(char c) {
+  return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+}
+
 string ToString(uint32_t l) {
   char buf[30];
   sprintf(buf, "%u", l);
@@ -48,7 +70,7 @@ SetPropertiesCardinalityCompareFunctor compare_set_properties_cardinality;
 
 /*static*/
 DimacsIterator* DimacsIterator::Get(const char* filename) {
-  FILE* data = fopen(filename, "r");
+  FILE* data = fopen(filename, "rb");
   if (!data) {
     cerr << "ERROR: Failed to open input file ("
               << filename << "): " << strerror(errno) << "\n";
@@ -58,7 +80,12 @@ DimacsIterator* DimacsIterator::Get(const char* filename) {
 }
 
 DimacsIterator::DimacsIterator(FILE* data)
-  : data_(data) {
+  : data_(data),
+    buffer_(kBufferSize + 1),
+    cursor_(&buffer_[0]),
+    end_(&buffer_[0]),
+    eof_(false) {
+  *end_ = '\0';
 }
 
 DimacsIterator::~DimacsIterator() {
@@ -66,32 +93,86 @@ DimacsIterator::~DimacsIterator() {
   data_ = 0;
 }
 
-int DimacsIterator::Next(vector<int>* vec) {
-  vec->clear();
-  // Now read the literals, until we reach the "0" terminator.
-  // If we ever read a "0" right at the beginning of a line it's probably the header
-  // or a comment line, so we can just continue.
-  int literal;
-  int scan_result;
-  while ((scan_result = fscanf(data_, "%u", &literal)) != EOF) {
+bool DimacsIterator::FillBuffer() {
+  size_t remaining = end_ - cursor_;
+  if (remaining >= kMaxTokenBytes || eof_)
+    return true;
+  // Move the unparsed tail to the front so that tokens never straddle
+  // a refill.
+  memmove(&buffer_[0], cursor_, remaining);
+  size_t wanted = kBufferSize - remaining;
+  size_t bytes_read = fread(&buffer_[remaining], 1, wanted, data_);
+  if (bytes_read < wanted) {
     if (ferror(data_)) {
       error_ = "Dataset read error, ferror code=" + ToString(ferror(data_));
-      return -1;
+      return false;
     }
-    if (!scan_result) {
-      // No conversions, probably a comment or header line.
+    eof_ = true;
+  }
+  cursor_ = &buffer_[0];
+  end_ = cursor_ + remaining + bytes_read;
+  *end_ = '\0';  // Sentinel, so the scanning loops need no bounds checks.
+  return true;
+}
+
+int DimacsIterator::Next(vector<int>* vec) {
+  vec->clear();
+  // Now read the literals, until we reach the "0" terminator. Lines
+  // that do not start with a literal are the header or comments, so we
+  // can just skip them.
+  while (true) {
+    while (IsSpace(*cursor_))
+      ++cursor_;
+    if (static_cast<size_t>(end_ - cursor_) < kMaxTokenBytes && !eof_) {
+      if (!FillBuffer())
+        return -1;
+      continue;
+    }
+    if (cursor_ == end_) {
+      if (vec->size()) {
+        error_ = "Final clause not properly terminated.";
+        return -1;
+      }
+      return 0;
+    }
+    if (*cursor_ != '-' && !IsDigit(*cursor_)) {
+      // No literal, probably a comment or header line.
       if (vec->size()) {
         error_ = "Unexpected non-integer in clause encountered.";
         return -1;
       }
-      char c;
       // Skip the current line and continue.
-      while ((scan_result = fscanf(data_, "%c", &c)) != EOF && scan_result != 0 && c != '\n') {
+      const char* newline;
+      while (!(newline = static_cast<const char*>(
+                   memchr(cursor_, '\n', end_ - cursor_)))) {
+        cursor_ = end_;
+        if (!FillBuffer())
+          return -1;
+        if (cursor_ == end_)
+          return 0;
       }
+      cursor_ = const_cast<char*>(newline) + 1;
       continue;
     }
+
+    // FillBuffer guarantees the whole literal is buffered.
+    bool negative = (*cursor_ == '-');
+    const char* digits = cursor_ + negative;
+    const char* p = digits;
+    uint64_t literal = 0;
+    while (IsDigit(*p) && p - digits <= kMaxLiteralDigits) {
+      literal = literal * 10 + (*p - '0');
+      ++p;
+    }
+    if (p == digits || p - digits > kMaxLiteralDigits ||
+        literal > kMaxLiteral || (p != end_ && !IsSpace(*p))) {
+      error_ = "Invalid literal encountered.";
+      return -1;
+    }
+    cursor_ += p - cursor_;
     if (literal) {
-      vec->push_back(literal);
+      vec->push_back(negative ? -static_cast<int>(literal) :
+                     static_cast<int>(literal));
     } else {
       if (vec->size()) {
         return 1;
@@ -101,19 +182,12 @@ int DimacsIterator::Next(vector<int>* vec) {
       }
     }
   }
-  return 0;
 }
 
 bool DimacsToApriori(
     DimacsIterator* data,
     const char* output_path,
     bool by_cardinality) {
-  FILE* output_file = fopen(output_path, "wb");
-  if (!output_file) {
-    cerr << "; Could not open output file for writing: "
-              << output_path << "\n";
-    return false;
-  }
   vector<int> clause;
 
   // First read in the data & compute the literal frequencies.
@@ -176,16 +250,27 @@ bool DimacsToApriori(
     sort(sort_us.begin(), sort_us.end(), compare_set_properties_cardinality);
   else
     sort(sort_us.begin(), sort_us.end(), compare_set_properties);
+  DatasetMetadata metadata;
+  metadata.sort_order = by_cardinality ? SORT_CARDINALITY : SORT_LEXICOGRAPHIC;
+  for (uint32_t i = 0; i < sort_us.size(); ++i)
+    metadata.Add(sort_us[i]->item, sort_us[i]->size);
+  AprioriWriter* output_file = AprioriWriter::Get(
+      output_path, AprioriWriter::BINARY, false/*front_coded*/, &metadata);
+  if (!output_file)
+    return false;
   cerr << "; Writing " << sort_us.size() << " itemsets to file..." << endl;
   for (uint32_t i = 0; i < sort_us.size(); ++i) {
     SetProperties* set = sort_us[i];
-    if (!fwrite(set, sizeof(uint32_t), 2 + set->size, output_file)) {
+    if (!output_file->Write(*set)) {
       // TODO: fix mem leak
+      delete output_file;
       return false;
     }
     SetProperties::Delete(set);
   }
-  if (fclose(output_file))
+  bool success = output_file->Close();
+  delete output_file;
+  if (!success)
     return false;
 
   return true;
@@ -41,20 +41,29 @@ class DimacsIterator {
   // encountered during a call to Next()/NextText().
   std::string GetErrorMessage() { return error_; }
 
-  // Reads the next input itemset from an "apriori binary" formatted
-  // input file.  Returns -1 on error, 0 on EOF, and 1 on
-  // success. Each itemset consists of a 4 byte integer ID, a 4 byte
-  // integer length, and then 4 byte integer IDs for each item. Checks
-  // for many dataset format errors, but not all of them. For example
-  // it does not check that the items are duplicate free and are
-  // consistently ordered according to frequency.
+  // Reads the literals of the next clause of the instance. Returns -1
+  // on error, 0 on EOF, and 1 on success. Each clause is a sequence of
+  // non-zero integer literals terminated by "0". Lines starting with
+  // anything other than a literal (such as the "c" comment and "p"
+  // problem lines) are skipped.
   int Next(std::vector<int>* literals);
 
  private:
   DimacsIterator(FILE* data);
 
+  // Refills the buffer if fewer than kMaxTokenBytes remain unparsed,
+  // keeping the unparsed bytes. Returns false on read error.
+  bool FillBuffer();
+
   FILE* data_;
   std::string error_;
+
+  // The input is parsed from buffer_, which holds the unparsed bytes
+  // [cursor_, end_) followed by a NUL sentinel.
+  std::vector<char> buffer_;
+  char* cursor_;
+  char* end_;
+  bool eof_;
 };  // class DimacsIterator
 
 // Accepts a DimacsIterator and converts the instance into an apriori
@@ -0,0 +1,266 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// Author: Roberto Bayardo
+
+#include "huge-page-allocator.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+
+#include <iostream>
+
+namespace {
+
+using google_extremal_sets::PagePolicyEnum;
+using google_extremal_sets::NumaPolicyEnum;
+using google_extremal_sets::SMALL_PAGES;
+using google_extremal_sets::TRANSPARENT_HUGE_PAGES;
+using google_extremal_sets::EXPLICIT_HUGE_PAGES;
+using google_extremal_sets::NUMA_DEFAULT;
+using google_extremal_sets::NUMA_INTERLEAVE;
+using google_extremal_sets::NUMA_LOCAL;
+
+// Huge page size assumed if /proc/meminfo does not report one.
+const size_t kDefaultHugePageBytes = 2 << 20;
+
+// Number of NUMA nodes a node mask can describe.
+const int kMaxNodes = 1024;
+const int kBitsPerWord = 8 * sizeof(unsigned long);
+
+PagePolicyEnum page_policy = SMALL_PAGES;
+NumaPolicyEnum numa_policy = NUMA_DEFAULT;
+size_t page_bytes = 0;
+
+// The mask of online nodes used for NUMA_INTERLEAVE, and the number
+// of bits of it in use.
+unsigned long online_nodes[kMaxNodes / kBitsPerWord];
+int node_bits = 0;
+
+// Statistics, updated atomically since allocations may be made by
+// several threads.
+uint64_t mapped_bytes = 0;
+uint64_t explicit_huge_page_bytes = 0;
+uint64_t explicit_huge_page_fallbacks = 0;
+
+// Warnings are printed only once.
+bool warned_fallback = false;
+bool warned_mbind = false;
+
+// Returns the size of the huge pages reported by /proc/meminfo.
+size_t HugePageBytes() {
+  size_t bytes = kDefaultHugePageBytes;
+  FILE* file = fopen("/proc/meminfo", "r");
+  if (!file)
+    return bytes;
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    unsigned long long kilobytes;
+    if (sscanf(line, "Hugepagesize: %llu kB", &kilobytes) == 1) {
+      bytes = kilobytes << 10;
+      break;
+    }
+  }
+  fclose(file);
+  return bytes;
+}
+
+// Fills online_nodes from the list of ranges of online nodes in sysfs,
+// e.g. "0-1,4". Leaves it empty on error.
+void ReadOnlineNodes() {
+  memset(online_nodes, 0, sizeof(online_nodes));
+  node_bits = 0;
+  FILE* file = fopen("/sys/devices/system/node/online", "r");
+  if (!file)
+    return;
+  char line[4096];
+  bool ok = fgets(line, sizeof(line), file) != 0;
+  fclose(file);
+  if (!ok)
+    return;
+  for (char* range = strtok(line, ",\n"); range; range = strtok(0, ",\n")) {
+    int first, last;
+    int fields = sscanf(range, "%d-%d", &first, &last);
+    if (fields == 1)
+      last = first;
+    else if (fields != 2)
+      continue;
+    for (int node = first; node <= last && node < kMaxNodes; ++node) {
+      online_nodes[node / kBitsPerWord] |= 1UL << (node % kBitsPerWord);
+      if (node + 1 > node_bits)
+        node_bits = node + 1;
+    }
+  }
+}
+
+size_t RoundUp(size_t bytes, size_t multiple) {
+  return (bytes + multiple - 1) / multiple * multiple;
+}
+
+// Maps length bytes aligned to a multiple of alignment, by mapping
+// more and unmapping the excess at either end. Returns MAP_FAILED on
+// failure.
+void* MapAligned(size_t length, size_t alignment) {
+  void* memory = mmap(0, length + alignment, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED)
+    return memory;
+  char* begin = static_cast<char*>(memory);
+  char* aligned = reinterpret_cast<char*>(
+      RoundUp(reinterpret_cast<size_t>(begin), alignment));
+  if (aligned != begin)
+    munmap(begin, aligned - begin);
+  size_t tail = begin + length + alignment - (aligned + length);
+  if (tail)
+    munmap(aligned + length, tail);
+  return aligned;
+}
+
+// Applies the NUMA policy to a mapping that has not been touched yet.
+// Failure, e.g. in a container that forbids mbind, only loses the
+// placement, so it is reported once and otherwise ignored.
+void ApplyNumaPolicy(void* memory, size_t length) {
+  long result = 0;
+  if (numa_policy == NUMA_INTERLEAVE && node_bits > 1) {
+    // The kernel expects one more than the number of bits in the mask.
+    result = syscall(SYS_mbind, memory, length, MPOL_INTERLEAVE,
+                     online_nodes, node_bits + 1, 0);
+  } else if (numa_policy == NUMA_LOCAL) {
+    result = syscall(SYS_mbind, memory, length, MPOL_LOCAL, 0, 0, 0);
+  }
+  if (result != 0 && !warned_mbind) {
+    warned_mbind = true;
+    std::cerr << "; WARNING: Failed to apply NUMA policy: "
+              << strerror(errno) << std::endl;
+  }
+}
+
+}  // namespace
+
+namespace google_extremal_sets {
+
+void SetAllocationPolicy(PagePolicyEnum pages, NumaPolicyEnum numa) {
+  page_policy = pages;
+  numa_policy = numa;
+  page_bytes = pages == SMALL_PAGES ? sysconf(_SC_PAGESIZE) : HugePageBytes();
+  if (numa == NUMA_INTERLEAVE)
+    ReadOnlineNodes();
+}
+
+bool LargeAllocationsMapped() {
+  return page_policy != SMALL_PAGES || numa_policy != NUMA_DEFAULT;
+}
+
+size_t AllocationPageSize() {
+  return page_bytes ? page_bytes : sysconf(_SC_PAGESIZE);
+}
+
+void* AllocateLarge(size_t bytes) {
+  size_t length = RoundUp(bytes, AllocationPageSize());
+  void* memory = MAP_FAILED;
+  if (page_policy == EXPLICIT_HUGE_PAGES) {
+    memory = mmap(0, length, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED) {
+      __sync_fetch_and_add(&explicit_huge_page_bytes, length);
+    } else {
+      __sync_fetch_and_add(&explicit_huge_page_fallbacks, 1);
+      if (!warned_fallback) {
+        warned_fallback = true;
+        std::cerr << "; WARNING: Explicit huge pages unavailable ("
+                  << strerror(errno)
+                  << "), falling back to transparent huge pages."
+                  << std::endl;
+      }
+    }
+  }
+  if (memory == MAP_FAILED) {
+    memory = MapAligned(length, AllocationPageSize());
+    if (memory == MAP_FAILED)
+      throw std::bad_alloc();
+    if (page_policy != SMALL_PAGES)
+      madvise(memory, length, MADV_HUGEPAGE);
+  }
+  ApplyNumaPolicy(memory, length);
+  __sync_fetch_and_add(&mapped_bytes, length);
+  return memory;
+}
+
+void FreeLarge(void* memory, size_t bytes) {
+  if (!memory)
+    return;
+  size_t length = RoundUp(bytes, AllocationPageSize());
+  munmap(memory, length);
+  __sync_fetch_and_sub(&mapped_bytes, length);
+}
+
+LargeAllocationStats GetLargeAllocationStats() {
+  LargeAllocationStats stats;
+  stats.mapped_bytes = mapped_bytes;
+  stats.explicit_huge_page_bytes = explicit_huge_page_bytes;
+  stats.explicit_huge_page_fallbacks = explicit_huge_page_fallbacks;
+  return stats;
+}
+
+uint64_t TransparentHugePageBytes() {
+  // smaps_rollup sums the fields over all mappings; older kernels only
+  // have the per-mapping smaps.
+  FILE* file = fopen("/proc/self/smaps_rollup", "r");
+  if (!file)
+    file = fopen("/proc/self/smaps", "r");
+  if (!file)
+    return 0;
+  uint64_t bytes = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    unsigned long long kilobytes;
+    if (sscanf(line, "AnonHugePages: %llu kB", &kilobytes) == 1)
+      bytes += kilobytes << 10;
+  }
+  fclose(file);
+  return bytes;
+}
+
+bool ParsePagePolicy(const char* arg, PagePolicyEnum* pages) {
+  if (strcmp(arg, "small") == 0)
+    *pages = SMALL_PAGES;
+  else if (strcmp(arg, "thp") == 0)
+    *pages = TRANSPARENT_HUGE_PAGES;
+  else if (strcmp(arg, "hugetlb") == 0)
+    *pages = EXPLICIT_HUGE_PAGES;
+  else
+    return false;
+  return true;
+}
+
+bool ParseNumaPolicy(const char* arg, NumaPolicyEnum* numa) {
+  if (strcmp(arg, "default") == 0)
+    *numa = NUMA_DEFAULT;
+  else if (strcmp(arg, "interleave") == 0)
+    *numa = NUMA_INTERLEAVE;
+  else if (strcmp(arg, "local") == 0)
+    *numa = NUMA_LOCAL;
+  else
+    return false;
+  return true;
+}
+
+}  // namespace google_extremal_sets
@@ -0,0 +1,167 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// Allocation of the large, randomly accessed arrays of the algorithms
+// from huge pages and according to a NUMA placement policy.
+// ---
+// Author: Roberto Bayardo
+
+#ifndef _HUGE_PAGE_ALLOCATOR_H_
+#define _HUGE_PAGE_ALLOCATOR_H_
+
+#include <stddef.h>
+#include <new>
+#include "basic-types.h"
+
+namespace google_extremal_sets {
+
+// Pages backing large allocations.
+enum PagePolicyEnum {
+  // The default pages of the heap.
+  SMALL_PAGES,
+  // Mappings advised to be backed by transparent huge pages, which the
+  // kernel provides as available.
+  TRANSPARENT_HUGE_PAGES,
+  // Pages from the reserved huge page pool (see
+  // /proc/sys/vm/nr_hugepages). Falls back to transparent huge pages if
+  // the pool is exhausted.
+  EXPLICIT_HUGE_PAGES
+};
+
+// Placement of large allocations on the NUMA nodes of the machine.
+enum NumaPolicyEnum {
+  // The placement of the heap, which is normally the node of the thread
+  // that first touches each page.
+  NUMA_DEFAULT,
+  // Pages are spread round-robin over all nodes, so that threads on
+  // every node see the same mix of local and remote accesses.
+  NUMA_INTERLEAVE,
+  // Pages are placed on the node of the thread that allocates them.
+  NUMA_LOCAL
+};
+
+// Selects the policies applied to allocations of at least
+// kMinLargeAllocation bytes made through HugePageAllocator. Must be
+// called before any such allocation is made, since memory is released
+// according to the policy in effect when it is freed.
+void SetAllocationPolicy(PagePolicyEnum pages, NumaPolicyEnum numa);
+
+// Returns true if large allocations are mapped separately rather than
+// taken from the heap, i.e. if either policy is not the default.
+bool LargeAllocationsMapped();
+
+// Allocations of at least this many bytes are subject to the policies.
+const size_t kMinLargeAllocation = 1 << 20;
+
+// Returns the size of the pages backing large allocations, which they
+// are rounded up to a multiple of.
+size_t AllocationPageSize();
+
+// Maps memory for a large allocation according to the policies. Throws
+// std::bad_alloc on failure, like operator new. FreeLarge must be given
+// the same number of bytes.
+void* AllocateLarge(size_t bytes);
+void FreeLarge(void* memory, size_t bytes);
+
+// The number of bytes currently mapped by AllocateLarge, the total
+// number of bytes ever mapped from explicit huge pages, and the number
+// of times explicit huge pages were requested but not available.
+struct LargeAllocationStats {
+  uint64_t mapped_bytes;
+  uint64_t explicit_huge_page_bytes;
+  uint64_t explicit_huge_page_fallbacks;
+};
+LargeAllocationStats GetLargeAllocationStats();
+
+// Returns the number of bytes of this process's anonymous memory that
+// the kernel has backed with transparent huge pages, or 0 if unknown.
+uint64_t TransparentHugePageBytes();
+
+// Parse the policies as given on the command line: "small", "thp" or
+// "hugetlb", and "default", "interleave" or "local". Return false if
+// the argument is malformed.
+bool ParsePagePolicy(const char* arg, PagePolicyEnum* pages);
+bool ParseNumaPolicy(const char* arg, NumaPolicyEnum* numa);
+
+// STL allocator that obtains allocations of at least
+// kMinLargeAllocation bytes from AllocateLarge when
+// LargeAllocationsMapped(), and everything else from operator new.
+template <class T>
+class HugePageAllocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template <class U>
+  struct rebind {
+    typedef HugePageAllocator<U> other;
+  };
+
+  HugePageAllocator() {}
+  template <class U>
+  HugePageAllocator(const HugePageAllocator<U>&) {}
+
+  pointer address(reference value) const { return &value; }
+  const_pointer address(const_reference value) const { return &value; }
+  size_type max_size() const { return static_cast<size_t>(-1) / sizeof(T); }
+
+  pointer allocate(size_type count, const void* = 0) {
+    if (count > max_size())
+      throw std::bad_alloc();
+    size_t bytes = count * sizeof(T);
+    if (IsLarge(bytes))
+      return static_cast<pointer>(AllocateLarge(bytes));
+    return static_cast<pointer>(::operator new(bytes));
+  }
+
+  void deallocate(pointer memory, size_type count) {
+    size_t bytes = count * sizeof(T);
+    if (IsLarge(bytes))
+      FreeLarge(memory, bytes);
+    else
+      ::operator delete(memory);
+  }
+
+  void construct(pointer memory, const T& value) {
+    new (static_cast<void*>(memory)) T(value);
+  }
+  void destroy(pointer memory) { memory->~T(); }
+
+ private:
+  static bool IsLarge(size_t bytes) {
+    return bytes >= kMinLargeAllocation && LargeAllocationsMapped();
+  }
+};
+
+template <class T, class U>
+inline bool operator==(const HugePageAllocator<T>&,
+                       const HugePageAllocator<U>&) {
+  return true;
+}
+
+template <class T, class U>
+inline bool operator!=(const HugePageAllocator<T>&,
+                       const HugePageAllocator<U>&) {
+  return false;
+}
+
+}  // namespace google_extremal_sets
+
+#endif  // _HUGE_PAGE_ALLOCATOR_H_
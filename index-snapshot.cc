@@ -0,0 +1,247 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// Author: Roberto Bayardo
+
+#include "index-snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <iostream>
+
+namespace {
+
+// The snapshot file header.
+struct SnapshotHeader {
+  uint32_t magic;
+  uint32_t kind;
+  uint32_t version;
+  uint32_t section_count;
+  uint64_t table_offset;
+  uint64_t reserved;
+};
+
+}  // namespace
+
+namespace google_extremal_sets {
+
+/*static*/
+SnapshotWriter* SnapshotWriter::Get(const char* snapshot_path, uint32_t kind) {
+  FILE* output = fopen(snapshot_path, "wb");
+  if (!output) {
+    std::cerr << "; Could not open snapshot file for writing: "
+              << snapshot_path << ": " << strerror(errno) << "\n";
+    return 0;
+  }
+  SnapshotWriter* writer = new SnapshotWriter(output, snapshot_path, kind);
+  // The header is rewritten with the table offset by Close().
+  if (!writer->WriteHeader(0)) {
+    std::cerr << "; Failed to write header to snapshot file: "
+              << snapshot_path << "\n";
+    delete writer;
+    return 0;
+  }
+  return writer;
+}
+
+SnapshotWriter::SnapshotWriter(
+    FILE* output, const char* snapshot_path, uint32_t kind)
+    : output_(output),
+      snapshot_path_(snapshot_path),
+      kind_(kind),
+      failed_(false),
+      bytes_written_(0),
+      in_section_(false) {
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  if (output_)
+    Close();
+}
+
+bool SnapshotWriter::WriteHeader(uint64_t table_offset) {
+  SnapshotHeader header;
+  header.magic = kSnapshotMagic;
+  header.kind = kind_;
+  header.version = kSnapshotVersion;
+  header.section_count = sections_.size();
+  header.table_offset = table_offset;
+  header.reserved = 0;
+  if (fwrite(&header, sizeof(header), 1, output_) != 1) {
+    failed_ = true;
+    return false;
+  }
+  if (!bytes_written_)
+    bytes_written_ = sizeof(header);
+  return true;
+}
+
+bool SnapshotWriter::BeginSection(uint32_t id) {
+  EndSection();
+  // Pad up to the alignment of the section.
+  static const char kPadding[kSnapshotAlignment] = { 0 };
+  size_t padding = (kSnapshotAlignment -
+                    bytes_written_ % kSnapshotAlignment) % kSnapshotAlignment;
+  if (!Write(kPadding, padding))
+    return false;
+  SnapshotSection section;
+  section.id = id;
+  section.reserved = 0;
+  section.offset = bytes_written_;
+  section.bytes = 0;
+  sections_.push_back(section);
+  in_section_ = true;
+  return true;
+}
+
+bool SnapshotWriter::Write(const void* data, size_t bytes) {
+  if (failed_)
+    return false;
+  if (bytes && fwrite(data, 1, bytes, output_) != bytes) {
+    failed_ = true;
+    return false;
+  }
+  bytes_written_ += bytes;
+  return true;
+}
+
+void SnapshotWriter::EndSection() {
+  if (!in_section_)
+    return;
+  sections_.back().bytes = bytes_written_ - sections_.back().offset;
+  in_section_ = false;
+}
+
+bool SnapshotWriter::Close() {
+  EndSection();
+  uint64_t table_offset = bytes_written_;
+  if (!sections_.empty())
+    Write(&sections_[0], sections_.size() * sizeof(SnapshotSection));
+  if (!failed_ && fseeko(output_, 0, SEEK_SET) != 0)
+    failed_ = true;
+  if (!failed_)
+    WriteHeader(table_offset);
+  if (fclose(output_))
+    failed_ = true;
+  output_ = 0;
+  if (failed_) {
+    std::cerr << "; Failed to write snapshot file: " << snapshot_path_
+              << "\n";
+  }
+  return !failed_;
+}
+
+/*static*/
+MappedSnapshot* MappedSnapshot::Get(const char* snapshot_path, uint32_t kind) {
+  int fd = open(snapshot_path, O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "ERROR: Failed to open snapshot file ("
+              << snapshot_path << "): " << strerror(errno) << "\n";
+    return 0;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat)) {
+    std::cerr << "ERROR: Failed to stat snapshot file ("
+              << snapshot_path << "): " << strerror(errno) << "\n";
+    close(fd);
+    return 0;
+  }
+  MappedSnapshot* snapshot = new MappedSnapshot(snapshot_path);
+  snapshot->map_size_ = file_stat.st_size;
+  if (snapshot->map_size_ < sizeof(SnapshotHeader)) {
+    std::cerr << "ERROR: Truncated snapshot file (" << snapshot_path
+              << ")\n";
+    close(fd);
+    delete snapshot;
+    return 0;
+  }
+  void* map = mmap(0, snapshot->map_size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    std::cerr << "ERROR: Failed to map snapshot file ("
+              << snapshot_path << "): " << strerror(errno) << "\n";
+    delete snapshot;
+    return 0;
+  }
+  snapshot->map_ = static_cast<const char*>(map);
+
+  const SnapshotHeader* header =
+      reinterpret_cast<const SnapshotHeader*>(snapshot->map_);
+  const char* error = 0;
+  if (header->magic != kSnapshotMagic) {
+    error = "not a snapshot file";
+  } else if (header->version != kSnapshotVersion) {
+    error = "unsupported snapshot version";
+  } else if (header->kind != kind) {
+    error = "snapshot was written by a different algorithm";
+  } else if (header->table_offset > snapshot->map_size_ ||
+             (snapshot->map_size_ - header->table_offset) /
+                 sizeof(SnapshotSection) < header->section_count) {
+    error = "truncated snapshot file";
+  }
+  if (error) {
+    std::cerr << "ERROR: Invalid snapshot file (" << snapshot_path << "): "
+              << error << "\n";
+    delete snapshot;
+    return 0;
+  }
+  snapshot->sections_ = reinterpret_cast<const SnapshotSection*>(
+      snapshot->map_ + header->table_offset);
+  snapshot->section_count_ = header->section_count;
+  return snapshot;
+}
+
+MappedSnapshot::MappedSnapshot(const char* snapshot_path)
+    : snapshot_path_(snapshot_path),
+      map_(0),
+      map_size_(0),
+      sections_(0),
+      section_count_(0) {
+}
+
+MappedSnapshot::~MappedSnapshot() {
+  if (map_)
+    munmap(const_cast<char*>(map_), map_size_);
+}
+
+bool MappedSnapshot::GetSection(uint32_t id, const void** data, size_t* bytes,
+                                size_t element_bytes) const {
+  for (uint32_t i = 0; i < section_count_; ++i) {
+    const SnapshotSection& section = sections_[i];
+    if (section.id != id)
+      continue;
+    if (section.offset > map_size_ ||
+        section.bytes > map_size_ - section.offset ||
+        section.offset % kSnapshotAlignment ||
+        section.bytes % element_bytes) {
+      std::cerr << "ERROR: Corrupt section " << id << " in snapshot file ("
+                << snapshot_path_ << ")\n";
+      return false;
+    }
+    *data = map_ + section.offset;
+    *bytes = section.bytes;
+    return true;
+  }
+  std::cerr << "ERROR: Missing section " << id << " in snapshot file ("
+            << snapshot_path_ << ")\n";
+  return false;
+}
+
+}  // namespace google_extremal_sets
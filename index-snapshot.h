@@ -0,0 +1,179 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// Snapshot files, which persist the index an algorithm builds over a
+// dataset so that later runs can map it instead of rebuilding it.
+//
+// A snapshot consists of a header, a sequence of sections, and a table
+// describing the sections:
+//
+//   <kSnapshotMagic> <kind> <kSnapshotVersion> <number of sections>
+//   <table offset> <reserved>
+//   <section 0> ... <section n-1>
+//   <SnapshotSection 0> ... <SnapshotSection n-1>
+//
+// where the kind identifies the algorithm that wrote the snapshot, the
+// table offset and reserved fields are 8-byte integers, and all other
+// header fields are 4-byte integers. Each section begins at a multiple
+// of kSnapshotAlignment bytes. Sections hold arrays of integers in the
+// byte order of the platform, and refer to each other by position
+// rather than by address, so that they can be used in place wherever
+// the file is mapped.
+// ---
+// Author: Roberto Bayardo
+
+#ifndef _INDEX_SNAPSHOT_H_
+#define _INDEX_SNAPSHOT_H_
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "basic-types.h"
+
+namespace google_extremal_sets {
+
+const uint32_t kSnapshotMagic = 0x534d4153;  // "SAMS" in little endian.
+const uint32_t kSnapshotVersion = 2;
+const size_t kSnapshotAlignment = 64;
+
+// Algorithms that write snapshots.
+enum SnapshotKindEnum {
+  LEXICOGRAPHIC_SNAPSHOT = 1,
+  SATELITE_SNAPSHOT = 2
+};
+
+// Identifiers of the sections of a snapshot.
+enum SnapshotSectionEnum {
+  // Counters and settings of the algorithm.
+  SECTION_PARAMETERS = 1,
+  // The arrays of a CandidateStore (see candidate-store.h).
+  SECTION_CANDIDATE_FORMAT,
+  SECTION_CANDIDATE_OFFSETS,
+  SECTION_CANDIDATE_SIZES,
+  SECTION_CANDIDATE_IDS,
+  SECTION_CANDIDATE_LIVE,
+  SECTION_CANDIDATE_PREFIXES,
+  SECTION_CANDIDATE_ITEMS,
+  // The item index of AllMaximalSetsLexicographic, and the items it is
+  // keyed by if it is sparse.
+  SECTION_ITEM_INDEX,
+  SECTION_ITEM_INDEX_ITEMS,
+  // The itemsets of AllMaximalSetsSateLite as apriori binary records,
+  // and the occurs lists, which are stored back to back as the word
+  // offsets of records, with the list of the i-th smallest item,
+  // occurs_items[i], in [occurs_begin[i], occurs_begin[i + 1]).
+  SECTION_RECORDS,
+  SECTION_OCCURS_ITEMS,
+  SECTION_OCCURS_BEGIN,
+  SECTION_OCCURS
+};
+
+struct SnapshotSection {
+  uint32_t id;
+  uint32_t reserved;
+  uint64_t offset;  // from the beginning of the file.
+  uint64_t bytes;
+};
+
+class SnapshotWriter {
+ public:
+  // Factory method for obtaining a writer of a snapshot of the given
+  // kind to the file at snapshot_path. Returns NULL on error and
+  // reports the error details to stderr.
+  static SnapshotWriter* Get(const char* snapshot_path, uint32_t kind);
+
+  // Closes the file if Close() has not already been called.
+  ~SnapshotWriter();
+
+  // Starts a new section, ending the current one if any. The contents
+  // of the section are then appended by Write.
+  bool BeginSection(uint32_t id);
+  bool Write(const void* data, size_t bytes);
+
+  // Writes a section holding the given array.
+  template <class T>
+  bool WriteSection(uint32_t id, const T* data, size_t count) {
+    return BeginSection(id) && Write(data, count * sizeof(T));
+  }
+  template <class Vector>
+  bool WriteSection(uint32_t id, const Vector& data) {
+    return WriteSection(id, data.empty() ? 0 : &data[0], data.size());
+  }
+
+  // Writes the table of sections and closes the file. Returns false on
+  // IO error.
+  bool Close();
+
+ private:
+  SnapshotWriter(FILE* output, const char* snapshot_path, uint32_t kind);
+
+  // Ends the current section, if any.
+  void EndSection();
+
+  bool WriteHeader(uint64_t table_offset);
+
+  FILE* output_;
+  const std::string snapshot_path_;
+  const uint32_t kind_;
+  bool failed_;
+  uint64_t bytes_written_;
+  std::vector<SnapshotSection> sections_;
+  bool in_section_;
+};
+
+// A snapshot memory-mapped read-only.
+class MappedSnapshot {
+ public:
+  // Factory method for mapping the snapshot of the given kind at
+  // snapshot_path. Returns NULL on error and reports the error details
+  // to stderr.
+  static MappedSnapshot* Get(const char* snapshot_path, uint32_t kind);
+  ~MappedSnapshot();
+
+  // Points *data at the contents of the section holding an array of
+  // T, and sets *count to its length. Returns false, reporting the
+  // error to stderr, if there is no such section or its size is not a
+  // multiple of sizeof(T).
+  template <class T>
+  bool GetArray(uint32_t id, const T** data, size_t* count) const {
+    const void* section;
+    size_t bytes;
+    if (!GetSection(id, &section, &bytes, sizeof(T)))
+      return false;
+    *data = static_cast<const T*>(section);
+    *count = bytes / sizeof(T);
+    return true;
+  }
+
+ private:
+  MappedSnapshot(const char* snapshot_path);
+
+  bool GetSection(uint32_t id, const void** data, size_t* bytes,
+                  size_t element_bytes) const;
+
+  const std::string snapshot_path_;
+  const char* map_;
+  size_t map_size_;
+  const SnapshotSection* sections_;
+  uint32_t section_count_;
+
+  // Not copyable.
+  MappedSnapshot(const MappedSnapshot&);
+  void operator=(const MappedSnapshot&);
+};
+
+}  // namespace google_extremal_sets
+
+#endif  // _INDEX_SNAPSHOT_H_
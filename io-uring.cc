@@ -0,0 +1,221 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ---
+// Author: Roberto Bayardo
+
+#include "io-uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+namespace google_extremal_sets {
+
+namespace {
+
+// Returns a pointer to the ring field at the given byte offset.
+unsigned* RingField(void* ring, unsigned offset) {
+  return reinterpret_cast<unsigned*>(static_cast<char*>(ring) + offset);
+}
+
+}  // namespace
+
+/*static*/
+IoUring* IoUring::Create(unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring_fd < 0)
+    return 0;
+  IoUring* ring = new IoUring(ring_fd);
+
+  ring->sq_ring_size_ =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap && ring->cq_ring_size_ > ring->sq_ring_size_)
+    ring->sq_ring_size_ = ring->cq_ring_size_;
+  void* sq_ring = mmap(0, ring->sq_ring_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED) {
+    delete ring;
+    return 0;
+  }
+  ring->sq_ring_ = sq_ring;
+  if (single_mmap) {
+    ring->cq_ring_ = sq_ring;
+  } else {
+    void* cq_ring = mmap(0, ring->cq_ring_size_, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_fd,
+                         IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) {
+      delete ring;
+      return 0;
+    }
+    ring->cq_ring_ = cq_ring;
+  }
+  ring->sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(0, ring->sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    delete ring;
+    return 0;
+  }
+  ring->sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+  ring->sq_head_ = RingField(ring->sq_ring_, params.sq_off.head);
+  ring->sq_tail_ = RingField(ring->sq_ring_, params.sq_off.tail);
+  ring->sq_mask_ = *RingField(ring->sq_ring_, params.sq_off.ring_mask);
+  ring->sq_entries_ = *RingField(ring->sq_ring_, params.sq_off.ring_entries);
+  ring->sq_array_ = RingField(ring->sq_ring_, params.sq_off.array);
+  ring->cq_head_ = RingField(ring->cq_ring_, params.cq_off.head);
+  ring->cq_tail_ = RingField(ring->cq_ring_, params.cq_off.tail);
+  ring->cq_mask_ = *RingField(ring->cq_ring_, params.cq_off.ring_mask);
+  ring->cqes_ = reinterpret_cast<struct io_uring_cqe*>(
+      static_cast<char*>(ring->cq_ring_) + params.cq_off.cqes);
+  return ring;
+}
+
+IoUring::IoUring(int ring_fd)
+    : ring_fd_(ring_fd),
+      queued_(0),
+      sq_ring_(0),
+      sq_ring_size_(0),
+      cq_ring_(0),
+      cq_ring_size_(0),
+      sqes_(0),
+      sqes_size_(0) {
+}
+
+IoUring::~IoUring() {
+  if (sqes_)
+    munmap(sqes_, sqes_size_);
+  if (cq_ring_ && cq_ring_ != sq_ring_)
+    munmap(cq_ring_, cq_ring_size_);
+  if (sq_ring_)
+    munmap(sq_ring_, sq_ring_size_);
+  close(ring_fd_);
+}
+
+bool IoUring::QueueRead(int fd, const struct iovec* iov, off_t offset,
+                        uint64_t user_data) {
+  // We are the only producer, so the tail can be read plainly; the
+  // head is advanced by the kernel as it consumes entries.
+  unsigned tail = *sq_tail_;
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (tail - head >= sq_entries_)
+    return false;
+  unsigned index = tail & sq_mask_;
+  struct io_uring_sqe* sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  // READV rather than READ so that kernels since 5.1 are supported.
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(iov);
+  sqe->len = 1;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  ++queued_;
+  return true;
+}
+
+int IoUring::Submit(unsigned min_complete) {
+  while (true) {
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    int submitted = syscall(__NR_io_uring_enter, ring_fd_, queued_,
+                            min_complete, flags, 0, 0);
+    if (submitted < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno;
+    }
+    queued_ -= submitted;
+    return 0;
+  }
+}
+
+unsigned IoUring::DiscardQueued() {
+  // The kernel advances the head past every entry it consumes, so
+  // whatever lies between the head and the tail was never submitted.
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  unsigned discarded = *sq_tail_ - head;
+  __atomic_store_n(sq_tail_, head, __ATOMIC_RELEASE);
+  queued_ = 0;
+  return discarded;
+}
+
+bool IoUring::PopCompletion(uint64_t* user_data, int* result) {
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  if (head == tail)
+    return false;
+  const struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+  *user_data = cqe->user_data;
+  *result = cqe->res;
+  __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+}  // namespace google_extremal_sets
+
+#else  // HAVE_IO_URING
+
+namespace google_extremal_sets {
+
+/*static*/
+IoUring* IoUring::Create(unsigned entries) {
+  return 0;
+}
+
+IoUring::IoUring(int ring_fd) : ring_fd_(ring_fd) {
+}
+
+IoUring::~IoUring() {
+}
+
+bool IoUring::QueueRead(int fd, const struct iovec* iov, off_t offset,
+                        uint64_t user_data) {
+  return false;
+}
+
+int IoUring::Submit(unsigned min_complete) {
+  return 0;
+}
+
+unsigned IoUring::DiscardQueued() {
+  return 0;
+}
+
+bool IoUring::PopCompletion(uint64_t* user_data, int* result) {
+  return false;
+}
+
+}  // namespace google_extremal_sets
+
+#endif  // HAVE_IO_URING
@@ -0,0 +1,92 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// A minimal io_uring wrapper for issuing several file reads at once,
+// implemented directly on the system calls so that it has no library
+// dependencies. Only available on Linux with io_uring headers; on other
+// systems Create() always returns NULL.
+// ---
+// Author: Roberto Bayardo
+
+#ifndef _IO_URING_H_
+#define _IO_URING_H_
+
+#include <sys/types.h>
+#include "basic-types.h"
+
+struct iovec;
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace google_extremal_sets {
+
+class IoUring {
+ public:
+  // Factory method for obtaining a ring with room for the given number
+  // of outstanding requests. Returns NULL if the kernel does not
+  // support io_uring (or it is disabled), in which case callers should
+  // fall back to synchronous reads. Reports nothing to stderr.
+  static IoUring* Create(unsigned entries);
+  ~IoUring();
+
+  // Queues a read into the buffer described by iov from the given file
+  // offset. The iovec must remain valid until the read completes.
+  // user_data is returned with the completion. Returns false if the
+  // submission queue is full.
+  bool QueueRead(int fd, const struct iovec* iov, off_t offset,
+                 uint64_t user_data);
+
+  // Submits all queued reads and then waits until at least
+  // min_complete completions are available. Returns the errno of a
+  // failed submission, or 0 on success. On failure, the reads the
+  // kernel did not accept remain queued.
+  int Submit(unsigned min_complete);
+
+  // Withdraws the reads that are queued but were not yet accepted by
+  // the kernel, and returns their number. These are always the most
+  // recently queued reads, and will never complete.
+  unsigned DiscardQueued();
+
+  // Removes the oldest completion from the ring. Returns false if there
+  // is none; otherwise *result is the byte count or negated errno.
+  bool PopCompletion(uint64_t* user_data, int* result);
+
+ private:
+  explicit IoUring(int ring_fd);
+
+  const int ring_fd_;
+  unsigned queued_;  // reads queued but not yet submitted.
+
+  // The shared ring mappings and pointers to their fields.
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  struct io_uring_cqe* cqes_;
+};
+
+}  // namespace google_extremal_sets
+
+#endif  // _IO_URING_H_
@@ -23,6 +23,7 @@
 #include <utility>
 #include <vector>
 
+#include "apriori-writer.h"
 #include "basic-types.h"
 #include "data-source-iterator.h"
 #include "set-properties.h"
@@ -37,12 +38,6 @@ SetPropertiesCardinalityCompareFunctor compare_set_properties_cardinality;
 
 bool FixItems(
     DataSourceIterator* data, const char* output_path, bool by_cardinality) {
-  FILE* output_file = fopen(output_path, "wb");
-  if (!output_file) {
-    cerr << "; Could not open output file for writing: "
-              << output_path << "\n";
-    return false;
-  }
   vector<uint32_t> clause;
 
   // First read in the data & compute the literal frequencies.
@@ -106,16 +101,27 @@ bool FixItems(
     sort(sort_us.begin(), sort_us.end(), compare_set_properties_cardinality);
   else
     sort(sort_us.begin(), sort_us.end(), compare_set_properties);
+  DatasetMetadata metadata;
+  metadata.sort_order = by_cardinality ? SORT_CARDINALITY : SORT_LEXICOGRAPHIC;
+  for (uint32_t i = 0; i < sort_us.size(); ++i)
+    metadata.Add(sort_us[i]->item, sort_us[i]->size);
+  AprioriWriter* output_file = AprioriWriter::Get(
+      output_path, AprioriWriter::BINARY, false/*front_coded*/, &metadata);
+  if (!output_file)
+    return false;
   cerr << "; Writing " << sort_us.size() << " itemsets to file..." << endl;
   for (uint32_t i = 0; i < sort_us.size(); ++i) {
     SetProperties* set = sort_us[i];
-    if (!fwrite(set, sizeof(uint32_t), 2 + set->size, output_file)) {
+    if (!output_file->Write(*set)) {
       // TODO: fix mem leak
+      delete output_file;
       return false;
     }
     SetProperties::Delete(set);
   }
-  if (fclose(output_file))
+  bool success = output_file->Close();
+  delete output_file;
+  if (!success)
     return false;
 
   return true;
@@ -0,0 +1,111 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// Author: Roberto Bayardo
+
+#include "item-map.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace google_extremal_sets {
+
+const uint32_t ItemMap::kNoSlot;
+
+ItemMap::ItemMap() : hashed_(false), mask_(0), shift_(32) {
+}
+
+uint32_t ItemMap::Insert(uint32_t item) {
+  uint32_t slot = Find(item);
+  if (slot != kNoSlot)
+    return slot;
+  slot = items_.size();
+  items_.push_back(item);
+  if (hashed_) {
+    if (table_.size() < 2 * items_.size())
+      Rehash(2 * items_.size());
+    else
+      HashInsert(item, slot);
+  } else if (item < direct_.size()) {
+    direct_[item] = slot;
+  } else if (static_cast<uint64_t>(item) <
+             static_cast<uint64_t>(kMaxDirectRatio) * items_.size() +
+                 kMinDirectItems) {
+    direct_.resize(item + 1, kNoSlot);
+    direct_[item] = slot;
+  } else {
+    // The items are too sparse for the direct table to pay off.
+    std::vector<uint32_t>().swap(direct_);
+    hashed_ = true;
+    Rehash(2 * items_.size());
+  }
+  return slot;
+}
+
+void ItemMap::HashInsert(uint32_t item, uint32_t slot) {
+  uint32_t i = Hash(item);
+  while (table_[i].slot != kNoSlot)
+    i = (i + 1) & mask_;
+  table_[i].item = item;
+  table_[i].slot = slot;
+}
+
+void ItemMap::Rehash(size_t capacity) {
+  int bits = 1;
+  while ((static_cast<size_t>(1) << bits) < 2 * capacity)
+    ++bits;
+  Entry free_entry;
+  free_entry.item = 0;
+  free_entry.slot = kNoSlot;
+  table_.assign(static_cast<size_t>(1) << bits, free_entry);
+  mask_ = table_.size() - 1;
+  shift_ = 32 - bits;
+  for (uint32_t slot = 0; slot < items_.size(); ++slot)
+    HashInsert(items_[slot], slot);
+}
+
+void ItemMap::SlotsInItemOrder(std::vector<uint32_t>* slots) const {
+  slots->clear();
+  slots->reserve(items_.size());
+  if (!hashed_) {
+    for (size_t item = 0; item < direct_.size(); ++item) {
+      if (direct_[item] != kNoSlot)
+        slots->push_back(direct_[item]);
+    }
+    return;
+  }
+  std::vector<std::pair<uint32_t, uint32_t> > by_item(items_.size());
+  for (uint32_t slot = 0; slot < items_.size(); ++slot)
+    by_item[slot] = std::make_pair(items_[slot], slot);
+  std::sort(by_item.begin(), by_item.end());
+  for (size_t i = 0; i < by_item.size(); ++i)
+    slots->push_back(by_item[i].second);
+}
+
+void ItemMap::Clear() {
+  std::vector<uint32_t>().swap(items_);
+  std::vector<uint32_t>().swap(direct_);
+  std::vector<Entry>().swap(table_);
+  hashed_ = false;
+  mask_ = 0;
+  shift_ = 32;
+}
+
+uint64_t ItemMap::BytesUsed() const {
+  return (items_.capacity() + direct_.capacity()) * sizeof(uint32_t) +
+      table_.capacity() * sizeof(Entry);
+}
+
+}  // namespace google_extremal_sets
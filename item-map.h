@@ -0,0 +1,110 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// ItemMap: numbers the distinct item ids of a dataset densely, so that
+// per-item tables need not be sized by the largest item id.
+// ---
+// Author: Roberto Bayardo
+
+#ifndef _ITEM_MAP_H_
+#define _ITEM_MAP_H_
+
+#include <vector>
+#include "basic-types.h"
+
+namespace google_extremal_sets {
+
+// Assigns each item id it is given the next of the slots 0, 1, 2, ...,
+// in the order in which the items are first seen. Item ids can be any
+// 32-bit integers.
+//
+// While the item ids seen are dense enough, the slots are found by
+// direct lookup in a table indexed by item id. Once the largest id
+// exceeds kMaxDirectRatio times the number of items (plus
+// kMinDirectItems), the map switches to an open addressing hash table,
+// so that its memory is proportional to the number of items either way.
+class ItemMap {
+ public:
+  static const uint32_t kNoSlot = static_cast<uint32_t>(-1);
+  static const uint32_t kMaxDirectRatio = 4;
+  static const uint32_t kMinDirectItems = 1 << 16;
+
+  ItemMap();
+
+  // Returns the slot of the item, or kNoSlot if it is not in the map.
+  uint32_t Find(uint32_t item) const {
+    if (!hashed_)
+      return item < direct_.size() ? direct_[item] : kNoSlot;
+    for (uint32_t i = Hash(item); ; i = (i + 1) & mask_) {
+      const Entry& entry = table_[i];
+      if (entry.item == item || entry.slot == kNoSlot)
+        return entry.slot;
+    }
+  }
+
+  // Returns the slot of the item, assigning it the next slot if it is
+  // not in the map already.
+  uint32_t Insert(uint32_t item);
+
+  // Number of items in the map, which is also the next slot.
+  uint32_t size() const { return items_.size(); }
+
+  // Returns the item assigned the given slot.
+  uint32_t Item(uint32_t slot) const { return items_[slot]; }
+
+  // Sets *slots to the slots of all items, in increasing order of item
+  // id.
+  void SlotsInItemOrder(std::vector<uint32_t>* slots) const;
+
+  // Removes all items.
+  void Clear();
+
+  // Bytes of memory held by the map.
+  uint64_t BytesUsed() const;
+
+ private:
+  struct Entry {
+    uint32_t item;
+    uint32_t slot;  // kNoSlot if the entry is free.
+  };
+
+  uint32_t Hash(uint32_t item) const {
+    return (item * 0x9e3779b1U) >> shift_;
+  }
+
+  // Places the item with the given slot in the hash table, which must
+  // not contain it.
+  void HashInsert(uint32_t item, uint32_t slot);
+
+  // Moves the items into a hash table with room for at least
+  // capacity items.
+  void Rehash(size_t capacity);
+
+  // The item of each slot.
+  std::vector<uint32_t> items_;
+
+  // The slot of each item id, or kNoSlot, while !hashed_.
+  std::vector<uint32_t> direct_;
+
+  // The hash table, of a power of 2 entries, kept at most half full.
+  bool hashed_;
+  std::vector<Entry> table_;
+  uint32_t mask_;
+  int shift_;
+};
+
+}  // namespace google_extremal_sets
+
+#endif  // _ITEM_MAP_H_
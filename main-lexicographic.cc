@@ -19,13 +19,18 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <iostream>
 #include <memory>
 
 #include "all-maximal-sets-lexicographic.h"
 #include "data-source-iterator.h"
+#include "huge-page-allocator.h"
+#include "memory-budget.h"
+#include "perf-counters.h"
 
 using google_extremal_sets::DataSourceIterator;
 
@@ -33,34 +38,161 @@ int main(int argc, char** argv) {
   time_t start_time;
   time(&start_time);
 
+  // Parse options. If -m is specified, the dataset is memory-mapped
+  // and itemsets are used in place rather than copied into the
+  // heap. If -r is specified, the dataset is prefetched by a
+  // background thread, and if -d is specified that thread reads with
+  // direct IO, bypassing the page cache. If -f is specified, candidates
+  // are front coded in memory.
+  // The -b option gives the memory budget in bytes, optionally with a
+  // K, M or G suffix, or "auto" (the default) to derive it from the
+  // memory available to the process.
+  // The -p option selects the pages backing the large arrays of the
+  // algorithm ("small", "thp" for transparent huge pages or "hugetlb"
+  // for reserved huge pages), and -n their NUMA placement ("default",
+  // "interleave" or "local"). If -c is specified, data TLB and cycle
+  // counts are reported.
+  // If -w is specified, the index built over the dataset is saved to
+  // the given snapshot file instead of being checked for subsumption.
+  // If -l is specified, no dataset is given, and the maximal sets are
+  // found from the given snapshot file instead.
+  // The -t option gives the number of threads that check each chunk
+  // for subsumption, or "all" for one per online processor. If -o is
+  // specified, each chunk is read while the previous one is checked.
+  // The -i option selects the index over the candidates of each chunk:
+  // "first" (the default) indexes them by first item and searches the
+  // candidates for longer prefixes, and "trie" builds a prefix trie.
+  bool use_mmap = false;
+  bool read_ahead = false;
+  bool direct_io = false;
+  bool front_coded = false;
+  const char* budget = "auto";
+  const char* pages = "small";
+  const char* numa = "default";
+  bool report_counters = false;
+  const char* save_snapshot = 0;
+  const char* load_snapshot = 0;
+  const char* threads = "1";
+  bool pipelined = false;
+  const char* index = "first";
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+    if (strcmp(argv[arg], "-m") == 0)
+      use_mmap = true;
+    else if (strcmp(argv[arg], "-r") == 0)
+      read_ahead = true;
+    else if (strcmp(argv[arg], "-d") == 0)
+      read_ahead = direct_io = true;
+    else if (strcmp(argv[arg], "-f") == 0)
+      front_coded = true;
+    else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc)
+      budget = argv[++arg];
+    else if (strcmp(argv[arg], "-p") == 0 && arg + 1 < argc)
+      pages = argv[++arg];
+    else if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc)
+      numa = argv[++arg];
+    else if (strcmp(argv[arg], "-c") == 0)
+      report_counters = true;
+    else if (strcmp(argv[arg], "-w") == 0 && arg + 1 < argc)
+      save_snapshot = argv[++arg];
+    else if (strcmp(argv[arg], "-l") == 0 && arg + 1 < argc)
+      load_snapshot = argv[++arg];
+    else if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc)
+      threads = argv[++arg];
+    else if (strcmp(argv[arg], "-o") == 0)
+      pipelined = true;
+    else if (strcmp(argv[arg], "-i") == 0 && arg + 1 < argc)
+      index = argv[++arg];
+    else
+      break;
+  }
+
   // Verify input arguments.
-  if (argc != 2) {
-    std::cerr << "ERROR: Usage is: ./ams-lexicographic <dataset_path>\n";
+  uint64_t max_bytes_in_ram;
+  google_extremal_sets::PagePolicyEnum page_policy;
+  google_extremal_sets::NumaPolicyEnum numa_policy;
+  long thread_count = strcmp(threads, "all") == 0 ?
+      sysconf(_SC_NPROCESSORS_ONLN) : strtol(threads, 0, 10);
+  if (arg != argc - (load_snapshot ? 0 : 1) ||
+      thread_count < 1 ||
+      (strcmp(index, "first") != 0 && strcmp(index, "trie") != 0) ||
+      (save_snapshot && load_snapshot) ||
+      !google_extremal_sets::ParseMemoryBudget(budget, &max_bytes_in_ram) ||
+      !google_extremal_sets::ParsePagePolicy(pages, &page_policy) ||
+      !google_extremal_sets::ParseNumaPolicy(numa, &numa_policy) ||
+      (use_mmap && (read_ahead || front_coded))) {
+    std::cerr << "ERROR: Usage is: ./ams-lexicographic [-m | -r | -d] [-f] [-b <bytes> | auto] [-p small | thp | hugetlb] [-n default | interleave | local] [-c] [-t <threads> | all] [-o] [-i first | trie] {[-w <snapshot_path>] <dataset_path> | -l <snapshot_path>}\n";
     return 1;
   }
+  const char* dataset_path = load_snapshot ? 0 : argv[arg];
+  google_extremal_sets::SetAllocationPolicy(page_policy, numa_policy);
 
   {
-    std::auto_ptr<DataSourceIterator> data(DataSourceIterator::Get(argv[1]));
-    if (!data.get())
+    std::auto_ptr<DataSourceIterator> data;
+    if (dataset_path) {
+      data.reset(use_mmap ? DataSourceIterator::GetMapped(dataset_path)
+                          : DataSourceIterator::Get(dataset_path));
+      if (!data.get())
+        return 2;
+    }
+    if (read_ahead && data.get() &&
+        !data->EnableReadAhead(4/*buffer_count*/, 16 << 20/*buffer_size*/,
+                               direct_io)) {
+      std::cerr << "ERROR: " << data->GetErrorMessage() << "\n";
       return 2;
+    }
 
     google_extremal_sets::AllMaximalSetsLexicographic ap;
-    ap.SetMaxItemsInRam(1000000000);
+    ap.SetMaxBytesInRam(max_bytes_in_ram);
+    ap.SetFrontCodedCandidates(front_coded);
+    ap.SetThreadCount(thread_count);
+    ap.SetPipelinedChunks(pipelined);
+    ap.SetCandidateTrie(strcmp(index, "trie") == 0);
     ap.SetOutputMode(google_extremal_sets::COUNT_ONLY);
     //ap.SetOutputMode(google_extremal_sets::ID_AND_ITEMS);
 
-    bool result = ap.FindAllMaximalSets(data.get(), 8000000/*max_item_id*/);
+    google_extremal_sets::PerfCounters counters;
+    if (report_counters && !counters.Start())
+      std::cerr << "; WARNING: Performance counters are unavailable.\n";
+    bool result;
+    if (load_snapshot)
+      result = ap.FindAllMaximalSetsInSnapshot(load_snapshot);
+    else if (save_snapshot)
+      result = ap.SaveSnapshot(data.get(), save_snapshot);
+    else
+      result = ap.FindAllMaximalSets(data.get(), 8000000/*max_item_id unless in header*/);
+    counters.Stop();
 
     if (!result) {
-      std::cerr << "IO ERROR: " << data->GetErrorMessage() << "\n";
+      // Snapshot errors have already been reported.
+      if (data.get())
+        std::cerr << "IO ERROR: " << data->GetErrorMessage() << "\n";
       return 3;
     }
 
-    std::cerr << "; Found " << ap.MaximalSetsCount() << " maximal itemsets.\n"
-              << "; Number of itemsets in the input: " << ap.InputSetsCount()
-              << "\n"
-              << "; Number of candidate seeks performed: "
-              << ap.CandidateSeekCount() << "\n";
+    if (save_snapshot) {
+      std::cerr << "; Saved snapshot of " << ap.InputSetsCount()
+                << " itemsets.\n";
+    } else {
+      std::cerr << "; Found " << ap.MaximalSetsCount()
+                << " maximal itemsets.\n"
+                << "; Number of itemsets in the input: "
+                << ap.InputSetsCount() << "\n"
+                << "; Number of candidate seeks performed: "
+                << ap.CandidateSeekCount() << "\n";
+    }
+    if (report_counters) {
+      google_extremal_sets::LargeAllocationStats stats =
+          google_extremal_sets::GetLargeAllocationStats();
+      counters.Report(std::cerr);
+      std::cerr << "; Transparent huge page memory: "
+                << google_extremal_sets::TransparentHugePageBytes()
+                << " bytes\n"
+                << "; Explicit huge page memory: "
+                << stats.explicit_huge_page_bytes << " bytes ("
+                << stats.explicit_huge_page_fallbacks
+                << " allocations fell back)\n";
+    }
   }
 
   time_t end_time;
@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include <iostream>
@@ -26,6 +27,9 @@
 
 #include "all-maximal-sets-satelite.h"
 #include "data-source-iterator.h"
+#include "huge-page-allocator.h"
+#include "memory-budget.h"
+#include "perf-counters.h"
 
 using google_extremal_sets::DataSourceIterator;
 
@@ -33,33 +37,139 @@ int main(int argc, char** argv) {
   time_t start_time;
   time(&start_time);
 
+  // Parse options. If -m is specified, the dataset is memory-mapped
+  // and itemsets are used in place rather than copied into the
+  // heap. If -r is specified, the dataset is prefetched by a
+  // background thread, and if -d is specified that thread reads with
+  // direct IO, bypassing the page cache.
+  // The -b option gives the memory budget in bytes, optionally with a
+  // K, M or G suffix, or "auto" (the default) to derive it from the
+  // memory available to the process.
+  // The -p option selects the pages backing the large arrays of the
+  // algorithm ("small", "thp" for transparent huge pages or "hugetlb"
+  // for reserved huge pages), and -n their NUMA placement ("default",
+  // "interleave" or "local"). If -c is specified, data TLB and cycle
+  // counts are reported.
+  // If -w is specified, the index built over the dataset is saved to
+  // the given snapshot file instead of being checked for subsumption.
+  // If -l is specified, no dataset is given, and the maximal sets are
+  // found from the given snapshot file instead.
+  bool use_mmap = false;
+  bool read_ahead = false;
+  bool direct_io = false;
+  const char* budget = "auto";
+  const char* pages = "small";
+  const char* numa = "default";
+  bool report_counters = false;
+  const char* save_snapshot = 0;
+  const char* load_snapshot = 0;
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+    if (strcmp(argv[arg], "-m") == 0)
+      use_mmap = true;
+    else if (strcmp(argv[arg], "-r") == 0)
+      read_ahead = true;
+    else if (strcmp(argv[arg], "-d") == 0)
+      read_ahead = direct_io = true;
+    else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc)
+      budget = argv[++arg];
+    else if (strcmp(argv[arg], "-p") == 0 && arg + 1 < argc)
+      pages = argv[++arg];
+    else if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc)
+      numa = argv[++arg];
+    else if (strcmp(argv[arg], "-c") == 0)
+      report_counters = true;
+    else if (strcmp(argv[arg], "-w") == 0 && arg + 1 < argc)
+      save_snapshot = argv[++arg];
+    else if (strcmp(argv[arg], "-l") == 0 && arg + 1 < argc)
+      load_snapshot = argv[++arg];
+    else
+      break;
+  }
+
   // Verify input arguments.
-  if (argc != 2) {
-    std::cerr << "ERROR: Usage is: ./ams-satelite <dataset_path>\n";
+  uint64_t max_bytes_in_ram;
+  google_extremal_sets::PagePolicyEnum page_policy;
+  google_extremal_sets::NumaPolicyEnum numa_policy;
+  if (arg != argc - (load_snapshot ? 0 : 1) ||
+      (save_snapshot && load_snapshot) ||
+      !google_extremal_sets::ParseMemoryBudget(budget, &max_bytes_in_ram) ||
+      !google_extremal_sets::ParsePagePolicy(pages, &page_policy) ||
+      !google_extremal_sets::ParseNumaPolicy(numa, &numa_policy) ||
+      (use_mmap && read_ahead)) {
+    std::cerr << "ERROR: Usage is: ./ams-satelite [-m | -r | -d] [-b <bytes> | auto] [-p small | thp | hugetlb] [-n default | interleave | local] [-c] {[-w <snapshot_path>] <dataset_path> | -l <snapshot_path>}\n";
     return 1;
   }
+  const char* dataset_path = load_snapshot ? 0 : argv[arg];
+  google_extremal_sets::SetAllocationPolicy(page_policy, numa_policy);
 
   {
-    std::auto_ptr<DataSourceIterator> data(DataSourceIterator::Get(argv[1]));
-    if (!data.get())
+    std::auto_ptr<DataSourceIterator> data;
+    if (dataset_path) {
+      data.reset(use_mmap ? DataSourceIterator::GetMapped(dataset_path)
+                          : DataSourceIterator::Get(dataset_path));
+      if (!data.get())
+        return 2;
+    }
+    if (read_ahead && data.get() &&
+        !data->EnableReadAhead(4/*buffer_count*/, 16 << 20/*buffer_size*/,
+                               direct_io)) {
+      std::cerr << "ERROR: " << data->GetErrorMessage() << "\n";
       return 2;
+    }
 
     google_extremal_sets::AllMaximalSetsSateLite ap;
-    bool result = ap.FindAllMaximalSets(
-        data.get(),
-        8000000/*max_item_id*/,
-        1000000000/*max_items_in_ram*/,
-        google_extremal_sets::COUNT_ONLY/*output_mode*/);
+    google_extremal_sets::PerfCounters counters;
+    if (report_counters && !counters.Start())
+      std::cerr << "; WARNING: Performance counters are unavailable.\n";
+    bool result;
+    if (load_snapshot) {
+      result = ap.FindAllMaximalSetsInSnapshot(
+          load_snapshot, google_extremal_sets::COUNT_ONLY/*output_mode*/);
+    } else if (save_snapshot) {
+      result = ap.SaveSnapshot(
+          data.get(),
+          8000000/*max_item_id unless in header*/,
+          max_bytes_in_ram,
+          save_snapshot);
+    } else {
+      result = ap.FindAllMaximalSets(
+          data.get(),
+          8000000/*max_item_id unless in header*/,
+          max_bytes_in_ram,
+          google_extremal_sets::COUNT_ONLY/*output_mode*/);
+    }
+    counters.Stop();
     if (!result) {
-      std::cerr << "IO ERROR: " << data->GetErrorMessage() << "\n";
+      // Snapshot errors have already been reported.
+      if (data.get())
+        std::cerr << "IO ERROR: " << data->GetErrorMessage() << "\n";
       return 3;
     }
 
-    std::cerr << "; Found " << ap.MaximalSetsCount() << " maximal itemsets.\n"
-              << "; Number of itemsets in the input: " << ap.InputSetsCount()
-              << "\n"
-              << "; Number of subsumption checks performed: "
-              << ap.SubsumptionChecksCount() << "\n";
+    if (save_snapshot) {
+      std::cerr << "; Saved snapshot of " << ap.InputSetsCount()
+                << " itemsets.\n";
+    } else {
+      std::cerr << "; Found " << ap.MaximalSetsCount()
+                << " maximal itemsets.\n"
+                << "; Number of itemsets in the input: "
+                << ap.InputSetsCount() << "\n"
+                << "; Number of subsumption checks performed: "
+                << ap.SubsumptionChecksCount() << "\n";
+    }
+    if (report_counters) {
+      google_extremal_sets::LargeAllocationStats stats =
+          google_extremal_sets::GetLargeAllocationStats();
+      counters.Report(std::cerr);
+      std::cerr << "; Transparent huge page memory: "
+                << google_extremal_sets::TransparentHugePageBytes()
+                << " bytes\n"
+                << "; Explicit huge page memory: "
+                << stats.explicit_huge_page_bytes << " bytes ("
+                << stats.explicit_huge_page_fallbacks
+                << " allocations fell back)\n";
+    }
   }
 
   time_t end_time;
@@ -16,11 +16,15 @@
 // Invoke the Sorter utility to sort a given binary dataset.
 // To invoke:
 //
-// ./sorter [-c] <path_to_input_dataset> <path_to_output_dataset>
+// ./sorter [-c] [-z] [-i] <path_to_input_dataset> <path_to_output_dataset>
 //
 // If -c option is specified, the input dataset will be sorted in
 // increasing cardinality of its itemsets. Otherwise the dataset will
-// be sorted in increasing lexicographic order of its itemsets.
+// be sorted in increasing lexicographic order of its itemsets. If -z
+// option is specified, the output is written in the compressed
+// apriori format. If -i option is specified, an index sidecar file
+// (<path_to_output_dataset>.idx) is written as well, which allows
+// seeking to itemsets by ordinal or first item.
 // ---
 // Author: Roberto Bayardo
 
@@ -41,24 +45,38 @@ int main(int argc, char** argv) {
   time_t start_time;
   time(&start_time);
 
+  // Parse options.
+  bool by_cardinality = false;
+  bool compress = false;
+  bool write_index = false;
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+    if (strcmp(argv[arg], "-c") == 0)
+      by_cardinality = true;
+    else if (strcmp(argv[arg], "-z") == 0)
+      compress = true;
+    else if (strcmp(argv[arg], "-i") == 0)
+      write_index = true;
+    else
+      break;
+  }
+
   // Verify input arguments.
-  if (argc != 3 && argc != 4 ||
-      (argc == 4 && strcmp(argv[1], "-c") != 0)) {
+  if (arg != argc - 2) {
     std::cerr
-        << "ERROR: Usage is: ./sorter [-c] <input_dataset_path>"
+        << "ERROR: Usage is: ./sorter [-c] [-z] [-i] <input_dataset_path>"
         << " <output_dataset_path>\n";
     return 1;
   }
-  bool by_cardinality = (argc == 4);
-  int offset = (argc == 4) ? 1 : 0;
 
   {
     std::auto_ptr<DataSourceIterator> data(
-        DataSourceIterator::Get(argv[1 + offset]));
+        DataSourceIterator::Get(argv[arg]));
     if (!data.get())
       return 2;
     bool result = google_extremal_sets::Sort(
-        data.get(), argv[2 + offset], by_cardinality);
+        data.get(), argv[arg + 1], by_cardinality, compress,
+        write_index ? 4096 : 0/*index_interval*/);
 
     if (!result) {
       std::cerr << "IO ERROR: " << data->GetErrorMessage() << "\n";
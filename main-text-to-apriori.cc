@@ -0,0 +1,85 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// Convert a text format dataset (see DataSourceIterator::NextText)
+// into an apriori binary dataset. To invoke:
+//
+// ./text-to-apriori [-z] <path_to_input_dataset> <path_to_output_dataset>
+//
+// If -z option is specified, the output is written in the compressed
+// apriori format, which requires the items of every itemset to be
+// strictly increasing. The itemsets are not reordered; use the sorter
+// utility for that.
+// ---
+// Author: Roberto Bayardo
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <iostream>
+#include <memory>
+
+#include "data-source-iterator.h"
+#include "text-to-apriori.h"
+
+using google_extremal_sets::DataSourceIterator;
+
+int main(int argc, char** argv) {
+  time_t start_time;
+  time(&start_time);
+
+  // Verify input arguments.
+  if ((argc != 3 && argc != 4) ||
+      (argc == 4 && strcmp(argv[1], "-z") != 0)) {
+    std::cerr
+        << "ERROR: Usage is: ./text-to-apriori [-z] <input_dataset_path>"
+        << " <output_dataset_path>\n";
+    return 1;
+  }
+  bool compress = (argc == 4);
+  int offset = (argc == 4) ? 1 : 0;
+
+  {
+    std::auto_ptr<DataSourceIterator> data(
+        DataSourceIterator::Get(argv[1 + offset]));
+    if (!data.get())
+      return 2;
+#ifndef MICROSOFT
+    // Overlap reading the input with parsing it.
+    if (!data->EnableReadAhead(4, 16 << 20)) {
+      std::cerr << "ERROR: " << data->GetErrorMessage() << "\n";
+      return 2;
+    }
+#endif
+    bool result = google_extremal_sets::TextToApriori(
+        data.get(), argv[2 + offset], compress);
+
+    if (!result) {
+      std::cerr << "IO ERROR: " << data->GetErrorMessage() << "\n";
+      return 3;
+    }
+
+    std::cerr << "; Success!\n";
+  }
+
+  time_t end_time;
+  time(&end_time);
+  std::cerr << "; Total running time: " << (end_time - start_time)
+            << " seconds" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,173 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ---
+// Author: Roberto Bayardo
+
+#include "memory-budget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+namespace {
+
+using google_extremal_sets::kUnlimitedMemory;
+
+// Where the cgroup hierarchies are mounted. Under a hybrid setup the
+// v2 hierarchy is mounted at kCgroup2HybridMount instead.
+const char kCgroup2Mount[] = "/sys/fs/cgroup";
+const char kCgroup2HybridMount[] = "/sys/fs/cgroup/unified";
+const char kCgroup1MemoryMount[] = "/sys/fs/cgroup/memory";
+
+// Reads the number at the beginning of the given file. Returns false
+// if the file could not be read or does not begin with a number, as
+// is the case for the "max" of an unlimited cgroup v2.
+bool ReadNumber(const std::string& path, uint64_t* value) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (!file)
+    return false;
+  unsigned long long number;
+  bool ok = fscanf(file, "%llu", &number) == 1;
+  fclose(file);
+  if (ok)
+    *value = number;
+  return ok;
+}
+
+// Lowers *limit to the lowest limit recorded in the given file of the
+// cgroup at cgroup_path, or of any of its ancestors, within the
+// hierarchy mounted at mount. Inside a cgroup namespace the cgroup may
+// not be visible at its path, in which case only its ancestors that
+// are (in particular the root of the mount) are consulted.
+void ApplyCgroupLimit(const std::string& mount,
+                      std::string cgroup_path,
+                      const char* file_name,
+                      uint64_t* limit) {
+  while (true) {
+    uint64_t value;
+    if (ReadNumber(mount + cgroup_path + "/" + file_name, &value) &&
+        value < *limit) {
+      *limit = value;
+    }
+    std::string::size_type slash = cgroup_path.rfind('/');
+    if (slash == std::string::npos || cgroup_path.empty())
+      break;
+    cgroup_path.erase(slash);
+  }
+}
+
+// Returns the lowest memory limit of the cgroups containing this
+// process, or kUnlimitedMemory if there is none.
+uint64_t CgroupMemoryLimit() {
+  uint64_t limit = kUnlimitedMemory;
+  FILE* file = fopen("/proc/self/cgroup", "r");
+  if (!file)
+    return limit;
+  // Each line has the form "<hierarchy id>:<controllers>:<path>". The
+  // v2 hierarchy has id 0 and no controllers listed.
+  char line[4096];
+  while (fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "\n")] = '\0';
+    char* controllers = strchr(line, ':');
+    char* path = controllers ? strchr(controllers + 1, ':') : 0;
+    if (!path)
+      continue;
+    *controllers++ = '\0';
+    *path++ = '\0';
+    if (strcmp(line, "0") == 0 && *controllers == '\0') {
+      ApplyCgroupLimit(kCgroup2Mount, path, "memory.max", &limit);
+      ApplyCgroupLimit(kCgroup2HybridMount, path, "memory.max", &limit);
+      continue;
+    }
+    for (char* controller = strtok(controllers, ",");
+         controller;
+         controller = strtok(0, ",")) {
+      if (strcmp(controller, "memory") == 0) {
+        ApplyCgroupLimit(kCgroup1MemoryMount, path, "memory.limit_in_bytes",
+                         &limit);
+      }
+    }
+  }
+  fclose(file);
+  // Cgroup v1 reports the absence of a limit as a huge number just
+  // below 2^63.
+  if (limit >= (static_cast<uint64_t>(1) << 62))
+    limit = kUnlimitedMemory;
+  return limit;
+}
+
+// Returns the memory /proc/meminfo reports as available for starting
+// new applications without swapping, falling back to the total memory
+// on kernels that predate that estimate. Returns kUnlimitedMemory if
+// neither is reported.
+uint64_t MeminfoMemory() {
+  FILE* file = fopen("/proc/meminfo", "r");
+  if (!file)
+    return kUnlimitedMemory;
+  uint64_t available = kUnlimitedMemory;
+  uint64_t total = kUnlimitedMemory;
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    unsigned long long kilobytes;
+    if (sscanf(line, "MemAvailable: %llu kB", &kilobytes) == 1)
+      available = kilobytes << 10;
+    else if (sscanf(line, "MemTotal: %llu kB", &kilobytes) == 1)
+      total = kilobytes << 10;
+  }
+  fclose(file);
+  return available != kUnlimitedMemory ? available : total;
+}
+
+}  // namespace
+
+namespace google_extremal_sets {
+
+uint64_t AvailableMemory() {
+  uint64_t cgroup_limit = CgroupMemoryLimit();
+  uint64_t meminfo = MeminfoMemory();
+  uint64_t available = cgroup_limit < meminfo ? cgroup_limit : meminfo;
+  return available == kUnlimitedMemory ? 0 : available;
+}
+
+uint64_t AutoMemoryBudget() {
+  uint64_t available = AvailableMemory();
+  if (!available)
+    return kUnlimitedMemory;
+  return available / 4 * 3;
+}
+
+bool ParseMemoryBudget(const char* arg, uint64_t* bytes) {
+  if (strcmp(arg, "auto") == 0) {
+    *bytes = AutoMemoryBudget();
+    return true;
+  }
+  if (*arg < '0' || *arg > '9')
+    return false;
+  char* end;
+  unsigned long long number = strtoull(arg, &end, 10);
+  int shift = 0;
+  switch (*end) {
+    case 'K': case 'k': shift = 10; ++end; break;
+    case 'M': case 'm': shift = 20; ++end; break;
+    case 'G': case 'g': shift = 30; ++end; break;
+  }
+  if (*end != '\0' || number == 0 || number > (kUnlimitedMemory >> shift))
+    return false;
+  *bytes = static_cast<uint64_t>(number) << shift;
+  return true;
+}
+
+}  // namespace google_extremal_sets
@@ -0,0 +1,74 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// Functions for choosing the number of bytes of main memory the
+// algorithms may use.
+// ---
+// Author: Roberto Bayardo
+
+#ifndef _MEMORY_BUDGET_H_
+#define _MEMORY_BUDGET_H_
+
+#include <stddef.h>
+#include "basic-types.h"
+
+namespace google_extremal_sets {
+
+// Budget meaning that no limit is imposed.
+const uint64_t kUnlimitedMemory = ~static_cast<uint64_t>(0);
+
+// Returns the number of 4-byte items that fit in what remains of a
+// budget of max_bytes once used_bytes are in use, as taken by
+// DataSourceIterator::NextBatch.
+inline size_t ItemsLeftInBudget(uint64_t used_bytes, uint64_t max_bytes) {
+  if (used_bytes >= max_bytes)
+    return 0;
+  uint64_t items = (max_bytes - used_bytes) / sizeof(uint32_t);
+  size_t max_items = static_cast<size_t>(-1);
+  return items < max_items ? static_cast<size_t>(items) : max_items;
+}
+
+// Returns the memory consumed by a heap allocation of the given size,
+// including the bookkeeping and alignment padding added by the
+// allocator (modeled on glibc's malloc).
+inline size_t HeapBytes(size_t bytes) {
+  if (!bytes)
+    return 0;
+  size_t chunk = (bytes + sizeof(size_t) + 15) & ~static_cast<size_t>(15);
+  return chunk < 32 ? 32 : chunk;
+}
+
+// Returns the number of bytes of memory available to this process:
+// the lowest of the memory limits of the cgroups containing it (under
+// cgroup v2 or v1, including limits inherited from ancestor cgroups)
+// and the memory the kernel reports as available in /proc/meminfo.
+// Returns 0 if none of these could be determined.
+uint64_t AvailableMemory();
+
+// Returns the budget chosen by the "auto" setting, which is 3/4 of
+// AvailableMemory(). The rest is left for the data source buffers,
+// the program itself and the page cache. Returns kUnlimitedMemory if
+// the available memory could not be determined.
+uint64_t AutoMemoryBudget();
+
+// Parses a memory budget given on the command line: either "auto", or
+// a number of bytes with an optional K, M or G suffix denoting the
+// corresponding power of 1024. Returns false if the argument is
+// malformed.
+bool ParseMemoryBudget(const char* arg, uint64_t* bytes);
+
+}  // namespace google_extremal_sets
+
+#endif  // _MEMORY_BUDGET_H_
@@ -0,0 +1,119 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// Author: Roberto Bayardo
+
+#include "perf-counters.h"
+
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+
+namespace {
+
+// Returns the perf_event_attr config of a hardware cache event.
+uint64_t CacheEvent(uint64_t cache, uint64_t op, uint64_t result) {
+  return cache | (op << 8) | (result << 16);
+}
+
+// Opens a disabled user space counter for the calling thread and its
+// future children. Returns -1 on error.
+int OpenCounter(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0/*this thread*/, -1/*any cpu*/,
+                 -1/*no group*/, 0);
+}
+
+}  // namespace
+
+namespace google_extremal_sets {
+
+PerfCounters::PerfCounters() {
+  for (int i = 0; i < COUNTER_COUNT; ++i)
+    fds_[i] = -1;
+}
+
+PerfCounters::~PerfCounters() {
+  for (int i = 0; i < COUNTER_COUNT; ++i) {
+    if (fds_[i] >= 0)
+      close(fds_[i]);
+  }
+}
+
+bool PerfCounters::Start() {
+  fds_[DTLB_LOADS] = OpenCounter(
+      PERF_TYPE_HW_CACHE,
+      CacheEvent(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                 PERF_COUNT_HW_CACHE_RESULT_ACCESS));
+  fds_[DTLB_LOAD_MISSES] = OpenCounter(
+      PERF_TYPE_HW_CACHE,
+      CacheEvent(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                 PERF_COUNT_HW_CACHE_RESULT_MISS));
+  fds_[CYCLES] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  bool any = false;
+  for (int i = 0; i < COUNTER_COUNT; ++i) {
+    if (fds_[i] >= 0) {
+      ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+      any = true;
+    }
+  }
+  return any;
+}
+
+void PerfCounters::Stop() {
+  for (int i = 0; i < COUNTER_COUNT; ++i) {
+    if (fds_[i] >= 0)
+      ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+  }
+}
+
+bool PerfCounters::Read(int counter, uint64_t* count) {
+  return fds_[counter] >= 0 &&
+      read(fds_[counter], count, sizeof(*count)) == sizeof(*count);
+}
+
+void PerfCounters::Report(std::ostream& out) {
+  static const char* const kNames[COUNTER_COUNT] = {
+    "dTLB loads", "dTLB load misses", "Cycles"
+  };
+  uint64_t counts[COUNTER_COUNT];
+  bool available[COUNTER_COUNT];
+  for (int i = 0; i < COUNTER_COUNT; ++i) {
+    available[i] = Read(i, &counts[i]);
+    out << "; " << kNames[i] << ": ";
+    if (available[i])
+      out << counts[i];
+    else
+      out << "unavailable";
+    if (i == DTLB_LOAD_MISSES && available[i] && available[DTLB_LOADS] &&
+        counts[DTLB_LOADS]) {
+      out << " (" << 100.0 * counts[i] / counts[DTLB_LOADS] << "% of loads)";
+    }
+    out << "\n";
+  }
+}
+
+}  // namespace google_extremal_sets
@@ -0,0 +1,66 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// Hardware performance counters read through perf_event_open, for
+// measuring the effect of the allocation policies.
+// ---
+// Author: Roberto Bayardo
+
+#ifndef _PERF_COUNTERS_H_
+#define _PERF_COUNTERS_H_
+
+#include <ostream>
+#include "basic-types.h"
+
+namespace google_extremal_sets {
+
+// Counts data TLB loads and misses, and cycles, of the calling thread
+// and of the threads it creates while counting. Counting is limited to
+// user space so that it works under the default perf_event_paranoid
+// setting.
+class PerfCounters {
+ public:
+  PerfCounters();
+  ~PerfCounters();
+
+  // Opens and starts the counters. Counters the hardware or kernel
+  // does not provide are reported as unavailable. Returns false if
+  // none could be opened.
+  bool Start();
+
+  // Stops counting. The counts remain available to Report.
+  void Stop();
+
+  // Prints the counts, one per line, prefixed with "; ".
+  void Report(std::ostream& out);
+
+ private:
+  enum { DTLB_LOADS, DTLB_LOAD_MISSES, CYCLES, COUNTER_COUNT };
+
+  // Returns the count of the given counter, or false if it is not
+  // available.
+  bool Read(int counter, uint64_t* count);
+
+  // File descriptors of the counters, or -1.
+  int fds_[COUNTER_COUNT];
+
+  // Not copyable.
+  PerfCounters(const PerfCounters&);
+  void operator=(const PerfCounters&);
+};
+
+}  // namespace google_extremal_sets
+
+#endif  // _PERF_COUNTERS_H_
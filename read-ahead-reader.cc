@@ -0,0 +1,386 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ---
+// Author: Roberto Bayardo
+
+#include "read-ahead-reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+
+#include "io-uring.h"
+
+namespace {
+
+// Buffers are aligned to this many bytes, which is a multiple of the
+// page size and of the logical block size on any device we care about.
+const size_t kBufferAlignment = 4096;
+
+}  // namespace
+
+namespace google_extremal_sets {
+
+/*static*/
+ReadAheadReader* ReadAheadReader::Get(
+    int fd, off_t offset, int buffer_count, size_t buffer_size) {
+  if (buffer_count < 2 || buffer_size == 0) {
+    std::cerr << "ERROR: Read-ahead requires at least 2 non-empty buffers.\n";
+    return 0;
+  }
+  // Round the buffer size up to the alignment.
+  buffer_size =
+      (buffer_size + kBufferAlignment - 1) / kBufferAlignment * kBufferAlignment;
+  ReadAheadReader* reader = new ReadAheadReader(fd, offset, buffer_size, false);
+  if (!reader->Start(buffer_count)) {
+    delete reader;
+    return 0;
+  }
+  return reader;
+}
+
+/*static*/
+ReadAheadReader* ReadAheadReader::GetDirect(
+    const char* path, off_t offset, int buffer_count, size_t buffer_size) {
+  if (buffer_count < 2 || buffer_size == 0) {
+    std::cerr << "ERROR: Read-ahead requires at least 2 non-empty buffers.\n";
+    return 0;
+  }
+  int fd = open(path, O_RDONLY | O_DIRECT);
+  if (fd < 0) {
+    std::cerr << "ERROR: Could not open " << path << " for direct IO: "
+              << strerror(errno) << "\n";
+    return 0;
+  }
+  buffer_size =
+      (buffer_size + kBufferAlignment - 1) / kBufferAlignment * kBufferAlignment;
+  ReadAheadReader* reader = new ReadAheadReader(fd, offset, buffer_size, true);
+  reader->ring_ = IoUring::Create(buffer_count);
+  if (!reader->Start(buffer_count)) {
+    delete reader;
+    return 0;
+  }
+  return reader;
+}
+
+bool ReadAheadReader::Start(int buffer_count) {
+  for (int i = 0; i < buffer_count; ++i) {
+    void* buffer;
+    if (posix_memalign(&buffer, kBufferAlignment, buffer_size_)) {
+      std::cerr << "ERROR: Failed to allocate read-ahead buffers.\n";
+      shutdown_ = true;  // tells the destructor there's no thread.
+      return false;
+    }
+    buffers_.push_back(static_cast<char*>(buffer));
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = buffer_size_;
+    iovecs_.push_back(iov);
+    free_.push_back(i);
+  }
+  if (pthread_create(&thread_, 0, &ReaderThreadMain, this)) {
+    std::cerr << "ERROR: Failed to start read-ahead thread.\n";
+    shutdown_ = true;
+    return false;
+  }
+  return true;
+}
+
+ReadAheadReader::ReadAheadReader(
+    int fd, off_t offset, size_t buffer_size, bool direct)
+    : fd_(fd),
+      buffer_size_(buffer_size),
+      direct_(direct),
+      ring_(0),
+      position_(offset),
+      current_(-1),
+      current_length_(0),
+      current_offset_(0),
+      fetch_offset_(offset),
+      fetch_done_(false),
+      generation_(0),
+      shutdown_(false) {
+  pthread_mutex_init(&mutex_, 0);
+  pthread_cond_init(&consumer_cond_, 0);
+  pthread_cond_init(&reader_cond_, 0);
+}
+
+ReadAheadReader::~ReadAheadReader() {
+  pthread_mutex_lock(&mutex_);
+  bool thread_running = !shutdown_;
+  shutdown_ = true;
+  pthread_cond_signal(&reader_cond_);
+  pthread_mutex_unlock(&mutex_);
+  if (thread_running)
+    pthread_join(thread_, 0);
+  for (size_t i = 0; i < buffers_.size(); ++i)
+    free(buffers_[i]);
+  delete ring_;
+  if (direct_)
+    close(fd_);
+  pthread_cond_destroy(&reader_cond_);
+  pthread_cond_destroy(&consumer_cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+/*static*/
+void* ReadAheadReader::ReaderThreadMain(void* reader) {
+  ReadAheadReader* self = static_cast<ReadAheadReader*>(reader);
+  if (self->ring_)
+    self->UringLoop();
+  else
+    self->ReaderLoop();
+  return 0;
+}
+
+off_t ReadAheadReader::StartFetch(Filled* filled) {
+  filled->buffer = free_.back();
+  free_.pop_back();
+  filled->length = 0;
+  filled->error = 0;
+  // Direct IO must start at an aligned offset; the bytes preceding the
+  // requested one are skipped by the consumer.
+  filled->skip = direct_ ? fetch_offset_ % kBufferAlignment : 0;
+  off_t offset = fetch_offset_ - filled->skip;
+  fetch_offset_ = offset + buffer_size_;
+  return offset;
+}
+
+void ReadAheadReader::ReadFully(off_t offset, Filled* filled) {
+  // Keep going on short reads so that a partial buffer always means
+  // EOF. Short reads can only follow whole blocks, so with direct IO
+  // the continuation is still aligned.
+  char* buffer = buffers_[filled->buffer];
+  while (filled->length < buffer_size_) {
+    ssize_t bytes_read = pread(fd_, buffer + filled->length,
+                               buffer_size_ - filled->length,
+                               offset + filled->length);
+    if (bytes_read < 0) {
+      if (errno == EINTR)
+        continue;
+      filled->error = errno;
+      break;
+    }
+    if (bytes_read == 0)
+      break;
+    filled->length += bytes_read;
+  }
+}
+
+void ReadAheadReader::ReaderLoop() {
+  pthread_mutex_lock(&mutex_);
+  while (true) {
+    while (!shutdown_ && (fetch_done_ || free_.empty()))
+      pthread_cond_wait(&reader_cond_, &mutex_);
+    if (shutdown_)
+      break;
+    Filled filled;
+    int generation = generation_;
+    off_t offset = StartFetch(&filled);
+
+    // Do the actual read without holding the lock.
+    pthread_mutex_unlock(&mutex_);
+    ReadFully(offset, &filled);
+    pthread_mutex_lock(&mutex_);
+
+    if (generation != generation_) {
+      // A seek happened while we were reading; the data is stale.
+      free_.push_back(filled.buffer);
+      continue;
+    }
+    if (filled.error || filled.length < buffer_size_)
+      fetch_done_ = true;
+    filled_.push_back(filled);
+    pthread_cond_signal(&consumer_cond_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+void ReadAheadReader::UringLoop() {
+  // Reads submitted to the ring, in file order. Completions may arrive
+  // in any order, but buffers are handed to the consumer in this order.
+  struct InFlight {
+    Filled filled;
+    off_t offset;
+    int generation;
+    bool done;
+  };
+  std::deque<InFlight> in_flight;
+  // Set once the ring fails. No more reads are queued, and the plain
+  // reader takes over once the reads in the kernel have completed.
+  bool ring_failed = false;
+
+  pthread_mutex_lock(&mutex_);
+  while (true) {
+    if (ring_failed && in_flight.empty()) {
+      pthread_mutex_unlock(&mutex_);
+      ReaderLoop();
+      return;
+    }
+    while (!shutdown_ && in_flight.empty() && (fetch_done_ || free_.empty()))
+      pthread_cond_wait(&reader_cond_, &mutex_);
+    // Outstanding reads must complete before their buffers are freed.
+    if (shutdown_ && in_flight.empty())
+      break;
+    while (!ring_failed && !shutdown_ && !fetch_done_ && !free_.empty()) {
+      InFlight read;
+      read.offset = StartFetch(&read.filled);
+      read.generation = generation_;
+      read.done = false;
+      int buffer = read.filled.buffer;
+      if (!ring_->QueueRead(fd_, &iovecs_[buffer], read.offset, buffer)) {
+        // The ring is full; try again once something completes.
+        free_.push_back(buffer);
+        fetch_offset_ = read.offset + read.filled.skip;
+        break;
+      }
+      in_flight.push_back(read);
+    }
+    pthread_mutex_unlock(&mutex_);
+
+    if (ring_->Submit(1/*min_complete*/)) {
+      // The reads the kernel did not accept are the last ones queued;
+      // do those synchronously. The others are still in flight, and
+      // their buffers must not be released before they complete.
+      size_t unsubmitted = ring_->DiscardQueued();
+      for (size_t i = in_flight.size() - unsubmitted; i < in_flight.size();
+           ++i) {
+        ReadFully(in_flight[i].offset, &in_flight[i].filled);
+        in_flight[i].done = true;
+      }
+      ring_failed = true;
+    }
+    uint64_t buffer;
+    int result;
+    while (ring_->PopCompletion(&buffer, &result)) {
+      for (size_t i = 0; i < in_flight.size(); ++i) {
+        Filled& filled = in_flight[i].filled;
+        if (in_flight[i].done || filled.buffer != static_cast<int>(buffer))
+          continue;
+        if (result < 0) {
+          filled.error = -result;
+        } else {
+          filled.length = result;
+          if (filled.length > 0 && filled.length < buffer_size_)
+            ReadFully(in_flight[i].offset, &filled);
+        }
+        in_flight[i].done = true;
+        break;
+      }
+    }
+
+    pthread_mutex_lock(&mutex_);
+    while (!in_flight.empty() && in_flight.front().done) {
+      const InFlight& read = in_flight.front();
+      if (shutdown_ || read.generation != generation_ || fetch_done_) {
+        // Stale after a seek, or beyond EOF.
+        free_.push_back(read.filled.buffer);
+      } else {
+        if (read.filled.error || read.filled.length < buffer_size_)
+          fetch_done_ = true;
+        filled_.push_back(read.filled);
+        pthread_cond_signal(&consumer_cond_);
+      }
+      in_flight.pop_front();
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+bool ReadAheadReader::NextBuffer() {
+  pthread_mutex_lock(&mutex_);
+  if (current_ >= 0) {
+    free_.push_back(current_);
+    current_ = -1;
+    pthread_cond_signal(&reader_cond_);
+  }
+  while (filled_.empty() && !fetch_done_)
+    pthread_cond_wait(&consumer_cond_, &mutex_);
+  if (filled_.empty()) {
+    // The reader has stopped and handed over everything it read.
+    pthread_mutex_unlock(&mutex_);
+    return false;
+  }
+  Filled filled = filled_.front();
+  filled_.pop_front();
+  pthread_mutex_unlock(&mutex_);
+
+  current_ = filled.buffer;
+  current_length_ = filled.length;
+  current_offset_ = filled.skip;
+  if (filled.error) {
+    error_ = "read failed: " + std::string(strerror(filled.error));
+    current_length_ = current_offset_ = 0;
+    return false;
+  }
+  if (current_offset_ > current_length_)
+    current_offset_ = current_length_;  // the requested offset is past EOF.
+  return current_length_ != current_offset_;
+}
+
+size_t ReadAheadReader::Read(void* buffer, size_t bytes) {
+  char* out = static_cast<char*>(buffer);
+  size_t copied = 0;
+  while (copied < bytes) {
+    if (current_ < 0 || current_offset_ == current_length_) {
+      if (!NextBuffer())
+        break;
+    }
+    size_t chunk = current_length_ - current_offset_;
+    if (chunk > bytes - copied)
+      chunk = bytes - copied;
+    memcpy(out + copied, buffers_[current_] + current_offset_, chunk);
+    current_offset_ += chunk;
+    copied += chunk;
+  }
+  position_ += copied;
+  return copied;
+}
+
+void ReadAheadReader::Seek(off_t offset) {
+  if (offset == position_)
+    return;
+  // Seeks within the buffer being consumed need not disturb the
+  // reader thread.
+  off_t current_start = position_ - current_offset_;
+  if (current_ >= 0 && offset >= current_start &&
+      offset < current_start + static_cast<off_t>(current_length_)) {
+    current_offset_ = offset - current_start;
+    position_ = offset;
+    return;
+  }
+  pthread_mutex_lock(&mutex_);
+  ++generation_;
+  if (current_ >= 0) {
+    free_.push_back(current_);
+    current_ = -1;
+  }
+  while (!filled_.empty()) {
+    free_.push_back(filled_.front().buffer);
+    filled_.pop_front();
+  }
+  fetch_offset_ = offset;
+  fetch_done_ = false;
+  pthread_cond_signal(&reader_cond_);
+  pthread_mutex_unlock(&mutex_);
+  position_ = offset;
+  error_.clear();
+}
+
+}  // namespace google_extremal_sets
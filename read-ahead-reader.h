@@ -0,0 +1,136 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// A sequential file reader that fills a pool of large aligned buffers
+// on a background thread, so that the consumer of the data rarely
+// stalls on disk. Optionally bypasses the page cache with O_DIRECT, in
+// which case several reads are kept in flight through io_uring when
+// the kernel supports it.
+// ---
+// Author: Roberto Bayardo
+
+#ifndef _READ_AHEAD_READER_H_
+#define _READ_AHEAD_READER_H_
+
+#include <pthread.h>
+#include <sys/uio.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "basic-types.h"
+
+namespace google_extremal_sets {
+
+class IoUring;
+
+class ReadAheadReader {
+ public:
+  // Factory method for obtaining a reader of the open file descriptor
+  // fd, beginning at the given offset. Uses buffer_count buffers of
+  // buffer_size bytes each. Does not assume ownership of fd. Returns
+  // NULL on error and reports the error details to stderr.
+  static ReadAheadReader* Get(
+      int fd, off_t offset, int buffer_count, size_t buffer_size);
+
+  // Like Get, but opens the file at path itself with O_DIRECT so that
+  // the data does not pass through (or evict other pages from) the page
+  // cache. Reads are issued at aligned offsets, and all buffers are
+  // kept in flight at once through io_uring if available; otherwise
+  // the reads are made one at a time. Returns NULL on error (including
+  // file systems that do not support O_DIRECT) and reports the error
+  // details to stderr.
+  static ReadAheadReader* GetDirect(
+      const char* path, off_t offset, int buffer_count, size_t buffer_size);
+  ~ReadAheadReader();
+
+  // Copies up to "bytes" bytes from the current position into
+  // buffer. Returns the number of bytes copied, which is less than
+  // requested only at EOF or on a read error. Use HasError() to tell
+  // the two apart.
+  size_t Read(void* buffer, size_t bytes);
+
+  // Repositions the reader. Buffers prefetched for the old position
+  // are discarded and read-ahead restarts at the new offset.
+  void Seek(off_t offset);
+  off_t Tell() const { return position_; }
+
+  bool HasError() const { return !error_.empty(); }
+  std::string GetErrorMessage() const { return error_; }
+
+ private:
+  ReadAheadReader(int fd, off_t offset, size_t buffer_size, bool direct);
+
+  // Allocates the buffers and starts the background thread. Returns
+  // false on error, in which case the reader must be deleted.
+  bool Start(int buffer_count);
+
+  // Entry point & main loops of the background thread. UringLoop is
+  // used when ring_ is available, and ReaderLoop otherwise.
+  static void* ReaderThreadMain(void* reader);
+  void ReaderLoop();
+  void UringLoop();
+
+  // Hands the exhausted current buffer back to the reader thread and
+  // waits for the next one. Returns false on EOF or error.
+  bool NextBuffer();
+
+  // A prefetched buffer, identified by its index within buffers_.
+  struct Filled {
+    int buffer;
+    size_t length;
+    size_t skip;  // leading bytes preceding the requested offset.
+    int error;    // errno of a failed read, 0 otherwise.
+  };
+
+  // Takes a free buffer for the read at fetch_offset_ and advances
+  // fetch_offset_ past it. Returns the file offset the buffer is to be
+  // read from. Must be called with mutex_ held.
+  off_t StartFetch(Filled* filled);
+
+  // Reads the rest of the buffer synchronously, starting
+  // filled->length bytes past offset. Stops short only at EOF or on
+  // error.
+  void ReadFully(off_t offset, Filled* filled);
+
+  const int fd_;
+  const size_t buffer_size_;
+  const bool direct_;  // fd_ was opened with O_DIRECT by GetDirect.
+  std::vector<char*> buffers_;
+  std::vector<struct iovec> iovecs_;  // describes each of buffers_.
+  IoUring* ring_;  // NULL unless reading through io_uring.
+
+  // Consumer state, only touched by the consuming thread.
+  off_t position_;
+  int current_;  // index of the buffer being consumed, or -1.
+  size_t current_length_;
+  size_t current_offset_;
+  std::string error_;
+
+  // State shared with the reader thread, guarded by mutex_.
+  pthread_mutex_t mutex_;
+  pthread_cond_t consumer_cond_;
+  pthread_cond_t reader_cond_;
+  pthread_t thread_;
+  std::vector<int> free_;       // buffers available for filling.
+  std::deque<Filled> filled_;   // buffers ready for consumption, in order.
+  off_t fetch_offset_;          // file offset of the next read.
+  bool fetch_done_;             // reader hit EOF/error at fetch_offset_.
+  int generation_;              // incremented on every Seek.
+  bool shutdown_;
+};
+
+}  // namespace google_extremal_sets
+
+#endif  // _READ_AHEAD_READER_H_
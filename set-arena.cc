@@ -0,0 +1,104 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ---
+// Author: Roberto Bayardo
+
+#include "set-arena.h"
+
+#include <new>
+
+#include "huge-page-allocator.h"
+#include "set-properties.h"
+
+namespace {
+
+// Minimum size of each arena chunk. Itemsets larger than a quarter of
+// it are allocated on their own so that little of a chunk is ever
+// wasted.
+const size_t kChunkBytes = 1 << 20;
+const size_t kMaxChunkedBytes = kChunkBytes / 4;
+
+}  // namespace
+
+namespace google_extremal_sets {
+
+SetArena::SetArena()
+    : chunk_bytes_(kChunkBytes),
+      current_chunk_(0),
+      cursor_(0),
+      end_(0),
+      bytes_reserved_(0) {
+  // Mapped chunks span whole (possibly huge) pages.
+  if (LargeAllocationsMapped() && AllocationPageSize() > chunk_bytes_)
+    chunk_bytes_ = AllocationPageSize();
+}
+
+SetArena::~SetArena() {
+  Clear();
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    if (LargeAllocationsMapped())
+      FreeLarge(chunks_[i], chunk_bytes_);
+    else
+      ::operator delete(chunks_[i]);
+  }
+}
+
+char* SetArena::Allocate(size_t bytes) {
+  if (bytes > kMaxChunkedBytes) {
+    char* memory = static_cast<char*>(::operator new(bytes));
+    large_.push_back(memory);
+    bytes_reserved_ += bytes;
+    return memory;
+  }
+  if (static_cast<size_t>(end_ - cursor_) < bytes) {
+    if (cursor_)
+      ++current_chunk_;
+    if (current_chunk_ == chunks_.size()) {
+      chunks_.push_back(static_cast<char*>(
+          LargeAllocationsMapped() ? AllocateLarge(chunk_bytes_)
+                                   : ::operator new(chunk_bytes_)));
+      bytes_reserved_ += chunk_bytes_;
+    }
+    cursor_ = chunks_[current_chunk_];
+    end_ = cursor_ + chunk_bytes_;
+  }
+  char* memory = cursor_;
+  cursor_ += bytes;
+  return memory;
+}
+
+template <typename ItemId>
+BasicSetProperties<ItemId>* SetArena::Create(const SetProperties& copy_me) {
+  // Objects are kept 4-byte aligned, which narrow items may not be a
+  // multiple of.
+  size_t object_size = (sizeof(BasicSetProperties<ItemId>) +
+                        sizeof(ItemId) * copy_me.size + 3) & ~3;
+  return new (Allocate(object_size)) BasicSetProperties<ItemId>(copy_me);
+}
+
+template SetProperties* SetArena::Create<uint32_t>(const SetProperties&);
+template NarrowSetProperties* SetArena::Create<uint16_t>(
+    const SetProperties&);
+
+void SetArena::Clear() {
+  for (size_t i = 0; i < large_.size(); ++i) {
+    ::operator delete(large_[i]);
+  }
+  large_.clear();
+  bytes_reserved_ = chunks_.size() * chunk_bytes_;
+  current_chunk_ = 0;
+  cursor_ = end_ = 0;
+}
+
+}  // namespace google_extremal_sets
@@ -0,0 +1,79 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// SetArena: allocates SetProperties objects back to back from large
+// chunks of memory, which are released all at once.
+// ---
+// Author: Roberto Bayardo
+
+#ifndef _SET_ARENA_H_
+#define _SET_ARENA_H_
+
+#include <vector>
+#include "basic-types.h"
+
+namespace google_extremal_sets {
+
+// Itemsets created by an arena carry no per-object allocator overhead
+// and cannot be freed individually; a set that is no longer needed is
+// simply forgotten (e.g. its pointer is NULLed out), and its memory is
+// reclaimed by the next Clear().
+class SetArena {
+ public:
+  SetArena();
+  ~SetArena();
+
+  // Returns a copy of the given itemset allocated from the arena, with
+  // its items stored as ItemIds, which they must fit (see
+  // BasicSetProperties::Fits). The copy is valid until the next call
+  // to Clear().
+  template <typename ItemId>
+  BasicSetProperties<ItemId>* Create(const SetProperties& copy_me);
+
+  // Releases all itemsets created by the arena. The chunks are
+  // retained and reused by subsequent calls to Create().
+  void Clear();
+
+  // Total number of bytes of memory held by the arena.
+  size_t BytesReserved() const { return bytes_reserved_; }
+
+ private:
+  // Returns memory for an object of the given size, which must be a
+  // multiple of 4.
+  char* Allocate(size_t bytes);
+
+  // Chunks of chunk_bytes_ each, which are mapped according to the
+  // allocation policy (see huge-page-allocator.h) if one is set. Those
+  // preceding current_chunk_ are full; the free space of the current
+  // one is [cursor_, end_).
+  size_t chunk_bytes_;
+  std::vector<char*> chunks_;
+  size_t current_chunk_;
+  char* cursor_;
+  char* end_;
+
+  // Itemsets too large to share a chunk are allocated individually.
+  std::vector<char*> large_;
+
+  size_t bytes_reserved_;
+
+  // Not copyable.
+  SetArena(const SetArena&);
+  void operator=(const SetArena&);
+};
+
+}  // namespace google_extremal_sets
+
+#endif  // _SET_ARENA_H_
@@ -15,39 +15,67 @@
 // ---
 // Author: Roberto Bayardo
 
-#include <string.h>
+#include <algorithm>
 #include <iostream>
+#include <new>
 #include "set-properties.h"
 
 namespace google_extremal_sets {
 
-SetProperties::SetProperties(int id, const ItemSet& items)
+template <typename ItemId>
+BasicSetProperties<ItemId>::BasicSetProperties(int id, const ItemSet& items)
     : set_id(id),
       size(items.size()) {
-  memcpy(item, &(items[0]), (sizeof(uint32_t) * items.size()));
+  std::copy(items.begin(), items.end(), item);
 }
 
+template <typename ItemId>
 /*static*/
-SetProperties* SetProperties::Create(
+BasicSetProperties<ItemId>* BasicSetProperties<ItemId>::Create(
     uint32_t set_id, const ItemSet& items) {
   size_t object_size =
-      sizeof(SetProperties) + (sizeof(uint32_t) * items.size());
-  return new (::operator new (object_size)) SetProperties(set_id, items);
+      sizeof(BasicSetProperties) + (sizeof(ItemId) * items.size());
+  return new (::operator new (object_size)) BasicSetProperties(set_id, items);
 }
 
+template <typename ItemId>
+BasicSetProperties<ItemId>::BasicSetProperties(const SetProperties& copy_me)
+    : set_id(copy_me.set_id),
+      size(copy_me.size) {
+  std::copy(copy_me.begin(), copy_me.end(), item);
+}
+
+template <typename ItemId>
 /*static*/
-void SetProperties::Delete(SetProperties* delete_me) {
-  ::operator delete(delete_me);
+BasicSetProperties<ItemId>* BasicSetProperties<ItemId>::Create(
+    const SetProperties& copy_me) {
+  size_t object_size =
+      sizeof(BasicSetProperties) + (sizeof(ItemId) * copy_me.size);
+  return new (::operator new (object_size)) BasicSetProperties(copy_me);
 }
 
-std::ostream& operator<<(std::ostream& os, const SetProperties& output_me) {
+template <typename ItemId>
+/*static*/
+void BasicSetProperties<ItemId>::Delete(
+    const BasicSetProperties* delete_me) {
+  ::operator delete(const_cast<BasicSetProperties*>(delete_me));
+}
+
+template <typename ItemId>
+std::ostream& operator<<(
+    std::ostream& os, const BasicSetProperties<ItemId>& output_me) {
   os << output_me.set_id << ": ";
   for (uint32_t i = 0; i < output_me.size; ++i) {
     if (i != 0)
       os << ' ';
-    os << output_me.item[i];
+    os << static_cast<uint32_t>(output_me.item[i]);
   }
   return os;
 }
 
+template class BasicSetProperties<uint32_t>;
+template class BasicSetProperties<uint16_t>;
+template std::ostream& operator<<(std::ostream&, const SetProperties&);
+template std::ostream& operator<<(std::ostream&, const NarrowSetProperties&);
+
 }  // namespace google_extremal_sets
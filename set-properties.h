@@ -21,36 +21,69 @@
 #ifndef _SET_PROPERTIES_H_
 #define _SET_PROPERTIES_H_
 
+#include <iosfwd>
 #include "basic-types.h"
 
 namespace google_extremal_sets {
 
-class SetProperties {
+// The memory layout of a SetProperties object is identical to that of
+// an "apriori binary" record (id, size, then the items), so records of
+// a memory-mapped dataset can be viewed as SetProperties directly.
+//
+// The class is a template over the type of the item ids, which is
+// uint32_t for SetProperties, and uint16_t for NarrowSetProperties,
+// whose items take half the memory (see basic-types.h).
+template <typename ItemId>
+class BasicSetProperties {
  public:
-  const uint32_t* begin() const { return item; }
-  const uint32_t* end() const { return item + size; }
+  const ItemId* begin() const { return item; }
+  const ItemId* end() const { return item + size; }
   uint32_t operator[](uint32_t idx) const { return item[idx]; }
 
   uint32_t set_id;
   uint32_t size;
-  uint32_t item[0];
+  ItemId item[0];
 
   // Factory method for constructing SetProperties objects. Objects
   // allocated with this factory must be released by
-  // Delete().
-  static SetProperties* Create(
+  // Delete(). Every item must fit in an ItemId.
+  static BasicSetProperties* Create(
       uint32_t set_id, const ItemSet& items);
 
+  // Like above, but copies an existing itemset, e.g. a read-only view
+  // returned by DataSourceIterator.
+  static BasicSetProperties* Create(const SetProperties& copy_me);
+
   // Releases memory used by the SetProperties object, which must have
-  // been constructed with the Create factory method.
-  static void Delete(SetProperties* s);
+  // been constructed with the Create factory method. (Objects can also
+  // be allocated from a SetArena, which releases them in bulk.)
+  static void Delete(const BasicSetProperties* s);
+
+  // Returns true if every item of the given itemset fits in an ItemId,
+  // so that it can be copied.
+  static bool Fits(const SetProperties& set);
 
  private:
+  friend class SetArena;
+
   // Do not use this constructor directly. Use Create().
-  SetProperties(int set_id, const ItemSet& items);
+  BasicSetProperties(int set_id, const ItemSet& items);
+  BasicSetProperties(const SetProperties& copy_me);
 };
 
-std::ostream& operator<<(std::ostream&, const SetProperties& output_me);
+template <typename ItemId>
+std::ostream& operator<<(
+    std::ostream&, const BasicSetProperties<ItemId>& output_me);
+
+template <typename ItemId>
+inline bool BasicSetProperties<ItemId>::Fits(const SetProperties& set) {
+  if (sizeof(ItemId) >= sizeof(uint32_t))
+    return true;
+  uint32_t high_bits = 0;
+  for (uint32_t i = 0; i < set.size; ++i)
+    high_bits |= set.item[i] & ~static_cast<uint32_t>(ItemId(-1));
+  return high_bits == 0;
+}
 
 struct SetPropertiesCompareFunctor {
   bool operator()(SetProperties* s1, SetProperties* s2) const {
@@ -0,0 +1,133 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// SmallSet: a fixed-width record holding a small itemset inline, and
+// ItemMatcher, which tests items against a small itemset with SIMD
+// instructions.
+// ---
+// Author: Roberto Bayardo
+
+#ifndef _SMALL_SET_H_
+#define _SMALL_SET_H_
+
+#include <string.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "basic-types.h"
+#include "set-properties.h"
+
+namespace google_extremal_sets {
+
+// A non-empty itemset of at most Width items, stored inline so that
+// records can be packed contiguously in an array instead of being
+// allocated individually and reached through a pointer. The layout
+// matches that of BasicSetProperties<ItemId>, as which a record can be
+// viewed.
+template <uint32_t Width, typename ItemId = uint32_t>
+class SmallSet {
+ public:
+  static const uint32_t kWidth = Width;
+
+  // The given itemset must have between 1 and Width items, each of
+  // which fits in an ItemId.
+  explicit SmallSet(const SetProperties& set)
+      : set_id_(set.set_id), size_(set.size) {
+    std::copy(set.begin(), set.end(), items_);
+    std::fill(items_ + set.size, items_ + Width, 0);
+  }
+
+  const BasicSetProperties<ItemId>& set() const {
+    return *reinterpret_cast<const BasicSetProperties<ItemId>*>(this);
+  }
+
+  // Records are deleted by marking them empty, so that arrays of them
+  // can keep their order.
+  bool deleted() const { return size_ == 0; }
+  void Delete() { size_ = 0; }
+
+ private:
+  uint32_t set_id_;
+  uint32_t size_;
+  ItemId items_[Width];
+};
+
+// Holds an itemset of at most kMaxItems items in SIMD registers, so
+// that testing whether it contains an item takes a handful of
+// instructions and no data-dependent branches. Unused lanes repeat the
+// last item, so they never change the outcome of a test.
+class ItemMatcher {
+ public:
+  static const uint32_t kMaxItems = 16;
+
+  // Loads the given itemset, which must have between 1 and kMaxItems
+  // items.
+  void Load(const uint32_t* items, uint32_t size) {
+    uint32_t padded[kMaxItems];
+    memcpy(padded, items, size * sizeof(uint32_t));
+    for (uint32_t i = size; i < kMaxItems; ++i)
+      padded[i] = items[size - 1];
+    registers_ = (size + 3) / 4;
+#ifdef __SSE2__
+    for (int i = 0; i < 4; ++i) {
+      lanes_[i] = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(padded + 4 * i));
+    }
+#else
+    memcpy(items_, padded, sizeof(items_));
+#endif
+  }
+
+  bool Contains(uint32_t item) const {
+#ifdef __SSE2__
+    __m128i key = _mm_set1_epi32(item);
+    __m128i equal = _mm_cmpeq_epi32(key, lanes_[0]);
+    for (int i = 1; i < registers_; ++i)
+      equal = _mm_or_si128(equal, _mm_cmpeq_epi32(key, lanes_[i]));
+    return _mm_movemask_epi8(equal) != 0;
+#else
+    for (int i = 0; i < 4 * registers_; ++i) {
+      if (items_[i] == item)
+        return true;
+    }
+    return false;
+#endif
+  }
+
+  // Returns true if every item in [begin, end) is among the loaded
+  // items.
+  template <typename ItemId>
+  bool ContainsAll(const ItemId* begin, const ItemId* end) const {
+    for (; begin != end; ++begin) {
+      if (!Contains(*begin))
+        return false;
+    }
+    return true;
+  }
+
+ private:
+#ifdef __SSE2__
+  __m128i lanes_[4];
+#else
+  uint32_t items_[kMaxItems];
+#endif
+  // Number of groups of 4 lanes holding items.
+  int registers_;
+};
+
+}  // namespace google_extremal_sets
+
+#endif  // _SMALL_SET_H_
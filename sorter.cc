@@ -21,6 +21,7 @@
 #include <iostream>
 #include <vector>
 
+#include "apriori-writer.h"
 #include "basic-types.h"
 #include "data-source-iterator.h"
 #include "set-properties.h"
@@ -31,13 +32,11 @@ SetPropertiesCompareFunctor compare_set_properties;
 SetPropertiesCardinalityCompareFunctor compare_set_properties_cardinality;
 
 bool Sort(
-    DataSourceIterator* data, const char* output_path, bool by_cardinality) {
-  FILE* output_file = fopen(output_path, "wb");
-  if (!output_file) {
-    std::cerr << "; Could not open output file for writing: "
-              << output_path << "\n";
-    return false;
-  }
+    DataSourceIterator* data,
+    const char* output_path,
+    bool by_cardinality,
+    bool compress,
+    uint32_t index_interval) {
   uint32_t set_id;
   std::vector<uint32_t> itemset;
   std::vector<SetProperties*> sort_us;
@@ -71,19 +70,32 @@ bool Sort(
     sort(sort_us.begin(), sort_us.end(), compare_set_properties_cardinality);
   else
     sort(sort_us.begin(), sort_us.end(), compare_set_properties);
+  DatasetMetadata metadata;
+  metadata.sort_order = by_cardinality ? SORT_CARDINALITY : SORT_LEXICOGRAPHIC;
+  for (uint32_t i = 0; i < sort_us.size(); ++i)
+    metadata.Add(sort_us[i]->item, sort_us[i]->size);
+  AprioriWriter* output_file = AprioriWriter::Get(
+      output_path,
+      compress ? AprioriWriter::COMPRESSED : AprioriWriter::BINARY,
+      true/*front_coded*/,
+      &metadata);
+  if (!output_file)
+    return false;
+  output_file->EnableIndex(index_interval);
   std::cerr
       << "; Writing " << sort_us.size() << " itemsets to file..." << std::endl;
   for (uint32_t i = 0; i < sort_us.size(); ++i) {
     SetProperties* set = sort_us[i];
-    if (!fwrite(set, sizeof(uint32_t), 2 + set->size, output_file)) {
+    if (!output_file->Write(*set)) {
       // TODO: fix mem leak
+      delete output_file;
       return false;
     }
     SetProperties::Delete(set);
   }
-  if (fclose(output_file))
-    return false;
-  return true;
+  bool success = output_file->Close();
+  delete output_file;
+  return success;
 }
 
 }  // namespace google_extremal_sets
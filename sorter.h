@@ -20,18 +20,24 @@
 #ifndef _SORTER_H_
 #define _SORTER_H_
 
+#include "basic-types.h"
+
 namespace google_extremal_sets {
 
 class DataSourceIterator;
 
 // Sorts the input data and writes it to the output_file in apriori
-// binary format. Returns false on IO error. Sort order is increasing
+// binary format, or in compressed apriori format if compress is
+// true. Returns false on IO error. Sort order is increasing
 // lexicographic if by_cardinality is false, and increasing cardinality
-// otherwise.
+// otherwise. If index_interval is non-zero, an index sidecar recording
+// the position of every index_interval-th itemset is written as well.
 bool Sort(
     DataSourceIterator* data,
     const char* output_path,
-    bool by_cardinality);
+    bool by_cardinality,
+    bool compress,
+    uint32_t index_interval);
 
 }  // namespace util
 
@@ -0,0 +1,60 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ---
+// Author: Roberto Bayardo
+
+#include "text-to-apriori.h"
+
+#include <iostream>
+#include <vector>
+
+#include "apriori-writer.h"
+#include "basic-types.h"
+#include "data-source-iterator.h"
+
+namespace google_extremal_sets {
+
+bool TextToApriori(
+    DataSourceIterator* data, const char* output_path, bool compress) {
+  AprioriWriter* output_file = AprioriWriter::Get(
+      output_path,
+      compress ? AprioriWriter::COMPRESSED : AprioriWriter::BINARY,
+      true/*front_coded*/,
+      0/*metadata*/);
+  if (!output_file)
+    return false;
+
+  uint32_t set_id;
+  std::vector<uint32_t> itemset;
+  uint64_t sets_written = 0;
+  int result;
+  std::cerr << "; Converting data..." << std::endl;
+  while ((result = data->NextText(&set_id, &itemset)) == 1) {
+    if (!output_file->Write(set_id, itemset)) {
+      delete output_file;
+      return false;
+    }
+    ++sets_written;
+  }
+  if (result < 0) {
+    delete output_file;
+    return false;
+  }
+  bool success = output_file->Close();
+  delete output_file;
+  std::cerr << "; Wrote " << sets_written << " itemsets." << std::endl;
+  return success;
+}
+
+}  // namespace google_extremal_sets
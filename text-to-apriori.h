@@ -0,0 +1,40 @@
+// Copyright 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ---
+// Utility for converting a text format dataset into an apriori binary
+// or compressed apriori dataset.
+// ---
+// Author: Roberto Bayardo
+//
+#ifndef _TEXT_TO_APRIORI_H_
+#define _TEXT_TO_APRIORI_H_
+
+namespace google_extremal_sets {
+
+class DataSourceIterator;
+
+// Streams the text format itemsets from data (see
+// DataSourceIterator::NextText) to output_path, in the same order and
+// without modifying them. The output is in the compressed apriori
+// format if compress is true, in which case the items of every set
+// must be strictly increasing. Returns false on error.
+bool TextToApriori(
+    DataSourceIterator* data,
+    const char* output_path,
+    bool compress);
+
+}  // namespace google_extremal_sets
+
+#endif  // _TEXT_TO_APRIORI_H_